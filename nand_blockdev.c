@@ -0,0 +1,363 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_blockdev.c
+    Description: Sector based block device interface on top of nand_m79a, for use as the
+                 disk layer of FatFs, littlefs and similar file systems.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include <string.h>
+
+#include "nand_blockdev.h"
+
+#define CACHE_EMPTY         0xFFFFFFFF
+#define ALL_SECTORS         ((1 << NAND_SECTORS_PER_PAGE) - 1)
+
+/* one page write-back cache */
+static uint8_t  cache[PAGE_DATA_SIZE];
+static uint32_t cache_page = CACHE_EMPTY;   // logical page held in cache
+static uint8_t  cache_valid;                // bitmask of sectors present in cache
+static uint8_t  cache_dirty;                // bitmask of sectors not yet written to flash
+
+
+/******************************************************************************
+ *                              Initialization
+ *****************************************************************************/
+
+/**
+    @brief Initializes the NAND and empties the sector cache.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Init
+ */
+NAND_ReturnType NAND_BlockDev_Init(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    NAND_ReturnType status = __blockdev_init(hspi);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_BlockDev_Init without the device lock */
+NAND_ReturnType __blockdev_init(SPI_HandleTypeDef *hspi) {
+    cache_page  = CACHE_EMPTY;
+    cache_valid = 0;
+    cache_dirty = 0;
+
+    return NAND_Init(hspi);
+}
+
+/**
+    @brief Reports the sector count, sector size and erase block size.
+ */
+void NAND_BlockDev_Get_Geometry(NAND_BlockDev_Geometry *geometry) {
+    geometry -> sector_count     = NAND_SECTOR_COUNT;
+    geometry -> sector_size      = NAND_SECTOR_SIZE;
+    geometry -> erase_block_size = NUM_PAGES_PER_BLOCK * NAND_SECTORS_PER_PAGE;
+}
+
+
+/******************************************************************************
+ *                              Reads and Writes
+ *****************************************************************************/
+
+/**
+    @brief Reads count sectors starting at sector.
+    @note Sectors held in the write-back cache are served from it; all other sectors are
+          read with as few NAND_Read calls as possible.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_BlockDev_Read(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count) {
+    NAND_OS_Lock();
+    NAND_ReturnType status = __blockdev_read(hspi, sector, buffer, count);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_BlockDev_Read without the device lock */
+NAND_ReturnType __blockdev_read(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count) {
+    NAND_ReturnType status;
+
+    if (sector >= NAND_SECTOR_COUNT || count > NAND_SECTOR_COUNT - sector) {
+        return Ret_AddressInvalid;
+    }
+
+    while (count > 0) {
+        uint32_t page  = sector / NAND_SECTORS_PER_PAGE;
+        uint8_t  first = sector % NAND_SECTORS_PER_PAGE;
+        uint32_t run;
+
+        if (page == cache_page) {
+            run = NAND_SECTORS_PER_PAGE - first;
+            if (run > count) {
+                run = count;
+            }
+            uint8_t mask = ((1 << run) - 1) << first;
+            if ((cache_valid & mask) != mask) {
+                status = __blockdev_fill_cache(hspi);
+                if (status != Ret_Success) {
+                    return status;
+                }
+            }
+            memcpy(buffer, &cache[first * NAND_SECTOR_SIZE], run * NAND_SECTOR_SIZE);
+        } else {
+            /* read directly up to the cached page, if it lies within the request */
+            run = count;
+            if (cache_page != CACHE_EMPTY && cache_page > page &&
+                cache_page * NAND_SECTORS_PER_PAGE < sector + count) {
+                run = cache_page * NAND_SECTORS_PER_PAGE - sector;
+            }
+            NAND_Addr addr = sector * NAND_SECTOR_SIZE;
+            status = NAND_Read(hspi, &addr, buffer, run * NAND_SECTOR_SIZE);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+
+        sector += run;
+        buffer += run * NAND_SECTOR_SIZE;
+        count  -= run;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Writes count sectors starting at sector.
+    @note Whole pages are programmed directly from buffer. Sectors covering only part of a
+          page go through the write-back cache; call NAND_BlockDev_Sync to make them durable.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_BlockDev_Write(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count) {
+    NAND_OS_Lock();
+    NAND_ReturnType status = __blockdev_write(hspi, sector, buffer, count);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_BlockDev_Write without the device lock */
+NAND_ReturnType __blockdev_write(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count) {
+    NAND_ReturnType status;
+
+    if (sector >= NAND_SECTOR_COUNT || count > NAND_SECTOR_COUNT - sector) {
+        return Ret_AddressInvalid;
+    }
+
+    while (count > 0) {
+        uint32_t page  = sector / NAND_SECTORS_PER_PAGE;
+        uint8_t  first = sector % NAND_SECTORS_PER_PAGE;
+        uint32_t run;
+
+        if (first == 0 && count >= NAND_SECTORS_PER_PAGE) {
+            /* run of whole pages: the cached copy of any of them is superseded */
+            uint32_t pages = count / NAND_SECTORS_PER_PAGE;
+            run = pages * NAND_SECTORS_PER_PAGE;
+
+            if (cache_page != CACHE_EMPTY && cache_page >= page && cache_page < page + pages) {
+                cache_page  = CACHE_EMPTY;
+                cache_valid = 0;
+                cache_dirty = 0;
+            }
+
+            NAND_Addr addr = page * PAGE_DATA_SIZE;
+            status = NAND_Write(hspi, &addr, buffer, pages * PAGE_DATA_SIZE);
+            if (status != Ret_Success) {
+                return status;
+            }
+        } else {
+            run = NAND_SECTORS_PER_PAGE - first;
+            if (run > count) {
+                run = count;
+            }
+
+            if (page != cache_page) {
+                status = __blockdev_flush_cache(hspi);
+                if (status != Ret_Success) {
+                    return status;
+                }
+                cache_page  = page;
+                cache_valid = 0;
+            }
+
+            uint8_t mask = ((1 << run) - 1) << first;
+            memcpy(&cache[first * NAND_SECTOR_SIZE], buffer, run * NAND_SECTOR_SIZE);
+            cache_valid |= mask;
+            cache_dirty |= mask;
+
+            /* a completely rewritten page will not change again soon */
+            if (cache_dirty == ALL_SECTORS) {
+                status = __blockdev_flush_cache(hspi);
+                if (status != Ret_Success) {
+                    return status;
+                }
+            }
+        }
+
+        sector += run;
+        buffer += run * NAND_SECTOR_SIZE;
+        count  -= run;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Writes the cached page to flash if it holds unwritten sectors, then makes all
+           writes durable with NAND_Sync.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Write and NAND_Sync
+ */
+NAND_ReturnType NAND_BlockDev_Sync(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    NAND_ReturnType status = __blockdev_sync(hspi);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_BlockDev_Sync without the device lock */
+NAND_ReturnType __blockdev_sync(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status = __blockdev_flush_cache(hspi);
+
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    return NAND_Sync(hspi);
+}
+
+/**
+    @brief Tells the device that count sectors starting at sector hold no useful data.
+    @note Cached sectors in the range are dropped and whole pages in the range are passed
+          to NAND_Trim. Trimmed sectors read back undefined.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Return values of NAND_Trim
+ */
+NAND_ReturnType NAND_BlockDev_Trim(SPI_HandleTypeDef *hspi, uint32_t sector, uint32_t count) {
+    NAND_OS_Lock();
+    NAND_ReturnType status = __blockdev_trim(hspi, sector, count);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_BlockDev_Trim without the device lock */
+NAND_ReturnType __blockdev_trim(SPI_HandleTypeDef *hspi, uint32_t sector, uint32_t count) {
+    if (sector >= NAND_SECTOR_COUNT || count > NAND_SECTOR_COUNT - sector) {
+        return Ret_AddressInvalid;
+    }
+
+    if (cache_page != CACHE_EMPTY) {
+        uint32_t cache_first = cache_page * NAND_SECTORS_PER_PAGE;
+        for (uint8_t i = 0; i < NAND_SECTORS_PER_PAGE; i++) {
+            if (cache_first + i >= sector && cache_first + i < sector + count) {
+                cache_dirty &= ~(1 << i);
+            }
+        }
+        if (cache_dirty == 0) {
+            cache_page  = CACHE_EMPTY;
+            cache_valid = 0;
+        }
+    }
+
+    NAND_Addr addr = sector * NAND_SECTOR_SIZE;
+    return NAND_Trim(hspi, &addr, count * NAND_SECTOR_SIZE);
+}
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+/**
+    @brief Reads the sectors of the cached page that are not present in the cache yet.
+    @note Each run of missing sectors is one NAND_Read call.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Read
+ */
+NAND_ReturnType __blockdev_fill_cache(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status;
+    uint8_t i = 0;
+
+    while (i < NAND_SECTORS_PER_PAGE) {
+        if (cache_valid & (1 << i)) {
+            i++;
+            continue;
+        }
+
+        uint8_t run = 1;
+        while (i + run < NAND_SECTORS_PER_PAGE && !(cache_valid & (1 << (i + run)))) {
+            run++;
+        }
+
+        NAND_Addr addr = cache_page * PAGE_DATA_SIZE + i * NAND_SECTOR_SIZE;
+        status = NAND_Read(hspi, &addr, &cache[i * NAND_SECTOR_SIZE], run * NAND_SECTOR_SIZE);
+        if (status != Ret_Success) {
+            return status;
+        }
+
+        cache_valid |= ((1 << run) - 1) << i;
+        i += run;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Programs the cached page if any of its sectors are dirty.
+    @note Sectors that were never loaded are read first so the page is written once, whole.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Read and NAND_Write
+ */
+NAND_ReturnType __blockdev_flush_cache(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status;
+
+    if (cache_page == CACHE_EMPTY || cache_dirty == 0) {
+        return Ret_Success;
+    }
+
+    if (cache_valid != ALL_SECTORS) {
+        status = __blockdev_fill_cache(hspi);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    NAND_Addr addr = cache_page * PAGE_DATA_SIZE;
+    status = NAND_Write(hspi, &addr, cache, PAGE_DATA_SIZE);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    cache_dirty = 0;
+
+    return Ret_Success;
+}
@@ -0,0 +1,74 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_blockdev.h
+    Description: Sector based block device interface on top of nand_m79a, for use as the
+                 disk layer of FatFs, littlefs and similar file systems.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_BLOCKDEV_H
+#define NAND_BLOCKDEV_H
+
+#include "nand_m79a.h"
+
+/*
+    Sectors are NAND_SECTOR_SIZE bytes; NAND_SECTORS_PER_PAGE of them share one page.
+    Runs of whole pages go straight to NAND_Read / NAND_Write from the caller's buffer.
+    Partial pages are collected in a one page write-back cache so that consecutive sector
+    writes into the same page cost one page program instead of one per sector. The cache
+    is written out when another page is written, when all its sectors are dirty, or on
+    NAND_BlockDev_Sync.
+*/
+#define NAND_SECTOR_SIZE            512
+#define NAND_SECTORS_PER_PAGE       (PAGE_DATA_SIZE / NAND_SECTOR_SIZE)
+#define NAND_SECTOR_COUNT           ((uint32_t) NAND_NUM_LOGICAL_PAGES * NAND_SECTORS_PER_PAGE)
+
+/* Geometry reported to the file system */
+typedef struct {
+    uint32_t sector_count;      // number of addressable sectors
+    uint16_t sector_size;       // bytes per sector
+    uint32_t erase_block_size;  // sectors per erase block
+} NAND_BlockDev_Geometry;
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+/* API bodies, run with the device lock held (see nand_os.h) */
+NAND_ReturnType __blockdev_init(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __blockdev_read(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count);
+NAND_ReturnType __blockdev_write(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count);
+NAND_ReturnType __blockdev_sync(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __blockdev_trim(SPI_HandleTypeDef *hspi, uint32_t sector, uint32_t count);
+
+NAND_ReturnType __blockdev_fill_cache(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __blockdev_flush_cache(SPI_HandleTypeDef *hspi);
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+NAND_ReturnType NAND_BlockDev_Init(SPI_HandleTypeDef *hspi);
+NAND_ReturnType NAND_BlockDev_Read(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count);
+NAND_ReturnType NAND_BlockDev_Write(SPI_HandleTypeDef *hspi, uint32_t sector, uint8_t *buffer, uint32_t count);
+NAND_ReturnType NAND_BlockDev_Sync(SPI_HandleTypeDef *hspi);
+NAND_ReturnType NAND_BlockDev_Trim(SPI_HandleTypeDef *hspi, uint32_t sector, uint32_t count);
+void NAND_BlockDev_Get_Geometry(NAND_BlockDev_Geometry *geometry);
+
+#endif
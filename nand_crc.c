@@ -0,0 +1,126 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_crc.c
+    Description: CRC32C (Castagnoli) used to check page data end to end. Runs on the CRC
+                 unit of the MCU when it has a programmable polynomial, otherwise in
+                 software with slicing-by-8 tables.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include "nand_crc.h"
+
+#if NAND_CRC_HARDWARE
+    #include "stm32l0xx_hal.h"
+#endif
+
+/* only units with a programmable polynomial can do CRC32C */
+#if NAND_CRC_HARDWARE && defined(CRC_POL_POL)
+    #define CRC_UNIT    1
+#else
+    #define CRC_UNIT    0
+#endif
+
+#if !CRC_UNIT
+/* crc_table[k][n]: the reflected CRC of byte n followed by k zero bytes */
+static uint32_t crc_table[8][256];
+static uint8_t  crc_table_ready;
+#endif
+
+
+/******************************************************************************
+ *                              CRC32C
+ *****************************************************************************/
+
+/**
+    @brief Returns the CRC32C of length bytes at data, continuing from crc.
+    @note Pass 0 as crc to start; pass the previous result to continue over data that
+          follows, e.g. the segments of a page. Gives 0xE3069283 for "123456789".
+ */
+uint32_t NAND_CRC32C(uint32_t crc, const uint8_t *data, uint32_t length) {
+#if CRC_UNIT
+    uint32_t i = 0;
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+
+    /* the unit shifts MSB first, so it holds the running value bit reversed, and takes
+     * each byte bit reversed on the way in */
+    CRC->POL  = NAND_CRC32C_POLY;
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR   = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT | CRC_CR_RESET;
+
+    for (; i + 4 <= length; i += 4) {
+        CRC->DR = ((uint32_t) data[i] << 24) | ((uint32_t) data[i + 1] << 16) | ((uint32_t) data[i + 2] << 8) | data[i + 3];
+    }
+    for (; i < length; i++) {
+        *(__IO uint8_t *) &CRC->DR = data[i];
+    }
+    return ~CRC->DR;
+#else
+    return ~__crc32c_software(~crc, data, length);
+#endif
+}
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+#if !CRC_UNIT
+/**
+    @brief Advances the reflected CRC32C register state over length bytes.
+    @note Slicing-by-8: one table lookup per byte, but eight of them independent of each
+          other per step instead of a chain of eight. Bytes are assembled by shifts, so
+          data need not be aligned and the result does not depend on the byte order.
+ */
+uint32_t __crc32c_software(uint32_t state, const uint8_t *data, uint32_t length) {
+    if (!crc_table_ready) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t value = n;
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                value = (value >> 1) ^ ((value & 1) ? 0x82F63B78 : 0);
+            }
+            crc_table[0][n] = value;
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            for (uint8_t k = 1; k < 8; k++) {
+                crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xFF];
+            }
+        }
+        crc_table_ready = 1;
+    }
+
+    while (length >= 8) {
+        uint32_t low  = state ^ (data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+        uint32_t high = data[4] | ((uint32_t) data[5] << 8) | ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+
+        state = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF] ^
+                crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24] ^
+                crc_table[3][high & 0xFF] ^ crc_table[2][(high >> 8) & 0xFF] ^
+                crc_table[1][(high >> 16) & 0xFF] ^ crc_table[0][high >> 24];
+        data   += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        state = (state >> 8) ^ crc_table[0][(state ^ *data) & 0xFF];
+        data++;
+        length--;
+    }
+    return state;
+}
+#endif
@@ -0,0 +1,56 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_crc.h
+    Description: CRC32C (Castagnoli) used to check page data end to end. Runs on the CRC
+                 unit of the MCU when it has a programmable polynomial, otherwise in
+                 software with slicing-by-8 tables.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_CRC_H
+#define NAND_CRC_H
+
+#include <stdint.h>
+
+/*
+    With NAND_CRC_HARDWARE set to 1 and a CRC unit that takes a programmable polynomial
+    (CRC_POL_POL in the device header, e.g. STM32L0), the unit does the work at one word
+    per four bus cycles. The unit is reprogrammed on every call, so it may be shared with
+    application code as long as both do not run at the same time.
+
+    Otherwise the software kernel processes 8 bytes per step with eight 256-entry tables,
+    8 KB of RAM that are filled on the first call. Builds on a host without HAL headers.
+*/
+#define NAND_CRC_HARDWARE       1
+
+#define NAND_CRC32C_POLY        0x1EDC6F41      /* normal form; 0x82F63B78 reflected */
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+uint32_t __crc32c_software(uint32_t state, const uint8_t *data, uint32_t length);
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+uint32_t NAND_CRC32C(uint32_t crc, const uint8_t *data, uint32_t length);
+
+#endif
@@ -0,0 +1,255 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_lz.c
+    Description: Small LZ77 codec (LZ4 block format) used to compress pages before they
+                 are sent over SPI. Needs no heap and 1 KB of static RAM.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include <string.h>
+
+#include "nand_lz.h"
+
+/*
+    Each sequence is: token (literal count << 4 | match length - 4), extra literal count
+    bytes, literals, 2 byte little-endian match offset, extra match length bytes. Counts of
+    15 or more continue in following bytes of 255 until a byte below 255. The block ends
+    with a sequence holding only literals.
+
+    All loads are done a byte at a time, since the Cortex-M0+ faults on unaligned words.
+*/
+
+/* most recent position of each hashed 4 byte sequence */
+static uint16_t hash_table[1 << NAND_LZ_HASH_BITS];
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+static inline uint32_t __lz_read32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint16_t __lz_hash(uint32_t sequence) {
+    return (uint16_t) ((sequence * 2654435761u) >> (32 - NAND_LZ_HASH_BITS));
+}
+
+/* writes a count that did not fit in the token; returns 0 if out of room */
+static inline uint8_t *__lz_write_length(uint8_t *op, const uint8_t *op_end, uint16_t length) {
+    while (length >= 255) {
+        if (op >= op_end) {
+            return 0;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= op_end) {
+        return 0;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+/* emits literals [anchor, anchor + literals) followed by an optional match; returns 0 if out of room */
+static uint8_t *__lz_write_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *anchor,
+                                    uint16_t literals, uint16_t offset, uint16_t match_length) {
+    uint8_t *token = op++;
+
+    if (op > op_end) {
+        return 0;
+    }
+
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = __lz_write_length(op, op_end, literals - 15);
+        if (op == 0) {
+            return 0;
+        }
+    } else {
+        *token = literals << 4;
+    }
+
+    if (op + literals > op_end) {
+        return 0;
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    if (match_length == 0) {
+        return op;
+    }
+
+    if (op + 2 > op_end) {
+        return 0;
+    }
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+
+    match_length -= NAND_LZ_MIN_MATCH;
+    if (match_length >= 15) {
+        *token |= 15;
+        op = __lz_write_length(op, op_end, match_length - 15);
+    } else {
+        *token |= match_length;
+    }
+
+    return op;
+}
+
+
+/******************************************************************************
+ *                              Compression
+ *****************************************************************************/
+
+/**
+    @brief Compresses src_length bytes of src into dst.
+    @note Greedy single-probe match finder: one hash lookup per input position.
+          Not reentrant, the match table is static.
+
+    @return Compressed length, or 0 if the result does not fit in dst_capacity bytes.
+ */
+uint16_t NAND_LZ_Compress(const uint8_t *src, uint16_t src_length, uint8_t *dst, uint16_t dst_capacity) {
+    const uint8_t *ip     = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end    = src + src_length;
+    uint8_t *op           = dst;
+    uint8_t *op_end       = dst + dst_capacity;
+
+    memset(hash_table, 0, sizeof(hash_table));
+
+    if (src_length > NAND_LZ_MATCH_LIMIT) {
+        const uint8_t *match_limit = end - NAND_LZ_MATCH_LIMIT;
+        const uint8_t *match_end   = end - NAND_LZ_LAST_LITERALS;
+
+        while (ip < match_limit) {
+            uint32_t sequence = __lz_read32(ip);
+            uint16_t h = __lz_hash(sequence);
+            const uint8_t *ref = src + hash_table[h];
+
+            hash_table[h] = (uint16_t) (ip - src);
+
+            if (ref >= ip || __lz_read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            uint16_t length = NAND_LZ_MIN_MATCH;
+            while (ip + length < match_end && ref[length] == ip[length]) {
+                length++;
+            }
+
+            op = __lz_write_sequence(op, op_end, anchor, ip - anchor, ip - ref, length);
+            if (op == 0) {
+                return 0;
+            }
+
+            ip    += length;
+            anchor = ip;
+        }
+    }
+
+    op = __lz_write_sequence(op, op_end, anchor, end - anchor, 0, 0);
+    if (op == 0) {
+        return 0;
+    }
+
+    return (uint16_t) (op - dst);
+}
+
+
+/******************************************************************************
+ *                              Decompression
+ *****************************************************************************/
+
+/**
+    @brief Decompresses src_length bytes of src into dst.
+    @note Every length and offset is bounds checked, so corrupted input cannot write
+          outside dst.
+
+    @return Decompressed length, or 0 if the input is malformed or dst is too small.
+ */
+uint16_t NAND_LZ_Decompress(const uint8_t *src, uint16_t src_length, uint8_t *dst, uint16_t dst_capacity) {
+    const uint8_t *ip     = src;
+    const uint8_t *ip_end = src + src_length;
+    uint8_t *op           = dst;
+    uint8_t *op_end       = dst + dst_capacity;
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        uint16_t length = token >> 4;
+
+        /* literals */
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) {
+                    return 0;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        if (length > ip_end - ip || length > op_end - op) {
+            return 0;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        /* the last sequence has no match part */
+        if (ip == ip_end) {
+            break;
+        }
+
+        /* match */
+        if (ip_end - ip < 2) {
+            return 0;
+        }
+        uint16_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst) {
+            return 0;
+        }
+
+        length = token & 0x0F;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) {
+                    return 0;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += NAND_LZ_MIN_MATCH;
+        if (length > op_end - op) {
+            return 0;
+        }
+
+        /* byte copy: source and destination overlap when offset < length */
+        const uint8_t *ref = op - offset;
+        while (length--) {
+            *op++ = *ref++;
+        }
+    }
+
+    return (uint16_t) (op - dst);
+}
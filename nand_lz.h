@@ -0,0 +1,44 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_lz.h
+    Description: Small LZ77 codec (LZ4 block format) used to compress pages before they
+                 are sent over SPI. Needs no heap and 1 KB of static RAM.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_LZ_H
+#define NAND_LZ_H
+
+#include <stdint.h>
+
+/* Kept free of HAL includes so the codec also builds on a host for benchmarking */
+
+#define NAND_LZ_HASH_BITS       9       /* match finder table: 2^9 entries of 2 bytes */
+#define NAND_LZ_MIN_MATCH       4
+#define NAND_LZ_LAST_LITERALS   5       /* the last bytes of a block are always literals */
+#define NAND_LZ_MATCH_LIMIT     12      /* no match may start this close to the end */
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+uint16_t NAND_LZ_Compress(const uint8_t *src, uint16_t src_length, uint8_t *dst, uint16_t dst_capacity);
+uint16_t NAND_LZ_Decompress(const uint8_t *src, uint16_t src_length, uint8_t *dst, uint16_t dst_capacity);
+
+#endif
@@ -22,9 +22,125 @@
 
 ********************************************************************************/
 
+#include <string.h>
+
 #include "nand_m79a.h"
 
+/* logical page => physical page mapping */
+#if NAND_MAP_EXTENTS
+static NAND_Extent extents[NAND_EXTENT_MAX];        // sorted by logical_start, never overlapping
+static uint16_t    extent_count;
+#elif NAND_MAP_DEMAND
+#define MAP_SEGMENTS_PER_PAGE       (NAND_MAP_ENTRIES_PER_PAGE / NAND_MAP_SEGMENT_ENTRIES)
+#define MAP_NO_SEGMENT              0xFFFF
+static NAND_MapSegment map_cache[NAND_MAP_CACHE_SEGMENTS];
+static NAND_PhysPage map_pages[NAND_MAP_PAGES];     // newest copy of each translation page
+static uint32_t map_sequence[NAND_MAP_PAGES];       // and its sequence number
+static uint16_t map_dirty;                          // dirty segments in map_cache
+static uint32_t map_clock;                          // lookups so far, for least recently used
+static uint8_t  map_read_failed;                    // a segment could not be read since last cleared
+static SPI_HandleTypeDef *map_hspi;                 // device read on misses, set at mount
+#else
+static NAND_MapEntry l2p[NAND_NUM_LOGICAL_PAGES];
+#endif
+
+/* per-block bookkeeping */
+static uint8_t  block_state[NAND_FTL_NUM_BLOCKS];
+static uint16_t valid_count[NAND_FTL_NUM_BLOCKS];   // pages (or chunks) in the block still referenced by the mapping
+static uint16_t written_count[NAND_FTL_NUM_BLOCKS]; // pages (or chunks) programmed into the block, plus
+                                                    // pages left unprogrammed when it was closed
+static uint8_t  trim_records[NAND_FTL_NUM_BLOCKS];  // trim record pages in the block
+static uint32_t block_sequence[NAND_FTL_NUM_BLOCKS];// sequence number of the newest page in the block
+static uint16_t free_blocks;                        // erased and ready to open
+static uint16_t dirty_blocks;                       // waiting to be erased
+static uint8_t  listed_free[NAND_FTL_NUM_BLOCKS];   // listed as erased by the newest free list on flash
+static uint16_t free_list_block;                    // block holding the newest free list
+static uint8_t  replenishing;                       // free pool fell below the low watermark
+
+/* append point of each stream, plus one for pages copied by space reclamation */
+#define STREAM_RECLAIM              NAND_NUM_STREAMS
+#define FTL_NUM_APPEND_POINTS       (NAND_NUM_STREAMS + 1)
+static uint16_t open_block[FTL_NUM_APPEND_POINTS];
+static uint8_t  open_page[FTL_NUM_APPEND_POINTS];   // next page to program in open_block
+#if NAND_BLOCK_SUMMARY
+/* tags of the pages programmed into each open block so far, for its summary page; at mount,
+ * the summary of the block being scanned */
+static NAND_SummaryEntry summary[FTL_NUM_APPEND_POINTS][NAND_SUMMARY_ENTRIES];
+#endif
+
+/* endurance statistics, see NAND_Get_Stats */
+static NAND_StatsRecord counters;                   // as of the last save, plus everything since
+static uint32_t ecc_at_load[NUM_ECC_RESULTS];       // LLD ECC counts already included in counters
+static uint64_t stats_saved_at;                     // counters.pages_programmed at the last save
+static uint64_t erases_saved_at;                    // counters.blocks_erased at the last save
+static uint64_t host_saved_at;                      // counters.host_bytes_written at the last save
+static uint16_t stats_block;                        // block holding the newest statistics record
+
+/* the open transaction, or one whose pages still have to be rolled back on flash */
+static NAND_TxnPage txn_pages[NAND_TXN_MAX_PAGES];
+static uint8_t  txn_count;
+static uint8_t  txn_open;
+static uint32_t txn_id;
+static uint32_t next_txn;
+static uint32_t committed_txn;                      // newest transaction with a commit record on flash
+static uint16_t commit_block;                       // block holding that record
+
+/* recent writes of each logical page, 2 bits per page, for NAND_STREAM_AUTO */
+static uint8_t  heat[(NAND_NUM_LOGICAL_PAGES + 3) / 4];
+static uint32_t heat_writes;                        // writes counted since the last decay
+static uint16_t alloc_cursor;                       // round-robin start for free block search
+static uint32_t next_sequence;
+static uint8_t  reclaiming;
+
+/* records that may have to move before a reclaimed block is erased: free list, statistics
+ * and commit record */
+#define FTL_RECLAIM_RECORD_PAGES    3
+
+/* free blocks only the reclaim stream may open, so that reclamation can always finish */
+#define FTL_RECLAIM_RESERVE_BLOCKS  1
 
+/* mount leaves data pages to a second pass that can take them in a better order, see
+ * __ftl_mount_replay and __ftl_mount_extents */
+#define FTL_MOUNT_DEFERS_CLAIMS     (NAND_MAP_DEMAND || NAND_MAP_EXTENTS)
+/* logical pages resolved per pass of __ftl_mount_extents, one entry each in a page buffer */
+#define FTL_MOUNT_WINDOW            (PAGE_DATA_SIZE / sizeof(NAND_MapEntry))
+
+/* enough record pages to list every unmapped range, even when maximally fragmented */
+#define TRIM_CHECKPOINT_MAX_PAGES   ((NAND_NUM_LOGICAL_PAGES / 2) / NAND_TRIM_RANGES_PER_PAGE + 1)
+/* same, for the preprocessor: 8-byte ranges, 2-byte page numbers */
+#if ((NAND_NUM_LOGICAL_PAGES / 2) / (PAGE_DATA_SIZE / 8) + 1) * 2 > NAND_POOL_ARENA_SIZE
+    #error "NAND_POOL_ARENA_SIZE too small for the pages of a trim checkpoint"
+#endif
+
+/* staging buffer for page data; the spare area is sent from a separate segment */
+static uint8_t page_buffer[PAGE_DATA_SIZE];
+
+/* most data segments a page is programmed from: head, new data, tail of a partial write */
+#define FTL_MAX_DATA_SEGMENTS       3
+
+/* leading ECC sectors whose spare bytes hold part of the tag; only programmed with it */
+#define FTL_TAG_SECTORS             ((SPARE_USER_OFFSET + sizeof(PageTag) + NAND_ECC_SPARE_SIZE - 1) / NAND_ECC_SPARE_SIZE)
+#define FTL_APPEND_START            (FTL_TAG_SECTORS * NAND_ECC_SECTOR_SIZE)
+
+#if NAND_COMPRESSION
+/* compressed chunks waiting to be programmed together */
+static uint8_t  pack_buffer[PAGE_DATA_SIZE];
+static uint8_t  pack_count;
+static uint16_t pack_fill;
+/* compressor output, or decompressor scratch for partial page reads */
+static uint8_t  lz_buffer[PAGE_DATA_SIZE];
+/* the compacted page being built in page_buffer during space reclamation */
+static uint8_t  reclaim_count;
+static uint16_t reclaim_fill;
+static NAND_MapEntry reclaim_from[NAND_PACK_MAX_CHUNKS];
+#endif
+
+#if NAND_PAGE_CRC
+/* set while space reclamation copies a page that failed its check: the copy is programmed
+ * with the CRC of the original, so reading it still reports the corruption */
+static uint8_t  keep_crc;
+static uint32_t kept_crc;
+#endif
 
 
 /******************************************************************************
@@ -32,15 +148,31 @@
  *****************************************************************************/
 
 /**
-    @brief Initializes the NAND. Steps: Reset device and check for correct device IDs.
+    @brief Initializes the NAND. Steps: Reset device, check for correct device IDs,
+           read the geometry (NAND_AUTODETECT only), calibrate the SPI clock
+           (NAND_CLOCK_CALIBRATION only) and rebuild the logical to physical mapping
+           from flash.
     @note This function must be called first when powered on.
 
     @return NAND_ReturnType
     @retval Ret_ResetFailed
     @retval Ret_WrongID
+    @retval Ret_WrongType
+    @retval Ret_AddressInvalid
+    @retval Ret_ReadFailed
     @retval Ret_Success
  */
 NAND_ReturnType NAND_Init(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_init(hspi);
+    NAND_TRACE_END(NAND_TRACE_INIT, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Init without the device lock */
+NAND_ReturnType __ftl_init(SPI_HandleTypeDef *hspi) {
     NAND_ID dev_ID;
 
     /* Wait for T_POR = 1.25ms after power on */
@@ -49,65 +181,3601 @@ NAND_ReturnType NAND_Init(SPI_HandleTypeDef *hspi) {
     /* Reset NAND flash during initialization. May not be necessary though (page 50) */
     if (NAND_Reset(hspi) != Ret_Success) {
         return Ret_ResetFailed;
-    } else {
-        /* check if device ID is same as expected */
-        NAND_Read_ID(hspi, &dev_ID);
-        if (dev_ID.manufacturer_ID != NAND_ID_MANUFACTURER || dev_ID.device_ID != NAND_ID_DEVICE) {
-            return Ret_WrongID;
+    }
+
+    /* check if device ID is same as expected */
+    NAND_Read_ID(hspi, &dev_ID);
+#ifdef NAND_AUTODETECT
+    if (dev_ID.manufacturer_ID != NAND_ID_MANUFACTURER) {
+        return Ret_WrongID;
+    }
+    NAND_ReturnType status = NAND_Read_Param_Page(hspi, &nand_geometry);
+    if (status != Ret_Success) {
+        return status;
+    }
+#else
+    if (dev_ID.manufacturer_ID != NAND_ID_MANUFACTURER || dev_ID.device_ID != NAND_ID_DEVICE) {
+        return Ret_WrongID;
+    }
+#endif
+
+    /* the FTL region must exist on this part */
+    if (NAND_FTL_FIRST_BLOCK + NAND_FTL_NUM_BLOCKS > NUM_BLOCKS) {
+        return Ret_AddressInvalid;
+    }
+
+#if NAND_CLOCK_CALIBRATION
+    if (NAND_CLOCK_CAL_BLOCK >= NUM_BLOCKS) {
+        return Ret_AddressInvalid;
+    }
+    /* on failure the clock stays at the reference setting, which is slow but works */
+    NAND_Calibrate_Clock(hspi, NAND_CLOCK_CAL_BLOCK, page_buffer);
+#endif
+
+    return __ftl_mount(hspi);
+}
+
+
+/******************************************************************************
+ *                              Reads and Writes
+ *****************************************************************************/
+
+/**
+    @brief Reads length bytes starting at a logical address.
+    @note Reads may start anywhere and span multiple pages. Logical pages that were never
+          written read back as 0xFF, like erased flash.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Ret_ReadFailed
+    @retval Ret_CorruptData: with NAND_PAGE_CRC, a page did not match its CRC
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Read(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_read(hspi, address, buffer, length);
+    NAND_TRACE_END(NAND_TRACE_READ, trace_start, *address, length, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Read without the device lock */
+NAND_ReturnType __ftl_read(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    PhysicalAddrs addr_i;
+    NAND_Addr addr = *address;
+    NAND_ReturnType status;
+
+    if (addr >= NAND_LOGICAL_SIZE_BYTES || length > NAND_LOGICAL_SIZE_BYTES - addr) {
+        return Ret_AddressInvalid;
+    }
+
+    while (length > 0) {
+        uint16_t offset = addr % PAGE_DATA_SIZE;
+        uint16_t chunk  = PAGE_DATA_SIZE - offset;
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        /* Convert logical address to physical internal addresses to send to NAND */
+        status = __map_logical_addr(&addr, &addr_i);
+
+        if (status == Ret_PageNotMapped) {
+            memset(buffer, 0xFF, chunk);
+#if NAND_COMPRESSION
+        } else if (MAP_SLOT(__map_get(addr / PAGE_DATA_SIZE)) != 0) {
+            if (__ftl_read_chunk(hspi, __map_get(addr / PAGE_DATA_SIZE), offset, buffer, chunk) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+#endif
+#if NAND_PAGE_CRC
+        } else {
+            /* the CRC covers the whole page, so part of one is staged in page_buffer */
+            uint8_t *page = (chunk == PAGE_DATA_SIZE) ? buffer : page_buffer;
+
+            status = __ftl_read_checked(hspi, MAP_PHYS(__map_get(addr / PAGE_DATA_SIZE)), page);
+            if (status != Ret_Success) {
+                return status;
+            }
+            if (page != buffer) {
+                memcpy(buffer, &page_buffer[offset], chunk);
+            }
+        }
+#else
+        } else if (NAND_Page_Read(hspi, &addr_i, buffer, chunk) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+#endif
+
+        addr   += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Writes length bytes starting at a logical address.
+    @note Every page touched is rewritten out-of-place. Partial pages are merged with their
+          current contents first, so page aligned writes of whole pages are the cheapest.
+          With NAND_COMPRESSION, data may stay in RAM until NAND_Sync. With
+          NAND_PARTIAL_PROGRAM, partial pages landing on erased sectors are programmed in place.
+          Each page is put in the hot or cold stream by how recently it was last written.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_CorruptData: with NAND_PAGE_CRC, a partially written page did not match its CRC
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    return NAND_Write_Stream(hspi, address, buffer, length, NAND_STREAM_AUTO);
+}
+
+/**
+    @brief Writes length bytes starting at a logical address into the given stream.
+    @note Like NAND_Write, but with a hint of how long the data will live: NAND_STREAM_HOT
+          for data that will soon be overwritten or trimmed, NAND_STREAM_COLD for data that
+          will stay. NAND_STREAM_AUTO classifies each page as NAND_Write does.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Return values of NAND_Write
+ */
+NAND_ReturnType NAND_Write_Stream(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length, uint8_t stream) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_write_stream(hspi, address, buffer, length, stream);
+    NAND_TRACE_END(NAND_TRACE_WRITE, trace_start, *address, length, stream, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Write_Stream without the device lock */
+NAND_ReturnType __ftl_write_stream(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length, uint8_t stream) {
+    NAND_Addr addr = *address;
+    NAND_ReturnType status;
+
+    if (addr >= NAND_LOGICAL_SIZE_BYTES || length > NAND_LOGICAL_SIZE_BYTES - addr) {
+        return Ret_AddressInvalid;
+    }
+    if (stream >= NAND_NUM_STREAMS && stream != NAND_STREAM_AUTO) {
+        return Ret_AddressInvalid;
+    }
+
+    while (length > 0) {
+        uint32_t logical_page = addr / PAGE_DATA_SIZE;
+        uint16_t offset = addr % PAGE_DATA_SIZE;
+        uint16_t chunk  = PAGE_DATA_SIZE - offset;
+        if (chunk > length) {
+            chunk = length;
+        }
+        uint8_t page_stream = (stream == NAND_STREAM_AUTO) ? __ftl_classify(logical_page) : stream;
+
+#if NAND_COMPRESSION
+        if (chunk < PAGE_DATA_SIZE) {
+            /* compressed reads stage in page_buffer, so the page is merged in a leased one */
+            NAND_Addr page_start = logical_page * PAGE_DATA_SIZE;
+            uint8_t *merged = __pool_acquire();
+            if (merged == NULL) {
+                return Ret_MemoryOverflow;
+            }
+            status = __ftl_read(hspi, &page_start, merged, PAGE_DATA_SIZE);
+            if (status == Ret_Success) {
+                memcpy(&merged[offset], buffer, chunk);
+                status = __ftl_write_compressed(hspi, logical_page, merged, page_stream);
+            }
+            __pool_release(merged);
         } else {
+            status = __ftl_write_compressed(hspi, logical_page, buffer, page_stream);
+        }
+        if (status != Ret_Success) {
+            return status;
+        }
+#else
+        /* whole pages are programmed straight from buffer */
+        SPI_Params data[FTL_MAX_DATA_SEGMENTS] = {{ .buffer = buffer, .length = chunk }};
+        uint8_t num_data = 1;
+
+        /* make room first: reclaiming space reuses page_buffer */
+        status = __ftl_reserve_page(hspi, page_stream);
+        if (status != Ret_Success) {
+            return status;
+        }
+
+        /* partial pages: the old contents around the new data come from page_buffer */
+        if (chunk < PAGE_DATA_SIZE) {
+            NAND_Addr page_start = logical_page * PAGE_DATA_SIZE;
+            uint16_t unread = PAGE_DATA_SIZE;
+#if NAND_PARTIAL_PROGRAM
+            /* an append only needs the sectors after the tag; the rest is read if it falls through */
+            if (offset >= FTL_APPEND_START) {
+                NAND_Addr tail_start = page_start + FTL_APPEND_START;
+                uint8_t appended;
+
+                status = __ftl_read(hspi, &tail_start, &page_buffer[FTL_APPEND_START], PAGE_DATA_SIZE - FTL_APPEND_START);
+                if (status != Ret_Success) {
+                    return status;
+                }
+                status = __ftl_append(hspi, logical_page, offset, buffer, chunk, &appended);
+                if (status != Ret_Success) {
+                    return status;
+                }
+                if (appended) {
+                    counters.host_bytes_written += chunk;
+
+                    addr   += chunk;
+                    buffer += chunk;
+                    length -= chunk;
+                    continue;
+                }
+                unread = FTL_APPEND_START;
+            }
+#endif
+            status = __ftl_read(hspi, &page_start, page_buffer, unread);
+            if (status != Ret_Success) {
+                return status;
+            }
+            data[0].buffer = page_buffer;
+            data[0].length = offset;
+            data[1].buffer = buffer;
+            data[1].length = chunk;
+            data[2].buffer = &page_buffer[offset + chunk];
+            data[2].length = PAGE_DATA_SIZE - offset - chunk;
+            num_data = 3;
+        }
+
+        status = __ftl_program_page(hspi, page_stream, logical_page, data, num_data);
+        if (status != Ret_Success) {
+            return status;
+        }
+#endif
+
+        counters.host_bytes_written += chunk;
+
+        addr   += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Makes all completed NAND_Write calls durable.
+    @note With NAND_COMPRESSION, programs the pack buffer. Also saves the statistics
+          if they changed since the last save.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Sync(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_sync(hspi);
+    NAND_TRACE_END(NAND_TRACE_SYNC, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Sync without the device lock */
+NAND_ReturnType __ftl_sync(SPI_HandleTypeDef *hspi) {
+#if NAND_COMPRESSION
+    NAND_ReturnType status = __ftl_flush_pack(hspi);
+    if (status != Ret_Success) {
+        return status;
+    }
+#endif
+
+    if (__ftl_stats_changed()) {
+        return __ftl_write_stats(hspi);
+    }
+
+    return Ret_Success;
+}
+
+
+/******************************************************************************
+ *                          Background Maintenance
+ *****************************************************************************/
+
+/**
+    @brief Does one step of background work. Call it whenever the application is idle,
+           for as long as NAND_Idle_Pending returns 1.
+    @note Each call takes at most one block erase or one block's worth of page copies.
+          In order: recalibrates the SPI clock after failed reads, erases a dirty block
+          and persists the free list and statistics right after it, reclaims space while
+          the free pool is being replenished, or saves the statistics once due.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Idle(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_idle(hspi);
+    NAND_TRACE_END(NAND_TRACE_IDLE, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Idle without the device lock */
+NAND_ReturnType __ftl_idle(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status;
+
+#if NAND_CLOCK_CALIBRATION
+    if (NAND_Clock_Calibration_Pending()) {
+        /* as in NAND_Init, a failed calibration leaves the reference setting */
+        NAND_Calibrate_Clock(hspi, NAND_CLOCK_CAL_BLOCK, page_buffer);
+        return Ret_Success;
+    }
+#endif
+
+    if (dirty_blocks > 0) {
+        status = __ftl_erase_dirty_block(hspi);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    /* erased blocks are listed as soon as possible, a reboot would erase them again */
+    if (__ftl_free_list_stale()) {
+        status = __ftl_write_free_list(hspi);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    /* same for the erase counts, a reboot would lose them */
+    if (counters.blocks_erased != erases_saved_at) {
+        return __ftl_write_stats(hspi);
+    }
+
+    /* the last NAND_FTL_GC_THRESHOLD blocks are left to the reclamation done by writes */
+    if (replenishing && free_blocks < NAND_FTL_POOL_TARGET) {
+        status = __ftl_reclaim_block(hspi, free_blocks > NAND_FTL_GC_THRESHOLD);
+        /* every full block is completely valid (or too valid to fit), so there is nothing to gain */
+        if (status == Ret_MemoryOverflow) {
+            replenishing = 0;
             return Ret_Success;
         }
+        return status;
+    }
+    replenishing = 0;
+
+    if (counters.pages_programmed - stats_saved_at >= NAND_STATS_SAVE_INTERVAL) {
+        return __ftl_write_stats(hspi);
     }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Tells whether NAND_Idle has work left to do.
+
+    @return 1 if NAND_Idle should be called again, 0 otherwise.
+ */
+uint8_t NAND_Idle_Pending(void) {
+    return (NAND_CLOCK_CALIBRATION && NAND_Clock_Calibration_Pending()) ||
+           dirty_blocks > 0 || __ftl_free_list_stale() || counters.blocks_erased != erases_saved_at ||
+           (replenishing && free_blocks < NAND_FTL_POOL_TARGET) ||
+           counters.pages_programmed - stats_saved_at >= NAND_STATS_SAVE_INTERVAL;
 }
 
 
 /******************************************************************************
- *                              Reads and Writes
+ *                                  Trim
  *****************************************************************************/
 
 /**
-    @brief 
-    @note 
+    @brief Discards the logical pages lying entirely inside [address, address + length).
+    @note Discarded pages read back as 0xFF and are never copied during space reclamation,
+          so blocks holding only discarded pages are erased without any copies. The trim is
+          persisted with a trim record before returning. Partial pages at either end of the
+          range are left untouched.
 
     @return NAND_ReturnType
-    @retval 
+    @retval Ret_AddressInvalid
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed: only with NAND_MAP_DEMAND
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
  */
-// NAND_ReturnType func(SPI_HandleTypeDef *hspi) {
-// }
+NAND_ReturnType NAND_Trim(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint32_t length) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_trim(hspi, address, length);
+    NAND_TRACE_END(NAND_TRACE_TRIM, trace_start, *address, length, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
 
-NAND_ReturnType NAND_Read(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint16_t length) {
-    PhysicalAddrs addr_i;
-    uint8_t data[PAGE_SIZE];
+/* NAND_Trim without the device lock */
+NAND_ReturnType __ftl_trim(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint32_t length) {
+    NAND_Addr addr = *address;
+    uint32_t discarded = 0;
+
+    if (addr >= NAND_LOGICAL_SIZE_BYTES || length > NAND_LOGICAL_SIZE_BYTES - addr) {
+        return Ret_AddressInvalid;
+    }
+
+    uint32_t first_page = (addr + PAGE_DATA_SIZE - 1) / PAGE_DATA_SIZE;
+    uint32_t end_page   = (addr + length) / PAGE_DATA_SIZE;
+
+#if NAND_COMPRESSION
+    /* a pending chunk would be programmed after the trim record and outlive it at mount */
+    for (uint32_t logical_page = first_page; logical_page < end_page; logical_page++) {
+        if (MAP_PHYS(__map_get(logical_page)) == NAND_PAGE_PENDING) {
+            NAND_ReturnType status = __ftl_flush_pack(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+            break;
+        }
+    }
+#endif
+
+    /* unmapping a range splits at most one extent */
+    if (__map_reserve_trim(first_page, end_page) != Ret_Success) {
+        return Ret_MemoryOverflow;
+    }
+
+    uint32_t head = __map_trim_head(first_page, end_page);
+    for (uint32_t i = 0; first_page + i < end_page; i++) {
+        uint32_t logical_page = (i < head) ? first_page + head - 1 - i : first_page + i;
+        if (__map_get(logical_page) != NAND_MAP_UNMAPPED) {
+            __ftl_drop_mapping(logical_page);
+            discarded++;
+#if NAND_MAP_DEMAND
+            /* a long range dirties more segments than the cache holds */
+            NAND_ReturnType status = __ftl_flush_map(hspi, NAND_MAP_DIRTY_SEGMENTS);
+            if (status != Ret_Success) {
+                return status;
+            }
+#endif
+        }
+    }
+
+    /* nothing on flash refers to these pages, so there is nothing to persist */
+    if (discarded == 0) {
+        return Ret_Success;
+    }
+
+    return __ftl_write_trim_record(hspi, first_page, end_page - first_page);
+}
+
+
+/******************************************************************************
+ *                              Transactions
+ *****************************************************************************/
+
+/**
+    @brief Opens a transaction. Until NAND_Txn_Commit, pages written with NAND_Txn_Write
+           are on flash but not visible, and are discarded if power is lost.
+    @note Only one transaction can be open at a time. Rolls back an aborted or interrupted
+          transaction first if that is still pending.
+
+    @return NAND_ReturnType
+    @retval Ret_Failed: a transaction is already open
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Txn_Begin(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_txn_begin(hspi);
+    NAND_TRACE_END(NAND_TRACE_TXN_BEGIN, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Txn_Begin without the device lock */
+NAND_ReturnType __ftl_txn_begin(SPI_HandleTypeDef *hspi) {
+    if (txn_open) {
+        return Ret_Failed;
+    }
+
+    /* committing another one first would resurrect the pages left on flash */
+    if (txn_count > 0) {
+        NAND_ReturnType status = __ftl_txn_rollback(hspi);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+#if NAND_MAP_DEMAND
+    /* once this one is the newest on flash, mount only claims the last commit's pages if
+     * they are newer than their translation pages, which may have been written meanwhile */
+    NAND_ReturnType status = __ftl_flush_map(hspi, 0);
+    if (status != Ret_Success) {
+        return status;
+    }
+#endif
+
+    txn_id   = next_txn++;
+    txn_open = 1;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Writes length bytes starting at a logical address as part of the open transaction.
+    @note Like NAND_Write, but NAND_Read keeps returning the committed data until
+          NAND_Txn_Commit. At most NAND_TXN_MAX_PAGES distinct logical pages can be written
+          per transaction. Pages are never compressed. The same pages must not be written
+          or trimmed outside the transaction while it is open.
+
+    @return NAND_ReturnType
+    @retval Ret_Failed: no transaction is open
+    @retval Ret_AddressInvalid
+    @retval Ret_MemoryOverflow: the transaction is full, or no space is left
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Txn_Write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_txn_write(hspi, address, buffer, length);
+    NAND_TRACE_END(NAND_TRACE_TXN_WRITE, trace_start, *address, length, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Txn_Write without the device lock */
+NAND_ReturnType __ftl_txn_write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    NAND_Addr addr = *address;
+    NAND_ReturnType status;
+
+    if (!txn_open) {
+        return Ret_Failed;
+    }
+    if (addr >= NAND_LOGICAL_SIZE_BYTES || length > NAND_LOGICAL_SIZE_BYTES - addr) {
+        return Ret_AddressInvalid;
+    }
+
+    while (length > 0) {
+        uint32_t logical_page = addr / PAGE_DATA_SIZE;
+        uint16_t offset = addr % PAGE_DATA_SIZE;
+        uint16_t chunk  = PAGE_DATA_SIZE - offset;
+        if (chunk > length) {
+            chunk = length;
+        }
+        SPI_Params data[FTL_MAX_DATA_SEGMENTS] = {{ .buffer = buffer, .length = chunk }};
+        uint8_t num_data = 1;
+        NAND_PhysPage phys;
+
+        uint8_t i = __ftl_txn_find(logical_page);
+        if (i == txn_count && txn_count == NAND_TXN_MAX_PAGES) {
+            return Ret_MemoryOverflow;
+        }
+        uint8_t stream = __ftl_classify(logical_page);
+
+#if NAND_COMPRESSION
+        /* the pending copy must reach flash first, or it would look newer at mount */
+        if (MAP_PHYS(__map_get(logical_page)) == NAND_PAGE_PENDING) {
+            status = __ftl_flush_pack(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+#endif
+        status = __ftl_reserve_page(hspi, stream);
+        if (status != Ret_Success) {
+            return status;
+        }
+
+        /* partial pages are merged with this transaction's copy, or else the committed one,
+         * read into a leased buffer since compressed reads stage in page_buffer */
+        uint8_t *merged = NULL;
+        if (chunk < PAGE_DATA_SIZE) {
+            merged = __pool_acquire();
+            if (merged == NULL) {
+                return Ret_MemoryOverflow;
+            }
+            if (i < txn_count) {
+#if NAND_PAGE_CRC
+                status = __ftl_read_checked(hspi, txn_pages[i].phys, merged);
+#else
+                PhysicalAddrs addr_i;
+                __map_physical_page(txn_pages[i].phys, 0, &addr_i);
+                if (NAND_Page_Read(hspi, &addr_i, merged, PAGE_DATA_SIZE) != Ret_Success) {
+                    status = Ret_ReadFailed;
+                }
+#endif
+            } else {
+                NAND_Addr page_start = logical_page * PAGE_DATA_SIZE;
+                status = __ftl_read(hspi, &page_start, merged, PAGE_DATA_SIZE);
+            }
+            data[0].buffer = merged;
+            data[0].length = offset;
+            data[1].buffer = buffer;
+            data[1].length = chunk;
+            data[2].buffer = &merged[offset + chunk];
+            data[2].length = PAGE_DATA_SIZE - offset - chunk;
+            num_data = 3;
+        }
+
+        if (status == Ret_Success) {
+            status = __ftl_program_tagged(hspi, stream, PAGE_TAG_TXN, logical_page, data, num_data, &phys);
+        }
+        if (merged != NULL) {
+            __pool_release(merged);
+        }
+        if (status != Ret_Success) {
+            return status;
+        }
+
+        /* not mapped yet, but counted as valid so that space reclamation keeps it */
+        if (i == txn_count) {
+            txn_pages[i].logical_page = logical_page;
+            txn_count++;
+        } else {
+            valid_count[txn_pages[i].phys / NUM_PAGES_PER_BLOCK]--;
+        }
+        txn_pages[i].phys = phys;
+        valid_count[phys / NUM_PAGES_PER_BLOCK]++;
+
+        counters.host_bytes_written += chunk;
+
+        addr   += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Makes every page written by the open transaction visible at once.
+    @note Programs a single commit record, then points the mapping at the pages already
+          written, so no data is copied. Power loss before the record is programmed rolls
+          the whole transaction back at the next NAND_Init. If this fails, the transaction
+          stays open and can be committed again or aborted.
+
+    @return NAND_ReturnType
+    @retval Ret_Failed: no transaction is open
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Txn_Commit(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_txn_commit(hspi);
+    NAND_TRACE_END(NAND_TRACE_TXN_COMMIT, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Txn_Commit without the device lock */
+NAND_ReturnType __ftl_txn_commit(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status;
+
+    if (!txn_open) {
+        return Ret_Failed;
+    }
+    if (txn_count == 0) {
+        txn_open = 0;
+        return Ret_Success;
+    }
 
-    // TODO: can't just be any address. start address has to be page start. and max len must be page end.
-    // handle writing between pages.
-    
-    /* Convert logical address to physical internal addresses to send to NAND */
-    __map_logical_addr(address, &addr_i);
+    /* make room first, since space reclamation may use up extents */
+    status = __ftl_reserve_page(hspi, NAND_STREAM_HOT);
+    if (status != Ret_Success) {
+        return status;
+    }
+#if NAND_MAP_EXTENTS
+    /* once the record is on flash, the mapping switch must not fail half way */
+    if (NAND_EXTENT_MAX - extent_count < 2 * txn_count + NAND_EXTENT_RESERVE) {
+        return Ret_MemoryOverflow;
+    }
+#elif NAND_MAP_DEMAND
+    if (NAND_MAP_CACHE_SEGMENTS - map_dirty < txn_count) {
+        return Ret_MemoryOverflow;
+    }
+#endif
+
+    status = __ftl_write_commit(hspi, txn_id);
+    if (status != Ret_Success) {
+        return status;
+    }
 
-    NAND_Page_Read(hspi, &addr_i, data, length);
+    for (uint8_t i = 0; i < txn_count; i++) {
+        __ftl_drop_mapping(txn_pages[i].logical_page);
+        __map_set(txn_pages[i].logical_page, MAP_ENTRY(txn_pages[i].phys, 0));
+    }
+    txn_count = 0;
+    txn_open  = 0;
 
     return Ret_Success;
+}
+
+/**
+    @brief Discards every page written by the open transaction.
+    @note The pages are only unmapped in RAM; on flash, they are superseded by fresh
+          copies of the committed data. If that fails, it is retried by NAND_Txn_Begin or
+          at the next NAND_Init, and the transaction is closed either way.
+
+    @return NAND_ReturnType
+    @retval Ret_Failed: no transaction is open
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Txn_Abort(SPI_HandleTypeDef *hspi) {
+    NAND_OS_Lock();
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __ftl_txn_abort(hspi);
+    NAND_TRACE_END(NAND_TRACE_TXN_ABORT, trace_start, 0, 0, 0, status);
+    NAND_OS_Unlock();
+    return status;
+}
+
+/* NAND_Txn_Abort without the device lock */
+NAND_ReturnType __ftl_txn_abort(SPI_HandleTypeDef *hspi) {
+    if (!txn_open) {
+        return Ret_Failed;
+    }
 
+    for (uint8_t i = 0; i < txn_count; i++) {
+        valid_count[txn_pages[i].phys / NUM_PAGES_PER_BLOCK]--;
+    }
+    txn_open = 0;
+
+    /* nothing reached flash */
+    if (txn_count == 0) {
+        return Ret_Success;
+    }
+
+    return __ftl_txn_rollback(hspi);
 }
 
+
 /******************************************************************************
  *                              Internal Functions
  *****************************************************************************/
 
 /**
-    @brief 
-    @note 
+    @brief Translates a logical address into the physical location currently holding it.
+    @note For a compressed page this is the page holding the chunk, not the data itself.
 
     @return NAND_ReturnType
-    @retval 
+    @retval Ret_AddressInvalid
+    @retval Ret_PageNotMapped
+    @retval Ret_ReadFailed: the translation page could not be read
+    @retval Ret_Success
  */
 NAND_ReturnType __map_logical_addr(NAND_Addr *address, PhysicalAddrs *addr_struct) {
-    addr_struct -> plane    = ADDRESS_2_PLANE(*address);
-    addr_struct -> block    = ADDRESS_2_BLOCK(*address);
-    addr_struct -> page     = ADDRESS_2_PAGE(*address);
-    addr_struct -> rowAddr  = 0 || ((ADDRESS_2_BLOCK(*address) << ROW_ADDRESS_PAGE_BITS) | ADDRESS_2_PAGE(*address));
-    addr_struct -> colAddr  = 0 || ((ADDRESS_2_PLANE(*address) << COL_ADDRESS_BITS) | ADDRESS_2_COL(*address));
+    uint32_t logical_page = *address / PAGE_DATA_SIZE;
+
+    if (logical_page >= NAND_NUM_LOGICAL_PAGES) {
+        return Ret_AddressInvalid;
+    }
+#if NAND_MAP_DEMAND
+    map_read_failed = 0;
+#endif
+    NAND_MapEntry entry = __map_get(logical_page);
+#if NAND_MAP_DEMAND
+    /* not knowing where the page is must not read back as erased */
+    if (map_read_failed) {
+        return Ret_ReadFailed;
+    }
+#endif
+    if (entry == NAND_MAP_UNMAPPED) {
+        return Ret_PageNotMapped;
+    }
+
+    __map_physical_page(MAP_PHYS(entry), *address % PAGE_DATA_SIZE, addr_struct);
 
     return Ret_Success;
 }
+
+/**
+    @brief Fills in the device addresses of a physical page in the FTL region.
+    @note column is the byte offset inside the page; values from PAGE_DATA_SIZE onwards
+          address the spare area.
+ */
+void __map_physical_page(NAND_PhysPage phys, uint16_t column, PhysicalAddrs *addr_struct) {
+    uint16_t block     = NAND_FTL_FIRST_BLOCK + (phys / NUM_PAGES_PER_BLOCK);
+    uint16_t page      = phys % NUM_PAGES_PER_BLOCK;
+    uint16_t die_block = block & ((1 << DIE_BLOCK_BITS) - 1);
+
+    addr_struct -> die      = block >> DIE_BLOCK_BITS;
+    addr_struct -> plane    = die_block & PLANE_MASK;
+    addr_struct -> block    = block;
+    addr_struct -> page     = page;
+    addr_struct -> rowAddr  = ((uint32_t) die_block << ROW_ADDRESS_PAGE_BITS) | page;
+    addr_struct -> colAddr  = ((uint32_t) (die_block & PLANE_MASK) << COL_ADDRESS_BITS) | column;
+}
+
+/**
+    @brief Returns the mapping entry of logical_page, or NAND_MAP_UNMAPPED.
+    @note O(log extents) in extent mode. With NAND_MAP_DEMAND a miss reads flash; if that
+          fails, map_read_failed is set and NAND_MAP_UNMAPPED returned.
+ */
+NAND_MapEntry __map_get(uint32_t logical_page) {
+#if NAND_MAP_EXTENTS
+    uint16_t i = __map_upper_bound(logical_page);
+
+    if (i > 0 && logical_page - extents[i - 1].logical_start < extents[i - 1].length) {
+        return extents[i - 1].physical_start + (logical_page - extents[i - 1].logical_start);
+    }
+    return NAND_MAP_UNMAPPED;
+#elif NAND_MAP_DEMAND
+    PhysicalAddrs addr_i;
+    NAND_PhysPage entry = NAND_MAP_UNMAPPED;
+    NAND_PhysPage page  = map_pages[logical_page / NAND_MAP_ENTRIES_PER_PAGE];
+    NAND_MapSegment *slot = __map_load(logical_page / NAND_MAP_SEGMENT_ENTRIES);
+
+    if (slot != NULL) {
+        return slot -> entries[logical_page % NAND_MAP_SEGMENT_ENTRIES];
+    }
+
+    /* every slot is dirty, and this segment is not one of them: flash is up to date */
+    if (page != NAND_MAP_UNMAPPED) {
+        __map_physical_page(page, (logical_page % NAND_MAP_ENTRIES_PER_PAGE) * sizeof(entry), &addr_i);
+        if (NAND_Page_Read(map_hspi, &addr_i, (uint8_t *) &entry, sizeof(entry)) != Ret_Success ||
+            (entry != NAND_MAP_UNMAPPED && entry >= NAND_FTL_NUM_BLOCKS * NUM_PAGES_PER_BLOCK)) {
+            map_read_failed = 1;
+            entry = NAND_MAP_UNMAPPED;
+        }
+    }
+    return entry;
+#else
+    return l2p[logical_page];
+#endif
+}
+
+/**
+    @brief Maps logical_page to entry, or unmaps it if entry is NAND_MAP_UNMAPPED.
+    @note In extent mode the extent holding the page is trimmed or split around it, and
+          the new entry is merged into a neighbouring extent when it continues it both
+          logically and physically, so sequential writes keep extending one extent.
+          With NAND_MAP_DEMAND the cached segment is marked dirty, unless entry is what it
+          already held.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow  The extent table is full. logical_page keeps its old entry
+                                if that needed a split, else it is left unmapped. With
+                                NAND_MAP_DEMAND, every cache slot is dirty or the segment
+                                could not be read, and nothing changed.
+    @retval Ret_Success
+ */
+NAND_ReturnType __map_set(uint32_t logical_page, NAND_MapEntry entry) {
+#if NAND_MAP_EXTENTS
+    uint16_t i = __map_upper_bound(logical_page);
+
+    /* take logical_page out of the extent holding it */
+    if (i > 0 && logical_page - extents[i - 1].logical_start < extents[i - 1].length) {
+        NAND_Extent *extent = &extents[i - 1];
+        uint16_t before = logical_page - extent -> logical_start;
+        uint16_t after  = extent -> length - before - 1;
+
+        if (before == 0 && after == 0) {
+            __map_remove_extent(i - 1);
+            i--;
+        } else if (before == 0) {
+            extent -> logical_start++;
+            extent -> physical_start++;
+            extent -> length--;
+            i--;
+        } else if (after == 0) {
+            extent -> length--;
+        } else if (extent_count == NAND_EXTENT_MAX) {
+            return Ret_MemoryOverflow;
+        } else {
+            NAND_Extent tail = {
+                .logical_start  = logical_page + 1,
+                .physical_start = extent -> physical_start + before + 1,
+                .length         = after,
+            };
+            extent -> length = before;
+            __map_insert_extent(i, &tail);
+        }
+    }
+
+    if (entry == NAND_MAP_UNMAPPED) {
+        return Ret_Success;
+    }
+
+    /* extents[i] is now the first extent starting after logical_page */
+    uint8_t joins_prev = i > 0 &&
+                         extents[i - 1].logical_start + extents[i - 1].length == logical_page &&
+                         extents[i - 1].physical_start + extents[i - 1].length == entry;
+    uint8_t joins_next = i < extent_count &&
+                         extents[i].logical_start == logical_page + 1 &&
+                         extents[i].physical_start == entry + 1;
+
+    if (joins_prev && joins_next) {
+        extents[i - 1].length += 1 + extents[i].length;
+        __map_remove_extent(i);
+    } else if (joins_prev) {
+        extents[i - 1].length++;
+    } else if (joins_next) {
+        extents[i].logical_start--;
+        extents[i].physical_start--;
+        extents[i].length++;
+    } else {
+        NAND_Extent single = { .logical_start = logical_page, .physical_start = entry, .length = 1 };
+        return __map_insert_extent(i, &single);
+    }
+    return Ret_Success;
+#elif NAND_MAP_DEMAND
+    NAND_MapSegment *slot = __map_load(logical_page / NAND_MAP_SEGMENT_ENTRIES);
+    NAND_PhysPage *target;
+
+    if (slot == NULL) {
+        return Ret_MemoryOverflow;
+    }
+    target = &slot -> entries[logical_page % NAND_MAP_SEGMENT_ENTRIES];
+    if (*target != entry) {
+        *target = entry;
+        if (!slot -> dirty) {
+            slot -> dirty = 1;
+            map_dirty++;
+        }
+    }
+    return Ret_Success;
+#else
+    l2p[logical_page] = entry;
+    return Ret_Success;
+#endif
+}
+
+/**
+    @brief Unmaps every logical page.
+    @note With NAND_MAP_DEMAND, forgets the translation pages and empties the cache instead.
+ */
+void __map_clear(void) {
+#if NAND_MAP_EXTENTS
+    extent_count = 0;
+#elif NAND_MAP_DEMAND
+    memset(map_cache, 0, sizeof(map_cache));
+    for (uint16_t i = 0; i < NAND_MAP_CACHE_SEGMENTS; i++) {
+        map_cache[i].segment = MAP_NO_SEGMENT;
+    }
+    memset(map_pages, 0xFF, sizeof(map_pages));
+    memset(map_sequence, 0, sizeof(map_sequence));
+    map_dirty = 0;
+    map_clock = 0;
+#else
+    memset(l2p, 0xFF, sizeof(l2p));
+#endif
+}
+
+/**
+    @brief Checks that the mapping has room for the updates of one page write or trim.
+    @note Always succeeds with the page map. In extent mode, host requests leave
+          NAND_EXTENT_RESERVE extents free so that space reclamation can copy a block.
+          With NAND_MAP_DEMAND, only fails once write-backs kept failing until no clean
+          cache slot was left.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __map_reserve(void) {
+#if NAND_MAP_EXTENTS
+    uint16_t needed = reclaiming ? 2 : NAND_EXTENT_RESERVE;
+
+    if (NAND_EXTENT_MAX - extent_count < needed) {
+        return Ret_MemoryOverflow;
+    }
+#elif NAND_MAP_DEMAND
+    if (map_dirty >= NAND_MAP_CACHE_SEGMENTS) {
+        return Ret_MemoryOverflow;
+    }
+#endif
+    return Ret_Success;
+}
+
+/**
+    @brief Checks that the mapping has room for unmapping logical pages first_page up to
+           end_page - 1.
+    @note In extent mode, only a range inside a single extent splits it, which takes one
+          extent plus the two space reclamation needs. Any other range frees extents, so
+          trims can still make room once writes are refused. Otherwise as __map_reserve.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __map_reserve_trim(uint32_t first_page, uint32_t end_page) {
+#if NAND_MAP_EXTENTS
+    uint16_t i = __map_upper_bound(first_page);
+
+    if (i > 0 && first_page > extents[i - 1].logical_start &&
+        end_page < extents[i - 1].logical_start + extents[i - 1].length &&
+        NAND_EXTENT_MAX - extent_count < 3) {
+        return Ret_MemoryOverflow;
+    }
+    return Ret_Success;
+#else
+    (void) first_page;
+    (void) end_page;
+    return __map_reserve();
+#endif
+}
+
+/**
+    @brief Returns how many pages from first_page on to unmap last to first when unmapping
+           first_page up to end_page - 1; the rest of the range goes first to last.
+    @note In extent mode, these are the pages of the range in the extent holding
+          first_page: unmapped from its far end, that extent shrinks instead of being split
+          on the way, so a trim never needs more extents than __map_reserve_trim checked.
+          0 otherwise.
+ */
+uint32_t __map_trim_head(uint32_t first_page, uint32_t end_page) {
+#if NAND_MAP_EXTENTS
+    uint16_t i = __map_upper_bound(first_page);
+
+    if (first_page < end_page && i > 0 && first_page - extents[i - 1].logical_start < extents[i - 1].length) {
+        uint32_t extent_end = extents[i - 1].logical_start + extents[i - 1].length;
+        return ((extent_end < end_page) ? extent_end : end_page) - first_page;
+    }
+#else
+    (void) first_page;
+    (void) end_page;
+#endif
+    return 0;
+}
+
+#if NAND_MAP_DEMAND
+/**
+    @brief Returns the cache slot holding segment. On a miss, the segment is read from its
+           translation page into the least recently used clean slot.
+    @note Dirty slots are only emptied by writing them back, see __ftl_flush_map. A segment
+          whose translation page was never written reads as unmapped. Entries beyond the
+          managed blocks count as a failed read.
+
+    @return The slot, or NULL if every slot is dirty or the read failed (map_read_failed)
+ */
+NAND_MapSegment *__map_load(uint32_t segment) {
+    PhysicalAddrs addr_i;
+    NAND_MapSegment *victim = NULL;
+    NAND_PhysPage page = map_pages[segment / MAP_SEGMENTS_PER_PAGE];
+
+    map_clock++;
+    for (uint16_t i = 0; i < NAND_MAP_CACHE_SEGMENTS; i++) {
+        if (map_cache[i].segment == segment) {
+            map_cache[i].used = map_clock;
+            return &map_cache[i];
+        }
+        if (!map_cache[i].dirty && (victim == NULL || map_cache[i].used < victim -> used)) {
+            victim = &map_cache[i];
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    victim -> segment = MAP_NO_SEGMENT;
+    victim -> used    = 0;
+    if (page == NAND_MAP_UNMAPPED) {
+        memset(victim -> entries, 0xFF, sizeof(victim -> entries));
+    } else {
+        __map_physical_page(page, (segment % MAP_SEGMENTS_PER_PAGE) * sizeof(victim -> entries), &addr_i);
+        if (NAND_Page_Read(map_hspi, &addr_i, (uint8_t *) victim -> entries, sizeof(victim -> entries)) != Ret_Success) {
+            map_read_failed = 1;
+            return NULL;
+        }
+        /* entries index the block tables, so a page that is not what it should be fails here */
+        for (uint16_t i = 0; i < NAND_MAP_SEGMENT_ENTRIES; i++) {
+            if (victim -> entries[i] != NAND_MAP_UNMAPPED && victim -> entries[i] >= NAND_FTL_NUM_BLOCKS * NUM_PAGES_PER_BLOCK) {
+                map_read_failed = 1;
+                return NULL;
+            }
+        }
+    }
+    victim -> segment = segment;
+    victim -> used    = map_clock;
+
+    return victim;
+}
+#endif
+
+#if NAND_MAP_EXTENTS
+/* index of the first extent starting after logical_page, found by binary search */
+uint16_t __map_upper_bound(uint32_t logical_page) {
+    uint16_t low = 0;
+    uint16_t high = extent_count;
+
+    while (low < high) {
+        uint16_t mid = (low + high) / 2;
+        if (extents[mid].logical_start <= logical_page) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+NAND_ReturnType __map_insert_extent(uint16_t index, NAND_Extent *extent) {
+    if (extent_count == NAND_EXTENT_MAX) {
+        return Ret_MemoryOverflow;
+    }
+    memmove(&extents[index + 1], &extents[index], (extent_count - index) * sizeof(NAND_Extent));
+    extents[index] = *extent;
+    extent_count++;
+    return Ret_Success;
+}
+
+void __map_remove_extent(uint16_t index) {
+    memmove(&extents[index], &extents[index + 1], (extent_count - index - 1) * sizeof(NAND_Extent));
+    extent_count--;
+}
+#endif
+
+/**
+    @brief Reads the spare area tag of a physical page.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_read_tag(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, PageTag *tag) {
+    PhysicalAddrs addr_i;
+
+    __map_physical_page(phys, PAGE_DATA_SIZE + SPARE_USER_OFFSET, &addr_i);
+    return NAND_Page_Read(hspi, &addr_i, (uint8_t *) tag, sizeof(PageTag));
+}
+
+#if NAND_PAGE_CRC
+/**
+    @brief Reads the data area of a physical page into buffer and checks it against the CRC
+           in its tag, which comes in the same transfer.
+    @note A mismatch is read again, up to NAND_PAGE_CRC_ATTEMPTS reads in all, and counts
+          as a failed read towards slowing the SPI clock each time. On Ret_CorruptData,
+          buffer holds the data as last read and kept_crc the CRC it should have had.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_CorruptData
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_read_checked(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint8_t *buffer) {
+    PhysicalAddrs addr_i;
+    PageTag tag;
+    uint8_t bad_block_mark[SPARE_USER_OFFSET];
+    SPI_Params segments[3] = {
+        { .buffer = buffer,                 .length = PAGE_DATA_SIZE },
+        { .buffer = bad_block_mark,         .length = SPARE_USER_OFFSET },
+        { .buffer = (uint8_t *) &tag,       .length = sizeof(PageTag) },
+    };
+
+    __map_physical_page(phys, 0, &addr_i);
+    for (uint8_t attempt = 0; attempt < NAND_PAGE_CRC_ATTEMPTS; attempt++) {
+        if (NAND_Page_Read_Segments(hspi, &addr_i, segments, 3) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        if (NAND_CRC32C(0, buffer, PAGE_DATA_SIZE) == tag.crc) {
+            return Ret_Success;
+        }
+        __clock_track(hspi, 1);
+    }
+
+    kept_crc = tag.crc;
+    return Ret_CorruptData;
+}
+#endif
+
+/**
+    @brief Rebuilds the mapping table and block states by scanning the tags of every page.
+    @note Blocks whose first spare byte is not 0xFF carry the factory bad-block mark.
+          When two pages claim the same logical page, the higher sequence number wins.
+          Trim records are applied after all data pages have been seen.
+          A block that was only partly programmed before power loss is closed rather than
+          appended to, since its last page may be unreliable. Blocks that look erased are
+          only trusted if the newest free list record lists them; the rest, and full blocks
+          without valid pages, are left for NAND_Idle to erase. Pages of a transaction that
+          was not committed are left unmapped and then rolled back on flash.
+          With NAND_MAP_DEMAND, data pages are claimed by __ftl_mount_replay instead, once
+          the newest copy of every translation page is known. With NAND_MAP_EXTENTS, they
+          are claimed and trimmed by __ftl_mount_extents.
+          With NAND_BLOCK_SUMMARY, the tags of a block with a summary page are taken from it.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount(SPI_HandleTypeDef *hspi) {
+    PhysicalAddrs addr_i;
+    PageTag tag;
+    uint8_t bad_block_mark[SPARE_USER_OFFSET];
+    SPI_Params first_page[2] = {
+        { .buffer = bad_block_mark,     .length = SPARE_USER_OFFSET },
+        { .buffer = (uint8_t *) &tag,   .length = sizeof(PageTag) },
+    };
+    uint32_t max_sequence = 0;
+    uint32_t list_sequence = 0;
+    NAND_PhysPage list_phys = NAND_PAGE_PENDING;   // none found yet
+    uint32_t stats_sequence = 0;
+    NAND_PhysPage stats_phys = NAND_PAGE_PENDING;
+    uint32_t commit_sequence = 0;
+    uint32_t newest_txn = 0;
+    uint16_t bad_blocks = 0;
+
+    NAND_Get_ECC_Counts(ecc_at_load);
+
+#if NAND_MAP_DEMAND
+    map_hspi        = hspi;
+    map_read_failed = 0;
+#endif
+    __map_clear();
+    memset(written_count, 0, sizeof(written_count));
+    memset(trim_records, 0, sizeof(trim_records));
+    memset(heat, 0, sizeof(heat));
+    memset(listed_free, 0, sizeof(listed_free));
+    free_blocks   = 0;
+    dirty_blocks  = 0;
+    txn_count     = 0;
+    txn_open      = 0;
+    committed_txn = 0;
+    commit_block  = NAND_FTL_NUM_BLOCKS;
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        NAND_PhysPage first = block * NUM_PAGES_PER_BLOCK;
+
+        /* the bad-block mark and the tag of the first page in one read */
+        __map_physical_page(first, BAD_BLOCK_BYTE, &addr_i);
+        if (NAND_Page_Read_Segments(hspi, &addr_i, first_page, 2) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        if (bad_block_mark[0] != 0xFF) {
+            block_state[block] = BLOCK_BAD;
+            bad_blocks++;
+            continue;
+        }
+
+        block_state[block] = BLOCK_FREE;
+
+#if NAND_BLOCK_SUMMARY
+        /* a full block gives the tags of all its pages in one more read */
+        PageTag summary_tag;
+        uint8_t summarized = 0;
+        if (tag.type != PAGE_TAG_ERASED) {
+            if (__ftl_read_summary(hspi, block, &summary_tag) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+            summarized = summary_tag.type == PAGE_TAG_SUMMARY && summary_tag.logical_page == NAND_SUMMARY_ENTRIES;
+        }
+#endif
+
+        uint8_t page;
+        for (page = 0; page < NUM_PAGES_PER_BLOCK; page++) {
+#if NAND_BLOCK_SUMMARY
+            if (summarized && page == NAND_SUMMARY_ENTRIES) {
+                tag = summary_tag;
+            } else if (summarized) {
+                NAND_SummaryEntry *entry = &summary[0][page];
+                if (entry -> type == PAGE_TAG_NONE) {
+                    /* its program failed */
+                    written_count[block]++;
+                    continue;
+                }
+                tag.type         = entry -> type;
+                tag.logical_page = entry -> logical_page;
+                tag.sequence     = entry -> sequence;
+                tag.txn          = entry -> txn;
+            } else
+#endif
+            if (page > 0 && __ftl_read_tag(hspi, first + page, &tag) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+            if (tag.type == PAGE_TAG_ERASED) {
+                break;
+            }
+            block_state[block]    = BLOCK_FULL;
+            block_sequence[block] = tag.sequence;
+
+            if (tag.sequence > max_sequence) {
+                max_sequence = tag.sequence;
+            }
+            written_count[block]++;
+
+            if (tag.type == PAGE_TAG_TRIM) {
+                trim_records[block]++;
+            } else if (tag.type == PAGE_TAG_FREE && tag.logical_page == NAND_FTL_NUM_BLOCKS) {
+                if (list_phys == NAND_PAGE_PENDING || tag.sequence > list_sequence) {
+                    list_phys     = first + page;
+                    list_sequence = tag.sequence;
+                }
+            } else if (tag.type == PAGE_TAG_STATS && tag.logical_page == NAND_FTL_NUM_BLOCKS) {
+                if (stats_phys == NAND_PAGE_PENDING || tag.sequence > stats_sequence) {
+                    stats_phys     = first + page;
+                    stats_sequence = tag.sequence;
+                }
+            } else if (tag.type == PAGE_TAG_COMMIT) {
+                if (tag.logical_page > committed_txn ||
+                    (tag.logical_page == committed_txn && tag.sequence > commit_sequence)) {
+                    committed_txn   = tag.logical_page;
+                    commit_sequence = tag.sequence;
+                    commit_block    = block;
+                }
+#if NAND_MAP_DEMAND
+            } else if (tag.type == PAGE_TAG_MAP && tag.logical_page < NAND_MAP_PAGES) {
+                if (map_pages[tag.logical_page] == NAND_MAP_UNMAPPED || tag.sequence > map_sequence[tag.logical_page]) {
+                    map_pages[tag.logical_page]    = first + page;
+                    map_sequence[tag.logical_page] = tag.sequence;
+                }
+#endif
+            } else if (tag.type == PAGE_TAG_DATA && !FTL_MOUNT_DEFERS_CLAIMS) {
+                NAND_ReturnType status = __ftl_mount_claim(hspi, tag.logical_page, MAP_ENTRY(first + page, 0), tag.sequence);
+                if (status != Ret_Success) {
+                    return status;
+                }
+            } else if (tag.type == PAGE_TAG_TXN) {
+                NAND_ReturnType status = __ftl_mount_txn_page(hspi, &tag, first + page, &newest_txn);
+                if (status != Ret_Success) {
+                    return status;
+                }
+#if NAND_COMPRESSION
+            } else if (tag.type == PAGE_TAG_PACKED && tag.logical_page <= NAND_PACK_MAX_CHUNKS) {
+                NAND_PackEntry entry;
+
+                __map_physical_page(first + page, 0, &addr_i);
+                if (NAND_Page_Read(hspi, &addr_i, page_buffer, NAND_PACK_HEADER_SIZE) != Ret_Success) {
+                    return Ret_ReadFailed;
+                }
+                written_count[block] += tag.logical_page - 1;
+                for (uint8_t slot = 0; slot < tag.logical_page; slot++) {
+                    memcpy(&entry, &page_buffer[slot * sizeof(NAND_PackEntry)], sizeof(entry));
+                    if (__ftl_mount_claim(hspi, entry.logical_page, MAP_ENTRY(first + page, slot + 1), tag.sequence) != Ret_Success) {
+                        return Ret_ReadFailed;
+                    }
+                }
+#endif
+            }
+        }
+
+        if (block_state[block] != BLOCK_FREE && page < NUM_PAGES_PER_BLOCK) {
+            /* the unprogrammed rest of the block is only regained by erasing it */
+            written_count[block] += NUM_PAGES_PER_BLOCK - page;
+        }
+    }
+
+    /* the first mount only finds the factory bad blocks */
+    if (stats_phys != NAND_PAGE_PENDING) {
+        __map_physical_page(stats_phys, 0, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, (uint8_t *) &counters, sizeof(counters)) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        stats_block = stats_phys / NUM_PAGES_PER_BLOCK;
+    } else {
+        memset(&counters, 0, sizeof(counters));
+        counters.factory_bad_blocks = bad_blocks;
+        stats_block = NAND_FTL_NUM_BLOCKS;
+    }
+    stats_saved_at  = counters.pages_programmed;
+    erases_saved_at = counters.blocks_erased;
+    host_saved_at   = counters.host_bytes_written;
+
+    /* an erase cut short by power loss can leave a block that only looks erased */
+    if (list_phys != NAND_PAGE_PENDING) {
+        __map_physical_page(list_phys, 0, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, page_buffer, FREE_LIST_SIZE) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        free_list_block = list_phys / NUM_PAGES_PER_BLOCK;
+    } else {
+        free_list_block = NAND_FTL_NUM_BLOCKS;
+    }
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] != BLOCK_FREE) {
+            continue;
+        }
+        if (list_phys != NAND_PAGE_PENDING && (page_buffer[block / 8] & (1 << (block % 8)))) {
+            listed_free[block] = 1;
+            free_blocks++;
+        } else {
+            block_state[block] = BLOCK_DIRTY;
+            dirty_blocks++;
+        }
+    }
+
+    /* ready for writes from here on, which mount itself may need */
+    next_sequence = max_sequence + 1;
+    for (uint8_t stream = 0; stream < FTL_NUM_APPEND_POINTS; stream++) {
+        open_block[stream] = NAND_FTL_NUM_BLOCKS;   // no open block until the first write
+        open_page[stream]  = 0;
+    }
+    alloc_cursor  = 0;
+    reclaiming    = 0;
+    heat_writes   = 0;
+    replenishing  = free_blocks < NAND_FTL_POOL_LOW_WATERMARK;
+
+#if NAND_MAP_DEMAND
+    NAND_ReturnType replayed = __ftl_mount_replay(hspi, newest_txn);
+    if (replayed != Ret_Success) {
+        return replayed;
+    }
+#elif NAND_MAP_EXTENTS
+    NAND_ReturnType resolved = __ftl_mount_extents(hspi, newest_txn);
+    if (resolved != Ret_Success) {
+        return resolved;
+    }
+#endif
+
+    /* the newest transaction only counts if its commit record reached flash */
+    if (committed_txn >= newest_txn) {
+        for (uint8_t i = 0; i < txn_count; i++) {
+            NAND_ReturnType status = __ftl_mount_claim(hspi, txn_pages[i].logical_page, MAP_ENTRY(txn_pages[i].phys, 0),
+                                                       txn_pages[i].sequence);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+        txn_count = 0;
+    }
+    txn_id   = newest_txn;
+    next_txn = ((committed_txn > newest_txn) ? committed_txn : newest_txn) + 1;
+
+    /* trim records only make sense once the newest copy of every page is known */
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS && !NAND_MAP_EXTENTS; block++) {
+        if (trim_records[block] > 0) {
+            NAND_ReturnType status = __ftl_apply_trim_records(hspi, block);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+    }
+
+    memset(valid_count, 0, sizeof(valid_count));
+    for (uint32_t i = 0; i < NAND_NUM_LOGICAL_PAGES; i++) {
+        NAND_MapEntry entry = __map_get(i);
+        if (entry != NAND_MAP_UNMAPPED) {
+            valid_count[MAP_PHYS(entry) / NUM_PAGES_PER_BLOCK]++;
+        }
+    }
+#if NAND_MAP_DEMAND
+    if (map_read_failed) {
+        return Ret_ReadFailed;
+    }
+    for (uint16_t index = 0; index < NAND_MAP_PAGES; index++) {
+        if (map_pages[index] != NAND_MAP_UNMAPPED) {
+            valid_count[map_pages[index] / NUM_PAGES_PER_BLOCK]++;
+        }
+    }
+#endif
+
+#if NAND_COMPRESSION
+    memset(pack_buffer, 0xFF, NAND_PACK_HEADER_SIZE);
+    pack_count    = 0;
+    pack_fill     = NAND_PACK_HEADER_SIZE;
+    reclaim_count = 0;
+#endif
+
+    /* blocks kept only by their trim records: one checkpoint makes those redundant, so all
+     * of them can be erased below; without a spare block they are left to reclamation */
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_FULL && valid_count[block] == 0 && trim_records[block] > 0) {
+            if (free_blocks > NAND_FTL_GC_THRESHOLD) {
+                reclaiming = 1;
+                NAND_ReturnType status = __ftl_checkpoint_trims(hspi);
+                reclaiming = 0;
+                if (status != Ret_Success && status != Ret_MemoryOverflow) {
+                    return status;
+                }
+            }
+            break;
+        }
+    }
+
+    /* reclaimed before the reboot, but not erased yet */
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_FULL && valid_count[block] == 0 && trim_records[block] == 0) {
+            block_state[block] = BLOCK_DIRTY;
+            dirty_blocks++;
+        }
+    }
+
+    /* if this fails, the rollback stays pending and NAND_Txn_Begin retries it */
+    if (txn_count > 0) {
+        __ftl_txn_rollback(hspi);
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Handles a page written by a transaction during mount.
+    @note Scan order is by block, so whether the newest transaction was committed is only
+          known at the end. Its pages are held in txn_pages until then, the newest copy of
+          each logical page only. Pages of older transactions were either committed or
+          rolled back, so they compete for the mapping like any other page (with
+          NAND_MAP_DEMAND, in __ftl_mount_replay; with NAND_MAP_EXTENTS, in
+          __ftl_mount_extents).
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_txn_page(SPI_HandleTypeDef *hspi, PageTag *tag, NAND_PhysPage phys, uint32_t *newest_txn) {
+    if (tag->txn < *newest_txn) {
+        return FTL_MOUNT_DEFERS_CLAIMS ? Ret_Success : __ftl_mount_claim(hspi, tag->logical_page, MAP_ENTRY(phys, 0), tag->sequence);
+    }
+
+    if (tag->txn > *newest_txn) {
+        /* the transaction held so far is an older one after all */
+        for (uint8_t i = 0; i < txn_count && !FTL_MOUNT_DEFERS_CLAIMS; i++) {
+            NAND_ReturnType status = __ftl_mount_claim(hspi, txn_pages[i].logical_page, MAP_ENTRY(txn_pages[i].phys, 0),
+                                                       txn_pages[i].sequence);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+        txn_count   = 0;
+        *newest_txn = tag->txn;
+    }
+
+    if (tag->logical_page >= NAND_NUM_LOGICAL_PAGES) {
+        return Ret_Success;
+    }
+
+    /* space reclamation may have copied a page of the open transaction */
+    uint8_t i = __ftl_txn_find(tag->logical_page);
+    if (i == txn_count) {
+        if (txn_count == NAND_TXN_MAX_PAGES) {
+            return Ret_MemoryOverflow;
+        }
+        txn_count++;
+    } else if (txn_pages[i].sequence > tag->sequence) {
+        return Ret_Success;
+    }
+    txn_pages[i].logical_page = tag->logical_page;
+    txn_pages[i].phys         = phys;
+    txn_pages[i].sequence     = tag->sequence;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Maps logical_page to entry during mount unless a newer copy is already mapped.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_claim(SPI_HandleTypeDef *hspi, uint32_t logical_page, NAND_MapEntry entry, uint32_t sequence) {
+    PageTag other;
+    NAND_MapEntry current;
+
+    if (logical_page >= NAND_NUM_LOGICAL_PAGES) {
+        return Ret_Success;
+    }
+
+    /* resolve duplicates left behind by overwrites */
+    current = __map_get(logical_page);
+    if (current != NAND_MAP_UNMAPPED) {
+        if (__ftl_read_tag(hspi, MAP_PHYS(current), &other) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+#if NAND_MAP_DEMAND
+        /* a translation page may still point at a page reclaimed since it was written */
+        if (!__ftl_tag_owns(&other, logical_page)) {
+            other.sequence = 0;
+        }
+#endif
+        if (other.sequence > sequence) {
+            return Ret_Success;
+        }
+    }
+
+    return __map_set(logical_page, entry);
+}
+
+#if NAND_MAP_EXTENTS
+/**
+    @brief Maps the data pages found at mount, one window of FTL_MOUNT_WINDOW logical
+           pages at a time.
+    @note Claimed in scan order, a stale copy can split an extent that the newest copy
+          joins again later, so the table could overflow on the way to a mapping that
+          fits. Instead the newest copy of every page in the window is found first, then
+          the window is mapped in logical order and takes no more extents than the result.
+          Pages of transactions older than newest_txn count as data pages; those of the
+          newest one only if it was committed, and txn_count is cleared then. Trim records
+          are applied as well. Reads the summaries once per window, and the tags of blocks
+          without a valid summary; the window is kept in a leased buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_extents(SPI_HandleTypeDef *hspi, uint32_t newest_txn) {
+    NAND_MapEntry *window = (NAND_MapEntry *) __pool_acquire();
+    NAND_ReturnType status = Ret_Success;
+
+    if (window == NULL) {
+        return Ret_MemoryOverflow;
+    }
+
+    for (uint32_t first = 0; first < NAND_NUM_LOGICAL_PAGES && status == Ret_Success; first += FTL_MOUNT_WINDOW) {
+        status = __ftl_mount_window(hspi, window, first, newest_txn);
+    }
+    __pool_release((uint8_t *) window);
+
+    if (status == Ret_Success && committed_txn >= newest_txn) {
+        txn_count = 0;
+    }
+    return status;
+}
+
+/**
+    @brief Finds the newest copy of logical pages first.. first + FTL_MOUNT_WINDOW - 1,
+           leaves out the trimmed ones and maps the rest, see __ftl_mount_extents.
+    @note Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_window(SPI_HandleTypeDef *hspi, NAND_MapEntry *window, uint32_t first, uint32_t newest_txn) {
+    PhysicalAddrs addr_i;
+    PageTag tag, mapped;
+    NAND_TrimRange range;
+    uint32_t count = NAND_NUM_LOGICAL_PAGES - first;
+
+    if (count > FTL_MOUNT_WINDOW) {
+        count = FTL_MOUNT_WINDOW;
+    }
+    memset(window, 0xFF, count * sizeof(NAND_MapEntry));
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        uint8_t summarized;
+
+        if (block_state[block] != BLOCK_FULL) {
+            continue;
+        }
+        if (__ftl_mount_window_summary(hspi, block, &summarized) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        for (uint8_t page = 0; page < NUM_PAGES_PER_BLOCK; page++) {
+            NAND_PhysPage phys = block * NUM_PAGES_PER_BLOCK + page;
+
+            if (__ftl_mount_window_tag(hspi, phys, summarized, &tag) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+            if (tag.type == PAGE_TAG_ERASED) {
+                break;
+            }
+            if ((tag.type != PAGE_TAG_DATA && (tag.type != PAGE_TAG_TXN || tag.txn >= newest_txn)) ||
+                tag.logical_page - first >= count) {
+                continue;
+            }
+
+            /* resolve duplicates left behind by overwrites, as __ftl_mount_claim does */
+            NAND_MapEntry *slot = &window[tag.logical_page - first];
+            if (*slot != NAND_MAP_UNMAPPED) {
+                if (__ftl_read_tag(hspi, *slot, &mapped) != Ret_Success) {
+                    return Ret_ReadFailed;
+                }
+                if (mapped.sequence > tag.sequence) {
+                    continue;
+                }
+            }
+            *slot = phys;
+        }
+    }
+
+    /* the newest transaction only counts if its commit record reached flash */
+    for (uint8_t i = 0; i < txn_count && committed_txn >= newest_txn; i++) {
+        if (txn_pages[i].logical_page - first >= count) {
+            continue;
+        }
+        NAND_MapEntry *slot = &window[txn_pages[i].logical_page - first];
+        if (*slot != NAND_MAP_UNMAPPED) {
+            if (__ftl_read_tag(hspi, *slot, &mapped) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+            if (mapped.sequence > txn_pages[i].sequence) {
+                continue;
+            }
+        }
+        *slot = txn_pages[i].phys;
+    }
+
+    /* as in __ftl_apply_trim_records, only copies older than the record are trimmed */
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        uint8_t summarized;
+
+        if (trim_records[block] == 0) {
+            continue;
+        }
+        if (__ftl_mount_window_summary(hspi, block, &summarized) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        for (uint8_t page = 0; page < NUM_PAGES_PER_BLOCK; page++) {
+            NAND_PhysPage phys = block * NUM_PAGES_PER_BLOCK + page;
+
+            if (__ftl_mount_window_tag(hspi, phys, summarized, &tag) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+            if (tag.type == PAGE_TAG_ERASED) {
+                break;
+            }
+            if (tag.type != PAGE_TAG_TRIM || tag.logical_page > NAND_TRIM_RANGES_PER_PAGE) {
+                continue;
+            }
+
+            __map_physical_page(phys, 0, &addr_i);
+            if (NAND_Page_Read(hspi, &addr_i, page_buffer, tag.logical_page * sizeof(NAND_TrimRange)) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+
+            for (uint32_t i = 0; i < tag.logical_page; i++) {
+                memcpy(&range, &page_buffer[i * sizeof(NAND_TrimRange)], sizeof(range));
+                if (range.first_page >= NAND_NUM_LOGICAL_PAGES ||
+                    range.num_pages > NAND_NUM_LOGICAL_PAGES - range.first_page) {
+                    continue;
+                }
+                uint32_t start = (range.first_page > first) ? range.first_page : first;
+                uint32_t end   = range.first_page + range.num_pages;
+                if (end > first + count) {
+                    end = first + count;
+                }
+                for (uint32_t logical_page = start; logical_page < end; logical_page++) {
+                    NAND_MapEntry *slot = &window[logical_page - first];
+                    if (*slot == NAND_MAP_UNMAPPED) {
+                        continue;
+                    }
+                    if (__ftl_read_tag(hspi, *slot, &mapped) != Ret_Success) {
+                        return Ret_ReadFailed;
+                    }
+                    if (mapped.sequence < tag.sequence) {
+                        *slot = NAND_MAP_UNMAPPED;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (window[i] != NAND_MAP_UNMAPPED && __map_set(first + i, window[i]) != Ret_Success) {
+            return Ret_MemoryOverflow;
+        }
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Reads the summary of block into summary[0] for __ftl_mount_window_tag, and
+           tells in summarized whether it is valid.
+    @note Only a block that was filled has one. Always 0 without NAND_BLOCK_SUMMARY.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_window_summary(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *summarized) {
+    *summarized = 0;
+#if NAND_BLOCK_SUMMARY
+    PageTag tag;
+
+    if (__ftl_read_summary(hspi, block, &tag) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+    *summarized = tag.type == PAGE_TAG_SUMMARY && tag.logical_page == NAND_SUMMARY_ENTRIES;
+#else
+    (void) hspi;
+    (void) block;
+#endif
+    return Ret_Success;
+}
+
+/**
+    @brief Returns the tag of phys into tag: from the summary of its block in summary[0]
+           if summarized, else read from flash.
+    @note The summary page itself comes back as PAGE_TAG_SUMMARY, a page whose program
+          failed as PAGE_TAG_NONE.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_window_tag(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint8_t summarized, PageTag *tag) {
+#if NAND_BLOCK_SUMMARY
+    uint8_t page = phys % NUM_PAGES_PER_BLOCK;
+
+    if (summarized) {
+        memset(tag, 0, sizeof(PageTag));
+        if (page == NAND_SUMMARY_ENTRIES) {
+            tag -> type = PAGE_TAG_SUMMARY;
+            return Ret_Success;
+        }
+        tag -> type         = summary[0][page].type;
+        tag -> logical_page = summary[0][page].logical_page;
+        tag -> sequence     = summary[0][page].sequence;
+        tag -> txn          = summary[0][page].txn;
+        return Ret_Success;
+    }
+#else
+    (void) summarized;
+#endif
+    return __ftl_read_tag(hspi, phys, tag);
+}
+#endif
+
+/**
+    @brief Unmaps logical_page and removes its old copy from the valid page count.
+    @note In extent mode this may split an extent; callers check __map_reserve first.
+ */
+void __ftl_drop_mapping(uint32_t logical_page) {
+    NAND_MapEntry entry = __map_get(logical_page);
+
+    if (entry != NAND_MAP_UNMAPPED && MAP_PHYS(entry) != NAND_PAGE_PENDING) {
+        valid_count[MAP_PHYS(entry) / NUM_PAGES_PER_BLOCK]--;
+    }
+    __map_set(logical_page, NAND_MAP_UNMAPPED);
+}
+
+/**
+    @brief Counts a write of logical_page and picks its stream by how often it was written.
+    @note Every NAND_STREAM_DECAY_WRITES counted writes all counters are halved, so only
+          recent writes count. A page written twice within about that many writes is hot.
+
+    @return NAND_STREAM_HOT or NAND_STREAM_COLD
+ */
+uint8_t __ftl_classify(uint32_t logical_page) {
+    uint8_t shift = (logical_page % 4) * 2;
+    uint8_t count = (heat[logical_page / 4] >> shift) & 0x03;
+
+    if (++heat_writes >= NAND_STREAM_DECAY_WRITES) {
+        for (uint16_t i = 0; i < sizeof(heat); i++) {
+            heat[i] = (heat[i] >> 1) & 0x55;
+        }
+        heat_writes = 0;
+    }
+
+    if (count < 3) {
+        count++;
+        heat[logical_page / 4] = (heat[logical_page / 4] & ~(0x03 << shift)) | (count << shift);
+    }
+
+    return (count >= 2) ? NAND_STREAM_HOT : NAND_STREAM_COLD;
+}
+
+/**
+    @brief Makes sure the open block of stream has a free page for the next
+           __ftl_program_page call.
+    @note Opens a new block when needed, which normally only takes a block pre-erased by
+          NAND_Idle. If the free pool runs low anyway, space is reclaimed and erased here.
+          The last FTL_RECLAIM_RESERVE_BLOCKS free blocks are left to the reclaim stream.
+          Space reclamation uses page_buffer, so callers must fill it only after this returns.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed: also if the summary of the filled block failed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_reserve_page(SPI_HandleTypeDef *hspi, uint8_t stream) {
+    NAND_ReturnType status = Ret_Success;
+
+    if (open_block[stream] < NAND_FTL_NUM_BLOCKS && open_page[stream] < NAND_FTL_PAGES_PER_BLOCK) {
+        return Ret_Success;
+    }
+
+    if (open_block[stream] < NAND_FTL_NUM_BLOCKS) {
+#if NAND_BLOCK_SUMMARY
+        /* without its summary, the block is only scanned page by page at mount; it is
+         * full either way */
+        status = __ftl_write_summary(hspi, stream);
+#endif
+        block_state[open_block[stream]] = BLOCK_FULL;
+        open_block[stream] = NAND_FTL_NUM_BLOCKS;
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    /* reclaim before opening so that the reserve pool is kept for reclamation itself */
+    while (!reclaiming && free_blocks <= NAND_FTL_GC_THRESHOLD) {
+        if (dirty_blocks > 0) {
+            /* NAND_Idle did not keep up, so this write has to wait for an erase */
+            status = __ftl_erase_dirty_block(hspi);
+            /* the dirty blocks all hold records with no page left to move them to, so
+             * reclaim another block into the open reclamation block instead */
+            if (status == Ret_MemoryOverflow) {
+                status = __ftl_reclaim_block(hspi, free_blocks > 0);
+            }
+        } else {
+            status = __ftl_reclaim_block(hspi, free_blocks > 0);
+        }
+        if (status != Ret_Success) {
+            return status;
+        }
+        /* reclamation may have left a partly filled open block behind */
+        if (dirty_blocks == 0 && open_block[stream] < NAND_FTL_NUM_BLOCKS && open_page[stream] < NAND_FTL_PAGES_PER_BLOCK) {
+            return Ret_Success;
+        }
+    }
+
+    if (free_blocks <= ((stream == STREAM_RECLAIM) ? 0 : FTL_RECLAIM_RESERVE_BLOCKS)) {
+        return Ret_MemoryOverflow;
+    }
+
+    for (uint16_t i = 0; i < NAND_FTL_NUM_BLOCKS; i++) {
+        uint16_t block = (alloc_cursor + i) % NAND_FTL_NUM_BLOCKS;
+        if (block_state[block] == BLOCK_FREE) {
+            block_state[block] = BLOCK_OPEN;
+            open_block[stream] = block;
+            open_page[stream]  = 0;
+#if NAND_BLOCK_SUMMARY
+            memset(summary[stream], 0, sizeof(summary[stream]));
+#endif
+            alloc_cursor = (block + 1) % NAND_FTL_NUM_BLOCKS;
+            free_blocks--;
+            if (free_blocks < NAND_FTL_POOL_LOW_WATERMARK) {
+                replenishing = 1;
+            }
+            return Ret_Success;
+        }
+    }
+
+    return Ret_MemoryOverflow;
+}
+
+/**
+    @brief Programs a page gathered from num_data data segments, followed by the given tag,
+           at the reserved location.
+    @note The segments must add up to PAGE_DATA_SIZE bytes. They are sent with the tag in a
+          single transfer, so no copy of the page is made. __ftl_reserve_page must have been
+          called first.
+
+    @return NAND_ReturnType
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_program_tagged(SPI_HandleTypeDef *hspi, uint8_t stream, uint8_t type, uint32_t logical_page, SPI_Params *data, uint8_t num_data, NAND_PhysPage *phys) {
+    PhysicalAddrs addr_i;
+    PageTag tag = {0};
+    SPI_Params segments[FTL_MAX_DATA_SEGMENTS + 1];
+    uint8_t spare[SPARE_USER_OFFSET + sizeof(PageTag)];
+
+    if (num_data > FTL_MAX_DATA_SEGMENTS || __segments_length(data, num_data) != PAGE_DATA_SIZE) {
+        return Ret_ProgramFailed;
+    }
+
+    uint16_t block = open_block[stream];
+    *phys = block * NUM_PAGES_PER_BLOCK + open_page[stream];
+
+    tag.type         = type;
+    tag.logical_page = logical_page;
+    tag.sequence     = next_sequence++;
+    if (type == PAGE_TAG_TXN) {
+        tag.txn = txn_id;
+    }
+#if NAND_PAGE_CRC
+    if (keep_crc) {
+        tag.crc  = kept_crc;
+        keep_crc = 0;
+    } else {
+        for (uint8_t i = 0; i < num_data; i++) {
+            tag.crc = NAND_CRC32C(tag.crc, data[i].buffer, data[i].length);
+        }
+    }
+#endif
+
+    /* the bad-block mark and the rest of the spare area are left erased */
+    memset(spare, 0xFF, SPARE_USER_OFFSET);
+    memcpy(&spare[SPARE_USER_OFFSET], &tag, sizeof(PageTag));
+
+    memcpy(segments, data, num_data * sizeof(SPI_Params));
+    segments[num_data].buffer = spare;
+    segments[num_data].length = sizeof(spare);
+
+    __map_physical_page(*phys, 0, &addr_i);
+    open_page[stream]++;
+
+    if (NAND_Page_Program_Segments(hspi, &addr_i, segments, num_data + 1) != Ret_Success) {
+        return Ret_ProgramFailed;
+    }
+
+    if (type == PAGE_TAG_TRIM) {
+        trim_records[block]++;
+    }
+    written_count[block] += (type == PAGE_TAG_PACKED) ? logical_page : 1;
+    block_sequence[block] = tag.sequence;
+    counters.pages_programmed++;
+
+#if NAND_BLOCK_SUMMARY
+    NAND_SummaryEntry *entry = &summary[stream][*phys % NUM_PAGES_PER_BLOCK];
+    entry -> type         = type;
+    entry -> logical_page = logical_page;
+    entry -> sequence     = tag.sequence;
+    entry -> txn          = tag.txn;
+#endif
+
+    return Ret_Success;
+}
+
+#if NAND_BLOCK_SUMMARY
+/**
+    @brief Programs the summary of the open block of stream into its last page, once all
+           the other pages have been programmed.
+    @note The entries go at the end of the data area, right before the tag, and are sent
+          straight from summary[stream]: page_buffer is left alone, so this is safe at any
+          point of space reclamation.
+
+    @return NAND_ReturnType
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_summary(SPI_HandleTypeDef *hspi, uint8_t stream) {
+    PhysicalAddrs addr_i;
+    PageTag tag = {0};
+    uint8_t bad_block_mark[SPARE_USER_OFFSET];
+    SPI_Params segments[3] = {
+        { .buffer = (uint8_t *) summary[stream],    .length = sizeof(summary[stream]) },
+        { .buffer = bad_block_mark,                 .length = SPARE_USER_OFFSET },
+        { .buffer = (uint8_t *) &tag,               .length = sizeof(PageTag) },
+    };
+    uint16_t block = open_block[stream];
+
+    if (open_page[stream] != NAND_SUMMARY_ENTRIES) {
+        return Ret_ProgramFailed;
+    }
+
+    tag.type         = PAGE_TAG_SUMMARY;
+    tag.logical_page = NAND_SUMMARY_ENTRIES;
+    tag.sequence     = next_sequence++;
+    memset(bad_block_mark, 0xFF, sizeof(bad_block_mark));
+
+    __map_physical_page(block * NUM_PAGES_PER_BLOCK + NAND_SUMMARY_ENTRIES, PAGE_DATA_SIZE - sizeof(summary[stream]), &addr_i);
+    open_page[stream]++;
+
+    if (NAND_Page_Program_Segments(hspi, &addr_i, segments, 3) != Ret_Success) {
+        return Ret_ProgramFailed;
+    }
+
+    written_count[block]++;
+    block_sequence[block] = tag.sequence;
+    counters.pages_programmed++;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Reads the summary page of block into summary[0] and its tag into tag.
+    @note Only valid if tag comes back as PAGE_TAG_SUMMARY with NAND_SUMMARY_ENTRIES entries.
+          For NAND_Init, before any block is open.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_read_summary(SPI_HandleTypeDef *hspi, uint16_t block, PageTag *tag) {
+    PhysicalAddrs addr_i;
+    uint8_t bad_block_mark[SPARE_USER_OFFSET];
+    SPI_Params segments[3] = {
+        { .buffer = (uint8_t *) summary[0],         .length = sizeof(summary[0]) },
+        { .buffer = bad_block_mark,                 .length = SPARE_USER_OFFSET },
+        { .buffer = (uint8_t *) tag,                .length = sizeof(PageTag) },
+    };
+
+    __map_physical_page(block * NUM_PAGES_PER_BLOCK + NAND_SUMMARY_ENTRIES, PAGE_DATA_SIZE - sizeof(summary[0]), &addr_i);
+    return NAND_Page_Read_Segments(hspi, &addr_i, segments, 3);
+}
+#endif
+
+/**
+    @brief Programs the data segments as the new copy of logical_page and updates the mapping.
+    @note See __ftl_program_tagged. With NAND_MAP_DEMAND, then writes back translation pages
+          if too many segments are dirty, which uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_program_page(SPI_HandleTypeDef *hspi, uint8_t stream, uint32_t logical_page, SPI_Params *data, uint8_t num_data) {
+    NAND_PhysPage phys;
+
+    /* check before programming, so a page never reaches flash without being mapped */
+    if (__map_reserve() != Ret_Success) {
+        return Ret_MemoryOverflow;
+    }
+
+    if (__ftl_program_tagged(hspi, stream, PAGE_TAG_DATA, logical_page, data, num_data, &phys) != Ret_Success) {
+        return Ret_ProgramFailed;
+    }
+
+    /* invalidate the previous copy */
+    __ftl_drop_mapping(logical_page);
+    __map_set(logical_page, MAP_ENTRY(phys, 0));
+    valid_count[phys / NUM_PAGES_PER_BLOCK]++;
+
+#if NAND_MAP_DEMAND
+    /* the page is written either way; a failed write-back is tried again after the next.
+     * Reclamation copies would otherwise write a translation page every few pages and
+     * gain nothing, so it keeps two clean slots only and writes back when done. */
+    __ftl_flush_map(hspi, reclaiming ? NAND_MAP_CACHE_SEGMENTS - 2 : NAND_MAP_DIRTY_SEGMENTS);
+#endif
+
+    return Ret_Success;
+}
+
+#if NAND_PARTIAL_PROGRAM
+/**
+    @brief Writes part of a logical page into its current copy with a partial program, if the
+           ECC sectors the data falls in are still erased there.
+    @note page_buffer must hold the current contents of the page from FTL_APPEND_START on.
+          Sectors reading all 0xFF
+          count as erased; the programs the page has had are bounded by one for the tagged
+          program plus one per sector after FTL_TAG_SECTORS that is not, which is never below
+          the true count, so the NOP limit holds. The tag and sequence number stay as they
+          are, so mount finds the page as before.
+
+    @return NAND_ReturnType
+    @retval Ret_Success: *appended tells whether the data was written
+    @retval Ret_ProgramFailed
+ */
+NAND_ReturnType __ftl_append(SPI_HandleTypeDef *hspi, uint32_t logical_page, uint16_t offset, uint8_t *buffer, uint16_t length, uint8_t *appended) {
+    PhysicalAddrs addr_i;
+    NAND_MapEntry entry = __map_get(logical_page);
+    uint16_t first = offset / NAND_ECC_SECTOR_SIZE;
+    uint16_t last  = (offset + length - 1) / NAND_ECC_SECTOR_SIZE;
+    uint8_t programs = 1;
+
+    *appended = 0;
+    if (first < FTL_TAG_SECTORS || entry == NAND_MAP_UNMAPPED) {
+        return Ret_Success;
+    }
+
+    for (uint16_t sector = FTL_TAG_SECTORS; sector < NAND_ECC_SECTORS; sector++) {
+        if (__ftl_all_erased(&page_buffer[sector * NAND_ECC_SECTOR_SIZE], NAND_ECC_SECTOR_SIZE)) {
+            continue;
+        }
+        if (sector >= first && sector <= last) {
+            return Ret_Success;     // already programmed
+        }
+        programs++;
+    }
+    if (programs >= NUM_PROGRAMS_PER_PAGE) {
+        return Ret_Success;
+    }
+
+    /* 0xFF over erased sectors is what they already hold; programming it would use up a
+     * program without making the sectors look any different */
+    if (!__ftl_all_erased(buffer, length)) {
+        __map_physical_page(MAP_PHYS(entry), offset, &addr_i);
+        if (NAND_Page_Append(hspi, &addr_i, buffer, length, &programs) != Ret_Success) {
+            return Ret_ProgramFailed;
+        }
+    }
+
+    *appended = 1;
+    return Ret_Success;
+}
+
+/* returns 1 if every byte is 0xFF */
+uint8_t __ftl_all_erased(uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+#endif
+
+/**
+    @brief Frees one block: picks a full block by cost-benefit, copies its valid pages to
+           the reclaim stream and moves it to the dirty pool.
+    @note The victim maximises stale * age / (written + valid): space gained, weighted by
+          how long the block has stayed unchanged, over the cost of reading it and copying
+          its valid pages. Unlike picking the most stale block, this also gets around to
+          cold blocks whose few stale pages would otherwise never be reclaimed. A block whose
+          pages were all overwritten or trimmed needs no copies and is taken first. Unless
+          may_open is set, only blocks that fit into the open reclamation block, or that
+          need nothing written at all, are taken, so that no free block is used up. In
+          extent mode, only blocks whose copies fit in the free extents are taken. The
+          erase is left to __ftl_erase_dirty_block. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_reclaim_block(SPI_HandleTypeDef *hspi, uint8_t may_open) {
+    PageTag tag;
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_ReturnType status = Ret_Success;
+    uint16_t victim = NAND_FTL_NUM_BLOCKS;
+    uint64_t best_score = 0;
+    uint16_t room = 0;
+
+    if (open_block[STREAM_RECLAIM] < NAND_FTL_NUM_BLOCKS) {
+        room = NAND_FTL_PAGES_PER_BLOCK - open_page[STREAM_RECLAIM];
+    }
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] != BLOCK_FULL || valid_count[block] == written_count[block]) {
+            continue;
+        }
+        /* a block left with obsolete records only needs no pages at all */
+        if (!may_open && (valid_count[block] > 0 || trim_records[block] > 0) &&
+            valid_count[block] + (trim_records[block] > 0 ? TRIM_CHECKPOINT_MAX_PAGES : 0) +
+            FTL_RECLAIM_RECORD_PAGES > room) {
+            continue;
+        }
+#if NAND_MAP_EXTENTS
+        /* each copy may split an extent, and a reclamation cut short frees nothing */
+        if (2 * valid_count[block] > NAND_EXTENT_MAX - extent_count) {
+            continue;
+        }
+#endif
+        if (valid_count[block] == 0) {
+            victim = block;
+            break;
+        }
+        uint64_t score = (uint64_t) (written_count[block] - valid_count[block]) *
+                         (next_sequence - block_sequence[block]) /
+                         (written_count[block] + valid_count[block]);
+        if (victim == NAND_FTL_NUM_BLOCKS || score > best_score) {
+            victim     = block;
+            best_score = score;
+        }
+    }
+    if (victim == NAND_FTL_NUM_BLOCKS) {
+        return Ret_MemoryOverflow;
+    }
+
+    reclaiming = 1;
+#if NAND_MAP_DEMAND
+    map_read_failed = 0;
+#endif
+
+    /* copy out the pages that are still referenced */
+    for (uint8_t page = 0; page < NUM_PAGES_PER_BLOCK && valid_count[victim] > 0; page++) {
+        NAND_PhysPage phys = victim * NUM_PAGES_PER_BLOCK + page;
+
+        if (__ftl_read_tag(hspi, phys, &tag) != Ret_Success) {
+            status = Ret_ReadFailed;
+            break;
+        }
+#if NAND_COMPRESSION
+        if (tag.type == PAGE_TAG_PACKED && tag.logical_page <= NAND_PACK_MAX_CHUNKS) {
+            status = __ftl_reclaim_packed(hspi, phys, tag.logical_page);
+            if (status != Ret_Success) {
+                break;
+            }
+            continue;
+        }
+#endif
+#if NAND_MAP_DEMAND
+        /* a current translation page moves by being written again, with its dirty segments */
+        if (tag.type == PAGE_TAG_MAP) {
+            if (tag.logical_page < NAND_MAP_PAGES && map_pages[tag.logical_page] == phys) {
+                status = __ftl_write_map_page(hspi, tag.logical_page, STREAM_RECLAIM);
+                if (status != Ret_Success) {
+                    break;
+                }
+            }
+            continue;
+        }
+#endif
+        /* pages of the open transaction are not mapped yet, but still needed */
+        if (tag.type == PAGE_TAG_TXN && txn_open && tag.txn == txn_id) {
+            status = __ftl_reclaim_txn_page(hspi, phys, tag.logical_page);
+            if (status != Ret_Success) {
+                break;
+            }
+            continue;
+        }
+        if ((tag.type != PAGE_TAG_DATA && tag.type != PAGE_TAG_TXN) || tag.logical_page >= NAND_NUM_LOGICAL_PAGES ||
+            __map_get(tag.logical_page) != MAP_ENTRY(phys, 0)) {
+            continue;
+        }
+
+#if NAND_COMPRESSION
+        /* page_buffer is about to be reused */
+        status = __ftl_flush_reclaim_pack(hspi);
+        if (status != Ret_Success) {
+            break;
+        }
+#endif
+        status = __ftl_reserve_page(hspi, STREAM_RECLAIM);
+        if (status != Ret_Success) {
+            break;
+        }
+#if NAND_PAGE_CRC
+        /* a corrupt page is moved as it is, and its CRC with it */
+        status = __ftl_read_checked(hspi, phys, page_buffer);
+        keep_crc = (status == Ret_CorruptData);
+        if (status != Ret_Success && !keep_crc) {
+            break;
+        }
+#else
+        PhysicalAddrs addr_i;
+        __map_physical_page(phys, 0, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, page_buffer, PAGE_DATA_SIZE) != Ret_Success) {
+            status = Ret_ReadFailed;
+            break;
+        }
+#endif
+        status = __ftl_program_page(hspi, STREAM_RECLAIM, tag.logical_page, &data, 1);
+#if NAND_PAGE_CRC
+        keep_crc = 0;       // in case the copy failed before it was programmed
+#endif
+        if (status != Ret_Success) {
+            break;
+        }
+
+        /* mount lets the newer copy win, so the transaction's copy must stay newer than
+         * the committed one it replaces */
+        uint8_t i = __ftl_txn_find(tag.logical_page);
+        if (txn_open && i < txn_count) {
+            status = __ftl_reclaim_txn_page(hspi, txn_pages[i].phys, tag.logical_page);
+            if (status != Ret_Success) {
+                break;
+            }
+        }
+    }
+#if NAND_MAP_DEMAND
+    /* a page may have been skipped for a lookup that failed */
+    if (status == Ret_Success && map_read_failed) {
+        status = Ret_ReadFailed;
+    }
+#endif
+
+#if NAND_COMPRESSION
+    if (status == Ret_Success) {
+        status = __ftl_flush_reclaim_pack(hspi);
+    }
+    /* pending chunks count as mapped in a checkpoint, so they must reach flash first */
+    if (status == Ret_Success && trim_records[victim] > 0) {
+        status = __ftl_flush_pack(hspi);
+    }
+#endif
+
+#if NAND_MAP_DEMAND
+    if (status == Ret_Success) {
+        status = __ftl_flush_map(hspi, NAND_MAP_DIRTY_SEGMENTS);
+    }
+#endif
+
+    /* the victim's trim records go away with it, so restate them elsewhere first */
+    if (status == Ret_Success && trim_records[victim] > 0) {
+        status = __ftl_checkpoint_trims(hspi);
+    }
+
+    reclaiming = 0;
+
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    block_state[victim] = BLOCK_DIRTY;
+    dirty_blocks++;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Erases one block of the dirty pool and adds it to the free pool.
+    @note A block listed by the newest free list on flash (from before it was last used),
+          or holding that list, is only erased after a new free list is written; otherwise
+          power loss during the erase could leave a half erased block listed as erased.
+          Likewise the statistics and the newest commit record are written again, into the
+          open reclamation block, before erasing the block holding them; if that fails, the
+          block is left dirty and the error returned. Blocks that need none of this are
+          erased first.
+          A block that fails to erase is retired as bad; Ret_ProgramFailed if it could not
+          be marked bad on flash.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_erase_dirty_block(SPI_HandleTypeDef *hspi) {
+    PhysicalAddrs addr_i;
+    NAND_ReturnType status;
+    uint16_t victim = NAND_FTL_NUM_BLOCKS;
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_DIRTY) {
+            victim = block;
+            if (!listed_free[block] && block != free_list_block && block != stats_block && block != commit_block) {
+                break;
+            }
+        }
+    }
+    if (victim == NAND_FTL_NUM_BLOCKS) {
+        return Ret_MemoryOverflow;
+    }
+
+    if (listed_free[victim] || victim == free_list_block) {
+        reclaiming = 1;
+        status = __ftl_write_free_list(hspi);
+        reclaiming = 0;
+        /* the newest records are only erased once rewritten elsewhere: a lost commit record
+           rolls the transaction back at the next mount */
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+    if (victim == stats_block) {
+        reclaiming = 1;
+        status = __ftl_write_stats(hspi);
+        reclaiming = 0;
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+    if (victim == commit_block) {
+        reclaiming = 1;
+        status = __ftl_write_commit(hspi, committed_txn);
+        reclaiming = 0;
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    dirty_blocks--;
+    counters.erase_count[victim]++;
+    counters.blocks_erased++;
+
+    __map_physical_page(victim * NUM_PAGES_PER_BLOCK, 0, &addr_i);
+    if (NAND_Block_Erase(hspi, &addr_i) != Ret_Success) {
+        /* nothing valid is left in the block, so retiring it loses no data */
+        return __ftl_retire_block(hspi, victim);
+    }
+
+    block_state[victim]   = BLOCK_FREE;
+    written_count[victim] = 0;
+    free_blocks++;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Persists which blocks are erased as a free list record.
+    @note Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_free_list(SPI_HandleTypeDef *hspi) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+    uint8_t stream = reclaiming ? STREAM_RECLAIM : NAND_STREAM_HOT;
+
+    /* may open a free block, so the list is only built afterwards */
+    status = __ftl_reserve_page(hspi, stream);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+    memset(page_buffer, 0, FREE_LIST_SIZE);
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_FREE) {
+            page_buffer[block / 8] |= 1 << (block % 8);
+        }
+    }
+
+    status = __ftl_program_tagged(hspi, stream, PAGE_TAG_FREE, NAND_FTL_NUM_BLOCKS, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        listed_free[block] = (block_state[block] == BLOCK_FREE);
+    }
+    free_list_block = phys / NUM_PAGES_PER_BLOCK;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Tells whether some erased blocks are missing from the newest free list on flash.
+
+    @return 1 if a new free list would list more blocks, 0 otherwise.
+ */
+uint8_t __ftl_free_list_stale(void) {
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_FREE && !listed_free[block]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+    @brief Finds logical_page among the pages written by the transaction.
+
+    @return Its index in txn_pages, or txn_count if it is not there.
+ */
+uint8_t __ftl_txn_find(uint32_t logical_page) {
+    for (uint8_t i = 0; i < txn_count; i++) {
+        if (txn_pages[i].logical_page == logical_page) {
+            return i;
+        }
+    }
+    return txn_count;
+}
+
+/**
+    @brief Copies a page of the open transaction out of a block being reclaimed, or past
+           a committed copy of the same logical page that reclamation just wrote.
+    @note The copy is tagged with the same transaction, so it is committed or rolled back
+          together with the rest. Copies that the transaction has since overwritten are
+          left behind. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_reclaim_txn_page(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint32_t logical_page) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PhysPage copy;
+    NAND_ReturnType status;
+    uint8_t i = __ftl_txn_find(logical_page);
+
+    if (i == txn_count || txn_pages[i].phys != phys) {
+        return Ret_Success;
+    }
+
+#if NAND_COMPRESSION
+    /* page_buffer is about to be reused */
+    status = __ftl_flush_reclaim_pack(hspi);
+    if (status != Ret_Success) {
+        return status;
+    }
+#endif
+    status = __ftl_reserve_page(hspi, STREAM_RECLAIM);
+    if (status != Ret_Success) {
+        return status;
+    }
+#if NAND_PAGE_CRC
+    /* a corrupt page is moved as it is, and its CRC with it */
+    status = __ftl_read_checked(hspi, phys, page_buffer);
+    keep_crc = (status == Ret_CorruptData);
+    if (status != Ret_Success && !keep_crc) {
+        return status;
+    }
+#else
+    PhysicalAddrs addr_i;
+    __map_physical_page(phys, 0, &addr_i);
+    if (NAND_Page_Read(hspi, &addr_i, page_buffer, PAGE_DATA_SIZE) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+#endif
+    status = __ftl_program_tagged(hspi, STREAM_RECLAIM, PAGE_TAG_TXN, logical_page, &data, 1, &copy);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    valid_count[phys / NUM_PAGES_PER_BLOCK]--;
+    valid_count[copy / NUM_PAGES_PER_BLOCK]++;
+    txn_pages[i].phys = copy;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Rolls back the pages listed in txn_pages on flash, for a transaction that was
+           aborted or interrupted by power loss.
+    @note Their logical pages are no longer mapped to them, but the pages would still win
+          at mount once a later transaction is committed. So each committed copy is
+          programmed again, or a trim record written for pages without one, which makes it
+          newer than the transaction's page. A commit record then stops later mounts from
+          rolling the transaction back again. Pages done are dropped from txn_pages, so a
+          failed rollback can be resumed. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_txn_rollback(SPI_HandleTypeDef *hspi) {
+    SPI_Params data = { .buffer = NULL, .length = PAGE_DATA_SIZE };
+    NAND_ReturnType status;
+
+#if NAND_COMPRESSION
+    /* pending chunks are not on flash, so they supersede nothing yet */
+    status = __ftl_flush_pack(hspi);
+    if (status != Ret_Success) {
+        return status;
+    }
+#endif
+
+    /* compressed reads stage in page_buffer, so copies are read into a leased buffer */
+    data.buffer = __pool_acquire();
+    if (data.buffer == NULL) {
+        return Ret_MemoryOverflow;
+    }
+
+    while (txn_count > 0) {
+        uint32_t logical_page = txn_pages[txn_count - 1].logical_page;
+        NAND_Addr page_start  = logical_page * PAGE_DATA_SIZE;
+
+        if (__map_get(logical_page) == NAND_MAP_UNMAPPED) {
+            status = __ftl_write_trim_record(hspi, logical_page, 1);
+        } else {
+            status = __ftl_reserve_page(hspi, STREAM_RECLAIM);
+            if (status == Ret_Success) {
+                status = __ftl_read(hspi, &page_start, data.buffer, PAGE_DATA_SIZE);
+            }
+            if (status == Ret_Success) {
+                status = __ftl_program_page(hspi, STREAM_RECLAIM, logical_page, &data, 1);
+            }
+        }
+        if (status != Ret_Success) {
+            __pool_release(data.buffer);
+            return status;
+        }
+        txn_count--;
+    }
+    __pool_release(data.buffer);
+
+    return __ftl_write_commit(hspi, txn_id);
+}
+
+/**
+    @brief Programs the commit record of transaction txn.
+    @note Also used to restate the newest commit record before its block is erased.
+          Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_commit(SPI_HandleTypeDef *hspi, uint32_t txn) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+    uint8_t stream = reclaiming ? STREAM_RECLAIM : NAND_STREAM_HOT;
+
+    status = __ftl_reserve_page(hspi, stream);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+
+    status = __ftl_program_tagged(hspi, stream, PAGE_TAG_COMMIT, txn, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    committed_txn = txn;
+    commit_block  = phys / NUM_PAGES_PER_BLOCK;
+
+    return Ret_Success;
+}
+
+
+/******************************************************************************
+ *                              Statistics
+ *****************************************************************************/
+
+/**
+    @brief Reports lifetime write, erase, bad block and ECC statistics.
+    @note Only reads RAM. The erase count percentiles take a pass over all blocks each,
+          so this is meant to be called now and then, not on every write.
+ */
+void NAND_Get_Stats(NAND_Stats *stats) {
+    NAND_OS_Lock();
+    __ftl_get_stats(stats);
+    NAND_OS_Unlock();
+}
+
+/* NAND_Get_Stats without the device lock */
+void __ftl_get_stats(NAND_Stats *stats) {
+    uint32_t ecc_now[NUM_ECC_RESULTS];
+    uint64_t erase_sum = 0;
+    uint16_t good_blocks = 0;
+
+    memset(stats, 0, sizeof(NAND_Stats));
+
+    stats -> host_bytes_written = counters.host_bytes_written;
+    stats -> pages_programmed   = counters.pages_programmed;
+    stats -> blocks_erased      = counters.blocks_erased;
+    if (counters.host_bytes_written > 0) {
+        stats -> write_amplification = (uint32_t) (counters.pages_programmed * PAGE_DATA_SIZE * 1000 /
+                                                   counters.host_bytes_written);
+    }
+
+    NAND_Get_ECC_Counts(ecc_now);
+    for (uint8_t i = 0; i < NUM_ECC_RESULTS; i++) {
+        stats -> ecc_results[i] = counters.ecc_results[i] + (ecc_now[i] - ecc_at_load[i]);
+    }
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] == BLOCK_BAD) {
+            stats -> bad_blocks++;
+            continue;
+        }
+        erase_sum += counters.erase_count[block];
+        good_blocks++;
+    }
+    if (stats -> bad_blocks > counters.factory_bad_blocks) {
+        stats -> grown_bad_blocks = stats -> bad_blocks - counters.factory_bad_blocks;
+    }
+    if (good_blocks == 0) {
+        return;
+    }
+
+    stats -> erase_min = __stats_erase_rank(0);
+    stats -> erase_max = __stats_erase_rank(good_blocks - 1);
+    stats -> erase_avg = (uint32_t) (erase_sum / good_blocks);
+    stats -> erase_p50 = __stats_erase_rank((good_blocks - 1) * 50 / 100);
+    stats -> erase_p90 = __stats_erase_rank((good_blocks - 1) * 90 / 100);
+    stats -> erase_p99 = __stats_erase_rank((good_blocks - 1) * 99 / 100);
+
+    stats -> erase_bucket_width = (stats -> erase_max - stats -> erase_min) / NAND_STATS_BUCKETS + 1;
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (block_state[block] != BLOCK_BAD) {
+            stats -> erase_histogram[(counters.erase_count[block] - stats -> erase_min) / stats -> erase_bucket_width]++;
+        }
+    }
+}
+
+/**
+    @brief Finds the erase count that rank blocks (of those not bad) are below or equal to.
+    @note Counts, for each candidate, the blocks below it; needs no sorted copy.
+
+    @return Erase count of the block at position rank in ascending order.
+ */
+uint32_t __stats_erase_rank(uint16_t rank) {
+    for (uint16_t candidate = 0; candidate < NAND_FTL_NUM_BLOCKS; candidate++) {
+        uint32_t value = counters.erase_count[candidate];
+        uint16_t below = 0, equal = 0;
+
+        if (block_state[candidate] == BLOCK_BAD) {
+            continue;
+        }
+        for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+            if (block_state[block] == BLOCK_BAD) {
+                continue;
+            }
+            if (counters.erase_count[block] < value) {
+                below++;
+            } else if (counters.erase_count[block] == value) {
+                equal++;
+            }
+        }
+        if (rank >= below && rank < below + equal) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+/**
+    @brief Saves the statistics as a statistics record.
+    @note The record is newer than every older one, so it supersedes them. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_stats(SPI_HandleTypeDef *hspi) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    uint32_t ecc_now[NUM_ECC_RESULTS];
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+    uint8_t stream = reclaiming ? STREAM_RECLAIM : NAND_STREAM_HOT;
+
+    status = __ftl_reserve_page(hspi, stream);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    NAND_Get_ECC_Counts(ecc_now);
+    for (uint8_t i = 0; i < NUM_ECC_RESULTS; i++) {
+        counters.ecc_results[i] += ecc_now[i] - ecc_at_load[i];
+        ecc_at_load[i] = ecc_now[i];
+    }
+    memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+    memcpy(page_buffer, &counters, sizeof(counters));
+
+    status = __ftl_program_tagged(hspi, stream, PAGE_TAG_STATS, NAND_FTL_NUM_BLOCKS, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    stats_block     = phys / NUM_PAGES_PER_BLOCK;
+    stats_saved_at  = counters.pages_programmed;
+    erases_saved_at = counters.blocks_erased;
+    host_saved_at   = counters.host_bytes_written;
+
+    return Ret_Success;
+}
+
+/* 1 if pages were written or blocks erased since the statistics were last saved */
+uint8_t __ftl_stats_changed(void) {
+    return counters.pages_programmed != stats_saved_at || counters.blocks_erased != erases_saved_at ||
+           counters.host_bytes_written != host_saved_at;
+}
+
+/**
+    @brief Marks a block as bad in RAM and on flash so that it is skipped from now on.
+    @note Programs BAD_BLOCK_VALUE into the first spare byte of the block's first page,
+          the same location the factory uses. The block stays retired in RAM even if that
+          program fails.
+
+    @return NAND_ReturnType
+    @retval Ret_ProgramFailed: the mark did not reach flash
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_retire_block(SPI_HandleTypeDef *hspi, uint16_t block) {
+    PhysicalAddrs addr_i;
+    uint8_t mark = BAD_BLOCK_VALUE;
+
+    block_state[block] = BLOCK_BAD;
+
+    __map_physical_page(block * NUM_PAGES_PER_BLOCK, BAD_BLOCK_BYTE, &addr_i);
+    return NAND_Page_Program(hspi, &addr_i, &mark, 1);
+}
+
+/**
+    @brief Persists the trim of num_pages logical pages starting at first_page.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_trim_record(SPI_HandleTypeDef *hspi, uint32_t first_page, uint32_t num_pages) {
+    NAND_TrimRange range = { .first_page = first_page, .num_pages = num_pages };
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+
+    status = __ftl_reserve_page(hspi, NAND_STREAM_HOT);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+    memcpy(page_buffer, &range, sizeof(range));
+
+    return __ftl_program_tagged(hspi, NAND_STREAM_HOT, PAGE_TAG_TRIM, 1, &data, 1, &phys);
+}
+
+/**
+    @brief Writes every currently unmapped logical range as new trim records.
+    @note The new records are newer than every page on flash, so they make all older trim
+          records redundant; those no longer hold their blocks back from being erased.
+          Only called by space reclamation, so the records go to the block it is filling
+          instead of taking another block from the reserve pool. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_checkpoint_trims(SPI_HandleTypeDef *hspi) {
+    NAND_TrimRange range;
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_ReturnType status = Ret_Success;
+    uint8_t num_written = 0;
+    uint32_t logical_page = 0;
+    uint16_t arena_mark = __pool_mark();
+    NAND_PhysPage *written = __pool_alloc(TRIM_CHECKPOINT_MAX_PAGES * sizeof(NAND_PhysPage));
+
+    if (written == NULL) {
+        return Ret_MemoryOverflow;
+    }
+
+#if NAND_MAP_DEMAND
+    map_read_failed = 0;
+#endif
+    while (logical_page < NAND_NUM_LOGICAL_PAGES) {
+        uint32_t count = 0;
+
+        status = __ftl_reserve_page(hspi, STREAM_RECLAIM);
+        if (status != Ret_Success) {
+            break;
+        }
+
+        memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+        while (logical_page < NAND_NUM_LOGICAL_PAGES && count < NAND_TRIM_RANGES_PER_PAGE) {
+            if (!__ftl_checkpoint_unmapped(logical_page)) {
+                logical_page++;
+                continue;
+            }
+            range.first_page = logical_page;
+            while (logical_page < NAND_NUM_LOGICAL_PAGES && __ftl_checkpoint_unmapped(logical_page)) {
+                logical_page++;
+            }
+            range.num_pages = logical_page - range.first_page;
+            memcpy(&page_buffer[count * sizeof(NAND_TrimRange)], &range, sizeof(range));
+            count++;
+        }
+
+        /* with no unmapped pages left there is nothing to restate */
+        if (count == 0) {
+            break;
+        }
+#if NAND_MAP_DEMAND
+        /* a page whose lookup failed would be restated as trimmed */
+        if (map_read_failed) {
+            status = Ret_ReadFailed;
+            break;
+        }
+#endif
+
+        status = __ftl_program_tagged(hspi, STREAM_RECLAIM, PAGE_TAG_TRIM, count, &data, 1, &written[num_written]);
+        if (status != Ret_Success) {
+            break;
+        }
+        num_written++;
+    }
+
+    if (status == Ret_Success) {
+        memset(trim_records, 0, sizeof(trim_records));
+        for (uint8_t i = 0; i < num_written; i++) {
+            trim_records[written[i] / NUM_PAGES_PER_BLOCK]++;
+        }
+    }
+
+    __pool_reset(arena_mark);
+    return status;
+}
+
+/**
+    @brief Returns 1 if a trim checkpoint may restate logical_page as trimmed.
+    @note Pages of the open transaction are not mapped yet, but its commit record will be
+          newer than the checkpoint, which must not undo them at mount.
+ */
+uint8_t __ftl_checkpoint_unmapped(uint32_t logical_page) {
+    return __map_get(logical_page) == NAND_MAP_UNMAPPED && !(txn_open && __ftl_txn_find(logical_page) < txn_count);
+}
+
+/**
+    @brief Applies the trim records found in a block during mount.
+    @note A mapped page is unmapped only if its copy is older than the trim record.
+          Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_apply_trim_records(SPI_HandleTypeDef *hspi, uint16_t block) {
+    PhysicalAddrs addr_i;
+    PageTag tag, mapped;
+    NAND_TrimRange range;
+
+    for (uint8_t page = 0; page < NUM_PAGES_PER_BLOCK; page++) {
+        NAND_PhysPage phys = block * NUM_PAGES_PER_BLOCK + page;
+
+        if (__ftl_read_tag(hspi, phys, &tag) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        if (tag.type == PAGE_TAG_ERASED) {
+            break;
+        }
+        if (tag.type != PAGE_TAG_TRIM || tag.logical_page > NAND_TRIM_RANGES_PER_PAGE) {
+            continue;
+        }
+
+        __map_physical_page(phys, 0, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, page_buffer, tag.logical_page * sizeof(NAND_TrimRange)) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+
+        for (uint32_t i = 0; i < tag.logical_page; i++) {
+            memcpy(&range, &page_buffer[i * sizeof(NAND_TrimRange)], sizeof(range));
+            if (range.first_page >= NAND_NUM_LOGICAL_PAGES ||
+                range.num_pages > NAND_NUM_LOGICAL_PAGES - range.first_page) {
+                continue;
+            }
+            for (uint32_t logical_page = range.first_page;
+                 logical_page < range.first_page + range.num_pages; logical_page++) {
+                NAND_MapEntry entry = __map_get(logical_page);
+                if (entry == NAND_MAP_UNMAPPED) {
+                    continue;
+                }
+                if (__ftl_read_tag(hspi, MAP_PHYS(entry), &mapped) != Ret_Success) {
+                    return Ret_ReadFailed;
+                }
+#if NAND_MAP_DEMAND
+                if (!__ftl_tag_owns(&mapped, logical_page)) {
+                    mapped.sequence = 0;
+                }
+#endif
+                if (mapped.sequence < tag.sequence && __map_set(logical_page, NAND_MAP_UNMAPPED) != Ret_Success) {
+                    return Ret_MemoryOverflow;
+                }
+            }
+        }
+    }
+
+    return Ret_Success;
+}
+
+
+/******************************************************************************
+ *                          Demand-Paged Mapping
+ *****************************************************************************/
+
+#if NAND_MAP_DEMAND
+/**
+    @brief Programs a new copy of translation page index: its current copy with every
+           cached segment of it merged in. Those segments are clean afterwards.
+    @note Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_map_page(SPI_HandleTypeDef *hspi, uint16_t index, uint8_t stream) {
+    PhysicalAddrs addr_i;
+
+    if (map_pages[index] == NAND_MAP_UNMAPPED) {
+        memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+    } else {
+        __map_physical_page(map_pages[index], 0, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, page_buffer, PAGE_DATA_SIZE) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+    }
+
+    for (uint16_t i = 0; i < NAND_MAP_CACHE_SEGMENTS; i++) {
+        uint16_t segment = map_cache[i].segment;
+        if (segment != MAP_NO_SEGMENT && segment / MAP_SEGMENTS_PER_PAGE == index) {
+            memcpy(&page_buffer[(segment % MAP_SEGMENTS_PER_PAGE) * sizeof(map_cache[i].entries)],
+                   map_cache[i].entries, sizeof(map_cache[i].entries));
+        }
+    }
+
+    return __ftl_program_map_page(hspi, index, stream);
+}
+
+/**
+    @brief Programs page_buffer as the new copy of translation page index, and marks the
+           cached segments of it clean.
+    @note Never reclaims space, which would change the mapping and page_buffer, so it is
+          safe in the middle of space reclamation and of mount. Without room made by the
+          caller the reserve pool is used instead, as for free list records.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_program_map_page(SPI_HandleTypeDef *hspi, uint16_t index, uint8_t stream) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    uint8_t was_reclaiming = reclaiming;
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+
+    reclaiming = 1;
+    status = __ftl_reserve_page(hspi, stream);
+    reclaiming = was_reclaiming;
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    status = __ftl_program_tagged(hspi, stream, PAGE_TAG_MAP, index, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    if (map_pages[index] != NAND_MAP_UNMAPPED) {
+        valid_count[map_pages[index] / NUM_PAGES_PER_BLOCK]--;
+    }
+    valid_count[phys / NUM_PAGES_PER_BLOCK]++;
+    map_pages[index]    = phys;
+    map_sequence[index] = next_sequence - 1;
+
+    for (uint16_t i = 0; i < NAND_MAP_CACHE_SEGMENTS; i++) {
+        if (map_cache[i].dirty && map_cache[i].segment / MAP_SEGMENTS_PER_PAGE == index) {
+            map_cache[i].dirty = 0;
+            map_dirty--;
+        }
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Writes back translation pages until at most keep segments are dirty, starting
+           with the page of the least recently used dirty segment.
+    @note Only call between complete mapping updates: a translation page on flash is
+          trusted to hold every change older than itself. Space is reclaimed first when
+          the free pool is low, like for any other write. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_flush_map(SPI_HandleTypeDef *hspi, uint16_t keep) {
+    /* during reclamation, keep to the block it is filling rather than open another */
+    uint8_t stream = reclaiming ? STREAM_RECLAIM : NAND_STREAM_HOT;
+
+    while (map_dirty > keep) {
+        NAND_MapSegment *oldest = NULL;
+
+        /* reclamation writes back segments of its own, so choose after it */
+        NAND_ReturnType status = __ftl_reserve_page(hspi, stream);
+        if (status != Ret_Success) {
+            return status;
+        }
+        if (map_dirty <= keep) {
+            break;
+        }
+
+        for (uint16_t i = 0; i < NAND_MAP_CACHE_SEGMENTS; i++) {
+            if (map_cache[i].dirty && (oldest == NULL || map_cache[i].used < oldest -> used)) {
+                oldest = &map_cache[i];
+            }
+        }
+
+        status = __ftl_write_map_page(hspi, oldest -> segment / MAP_SEGMENTS_PER_PAGE, stream);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Brings each translation page found at mount up to date with the pages written
+           after it.
+    @note A translation page holds every mapping change older than itself, so only data
+          pages newer than it compete for its entries, as in __ftl_mount_claim; pages of
+          transactions older than newest_txn count as data pages. Blocks whose newest page
+          is older than the translation page are skipped, so normally only the blocks
+          written since the last write-back are read again. The segments that changed go
+          back into the cache as dirty, as they were before power loss, so mount does not
+          take blocks that space reclamation may need; only if there are too many is the
+          translation page programmed again. Pages of the newest transaction and trim
+          records are left to the caller. Uses page_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_mount_replay(SPI_HandleTypeDef *hspi, uint32_t newest_txn) {
+    PhysicalAddrs addr_i;
+    PageTag tag, mapped;
+    NAND_PhysPage current;
+    NAND_ReturnType status;
+    uint16_t index = 0;
+
+    while (index < NAND_MAP_PAGES) {
+        uint32_t first_page = index * NAND_MAP_ENTRIES_PER_PAGE;
+        uint8_t changed[(MAP_SEGMENTS_PER_PAGE + 7) / 8] = {0};
+        uint16_t num_changed = 0;
+
+        if (map_pages[index] == NAND_MAP_UNMAPPED) {
+            memset(page_buffer, 0xFF, PAGE_DATA_SIZE);
+        } else {
+            __map_physical_page(map_pages[index], 0, &addr_i);
+            if (NAND_Page_Read(hspi, &addr_i, page_buffer, PAGE_DATA_SIZE) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+        }
+
+        for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+            if (block_state[block] != BLOCK_FULL || block_sequence[block] <= map_sequence[index]) {
+                continue;
+            }
+            for (uint8_t page = 0; page < NUM_PAGES_PER_BLOCK; page++) {
+                NAND_PhysPage phys = block * NUM_PAGES_PER_BLOCK + page;
+
+                if (__ftl_read_tag(hspi, phys, &tag) != Ret_Success) {
+                    return Ret_ReadFailed;
+                }
+                if (tag.type == PAGE_TAG_ERASED) {
+                    break;
+                }
+                if ((tag.type != PAGE_TAG_DATA && (tag.type != PAGE_TAG_TXN || tag.txn >= newest_txn)) ||
+                    tag.sequence <= map_sequence[index] || tag.logical_page >= NAND_NUM_LOGICAL_PAGES ||
+                    tag.logical_page - first_page >= NAND_MAP_ENTRIES_PER_PAGE) {
+                    continue;
+                }
+
+                uint16_t entry = tag.logical_page - first_page;
+                memcpy(&current, &page_buffer[entry * sizeof(NAND_PhysPage)], sizeof(current));
+                if (current != NAND_MAP_UNMAPPED) {
+                    if (current >= NAND_FTL_NUM_BLOCKS * NUM_PAGES_PER_BLOCK ||
+                        __ftl_read_tag(hspi, current, &mapped) != Ret_Success) {
+                        return Ret_ReadFailed;
+                    }
+                    if (__ftl_tag_owns(&mapped, tag.logical_page) && mapped.sequence > tag.sequence) {
+                        continue;
+                    }
+                }
+                memcpy(&page_buffer[entry * sizeof(NAND_PhysPage)], &phys, sizeof(phys));
+
+                uint16_t segment = entry / NAND_MAP_SEGMENT_ENTRIES;
+                if (!(changed[segment / 8] & (1 << (segment % 8)))) {
+                    changed[segment / 8] |= 1 << (segment % 8);
+                    num_changed++;
+                }
+            }
+        }
+
+        if (num_changed == 0) {
+            index++;
+            continue;
+        }
+
+        /* leave room for the newest transaction, which the caller claims next */
+        if (map_dirty + num_changed + NAND_TXN_MAX_PAGES < NAND_MAP_CACHE_SEGMENTS) {
+            for (uint16_t segment = 0; segment < MAP_SEGMENTS_PER_PAGE; segment++) {
+                if (!(changed[segment / 8] & (1 << (segment % 8)))) {
+                    continue;
+                }
+                NAND_MapSegment *slot = __map_load(index * MAP_SEGMENTS_PER_PAGE + segment);
+                if (slot == NULL) {
+                    return Ret_ReadFailed;
+                }
+                memcpy(slot -> entries, &page_buffer[segment * sizeof(slot -> entries)], sizeof(slot -> entries));
+                if (!slot -> dirty) {
+                    slot -> dirty = 1;
+                    map_dirty++;
+                }
+            }
+            index++;
+            continue;
+        }
+
+        /* erased blocks are only trusted once listed, so one may have to be erased first;
+         * that reuses page_buffer, so this translation page is replayed again after */
+        if (free_blocks == 0 && dirty_blocks > 0 &&
+            (open_block[NAND_STREAM_HOT] == NAND_FTL_NUM_BLOCKS || open_page[NAND_STREAM_HOT] >= NAND_FTL_PAGES_PER_BLOCK)) {
+            status = __ftl_erase_dirty_block(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+            continue;
+        }
+
+        status = __ftl_program_map_page(hspi, index, NAND_STREAM_HOT);
+        if (status != Ret_Success) {
+            return status;
+        }
+        index++;
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Returns 1 if the page tagged tag holds a copy of logical_page.
+    @note A translation page can still point at a page that was reclaimed, and maybe
+          reused, after it was written. Such an entry loses to any other copy at mount.
+ */
+uint8_t __ftl_tag_owns(PageTag *tag, uint32_t logical_page) {
+    return (tag -> type == PAGE_TAG_DATA || tag -> type == PAGE_TAG_TXN) && tag -> logical_page == logical_page;
+}
+#endif
+
+
+/******************************************************************************
+ *                              Compression
+ *****************************************************************************/
+
+#if NAND_COMPRESSION
+
+/**
+    @brief Compresses a full logical page and appends it to the pack buffer.
+    @note Pages that do not shrink below NAND_PACK_RAW_THRESHOLD are programmed
+          uncompressed into stream straight away. Packed pages mix chunks of any stream
+          and go to the hot stream. data is left alone by space reclamation, so it may be
+          a leased buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_write_compressed(SPI_HandleTypeDef *hspi, uint32_t logical_page, uint8_t *data, uint8_t stream) {
+    NAND_PackEntry entry;
+    NAND_ReturnType status;
+    uint16_t length = NAND_LZ_Compress(data, PAGE_DATA_SIZE, lz_buffer, NAND_PACK_RAW_THRESHOLD);
+
+    if (length == 0) {
+        /* the pending copy must reach flash first, or it would look newer at mount */
+        if (MAP_PHYS(__map_get(logical_page)) == NAND_PAGE_PENDING) {
+            status = __ftl_flush_pack(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+
+        status = __ftl_reserve_page(hspi, stream);
+        if (status != Ret_Success) {
+            return status;
+        }
+        SPI_Params raw = { .buffer = data, .length = PAGE_DATA_SIZE };
+        return __ftl_program_page(hspi, stream, logical_page, &raw, 1);
+    }
+
+    if (pack_count == NAND_PACK_MAX_CHUNKS || pack_fill + length > PAGE_DATA_SIZE) {
+        status = __ftl_flush_pack(hspi);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    entry.logical_page = logical_page;
+    entry.offset       = pack_fill;
+    entry.length       = length;
+    memcpy(&pack_buffer[pack_count * sizeof(NAND_PackEntry)], &entry, sizeof(entry));
+    memcpy(&pack_buffer[pack_fill], lz_buffer, length);
+    pack_fill += length;
+    pack_count++;
+
+    __ftl_drop_mapping(logical_page);
+    __map_set(logical_page, MAP_ENTRY(NAND_PAGE_PENDING, pack_count));
+
+    return Ret_Success;
+}
+
+/**
+    @brief Reads length bytes at offset of the compressed logical page mapped by entry.
+    @note Costs two short reads from flash: the chunk's directory entry, then the chunk.
+          With NAND_PAGE_CRC, one read of the whole packed page instead, to check it.
+          The chunk is staged in page_buffer. Whole page reads decompress straight into
+          buffer, partial ones go through lz_buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_CorruptData
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_read_chunk(SPI_HandleTypeDef *hspi, NAND_MapEntry entry, uint16_t offset, uint8_t *buffer, uint16_t length) {
+    NAND_PackEntry pack_entry;
+    const uint8_t *compressed;
+    uint16_t slot = MAP_SLOT(entry) - 1;
+
+    if (MAP_PHYS(entry) == NAND_PAGE_PENDING) {
+        memcpy(&pack_entry, &pack_buffer[slot * sizeof(NAND_PackEntry)], sizeof(pack_entry));
+        compressed = &pack_buffer[pack_entry.offset];
+    } else {
+#if NAND_PAGE_CRC
+        NAND_ReturnType status = __ftl_read_checked(hspi, MAP_PHYS(entry), page_buffer);
+        if (status != Ret_Success) {
+            return status;
+        }
+        memcpy(&pack_entry, &page_buffer[slot * sizeof(NAND_PackEntry)], sizeof(pack_entry));
+        if (pack_entry.offset < NAND_PACK_HEADER_SIZE || pack_entry.length > PAGE_DATA_SIZE - pack_entry.offset) {
+            return Ret_ReadFailed;
+        }
+        compressed = &page_buffer[pack_entry.offset];
+#else
+        PhysicalAddrs addr_i;
+        __map_physical_page(MAP_PHYS(entry), slot * sizeof(NAND_PackEntry), &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, (uint8_t *) &pack_entry, sizeof(pack_entry)) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        if (pack_entry.offset < NAND_PACK_HEADER_SIZE || pack_entry.length > PAGE_DATA_SIZE - pack_entry.offset) {
+            return Ret_ReadFailed;
+        }
+        __map_physical_page(MAP_PHYS(entry), pack_entry.offset, &addr_i);
+        if (NAND_Page_Read(hspi, &addr_i, page_buffer, pack_entry.length) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        compressed = page_buffer;
+#endif
+    }
+
+    if (offset == 0 && length == PAGE_DATA_SIZE) {
+        if (NAND_LZ_Decompress(compressed, pack_entry.length, buffer, PAGE_DATA_SIZE) != PAGE_DATA_SIZE) {
+            return Ret_ReadFailed;
+        }
+    } else {
+        if (NAND_LZ_Decompress(compressed, pack_entry.length, lz_buffer, PAGE_DATA_SIZE) != PAGE_DATA_SIZE) {
+            return Ret_ReadFailed;
+        }
+        memcpy(buffer, &lz_buffer[offset], length);
+    }
+
+    return Ret_Success;
+}
+
+/**
+    @brief Programs the pack buffer as one packed page and maps its chunks there.
+    @note Chunks that were overwritten or trimmed while waiting are still programmed but
+          not mapped; they count as stale space in their block. During space reclamation
+          the page goes to the reclaim stream, which may still open a block.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_flush_pack(SPI_HandleTypeDef *hspi) {
+    SPI_Params data = { .buffer = pack_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PackEntry entry;
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+    uint8_t stream = reclaiming ? STREAM_RECLAIM : NAND_STREAM_HOT;
+
+    if (pack_count == 0) {
+        return Ret_Success;
+    }
+
+    status = __ftl_reserve_page(hspi, stream);
+    if (status != Ret_Success) {
+        return status;
+    }
+    /* space reclamation may have flushed the pack itself */
+    if (pack_count == 0) {
+        return Ret_Success;
+    }
+
+    status = __ftl_program_tagged(hspi, stream, PAGE_TAG_PACKED, pack_count, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    for (uint8_t slot = 0; slot < pack_count; slot++) {
+        memcpy(&entry, &pack_buffer[slot * sizeof(NAND_PackEntry)], sizeof(entry));
+        if (__map_get(entry.logical_page) == MAP_ENTRY(NAND_PAGE_PENDING, slot + 1)) {
+            __map_set(entry.logical_page, MAP_ENTRY(phys, slot + 1));
+            valid_count[phys / NUM_PAGES_PER_BLOCK]++;
+        }
+    }
+
+    memset(pack_buffer, 0xFF, NAND_PACK_HEADER_SIZE);
+    pack_count = 0;
+    pack_fill  = NAND_PACK_HEADER_SIZE;
+
+    return Ret_Success;
+}
+
+/**
+    @brief Moves the still mapped chunks of a packed page into the page being compacted.
+    @note Chunks are copied compressed, without decompressing them. The compacted page is
+          built in page_buffer; the victim page is staged in a leased buffer.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_reclaim_packed(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint32_t num_chunks) {
+    NAND_PackEntry entry;
+    NAND_ReturnType status;
+    uint8_t *victim = __pool_acquire();
+
+    if (victim == NULL) {
+        return Ret_MemoryOverflow;
+    }
+
+#if NAND_PAGE_CRC
+    /* chunks share the new page with others and cannot keep the old CRC, so a page that
+     * stays corrupt after the retries is copied unchecked, as without NAND_PAGE_CRC */
+    status = __ftl_read_checked(hspi, phys, victim);
+    if (status == Ret_CorruptData) {
+        status = Ret_Success;
+    }
+#else
+    PhysicalAddrs addr_i;
+    __map_physical_page(phys, 0, &addr_i);
+    status = (NAND_Page_Read(hspi, &addr_i, victim, PAGE_DATA_SIZE) == Ret_Success) ? Ret_Success : Ret_ReadFailed;
+#endif
+
+    for (uint8_t slot = 0; status == Ret_Success && slot < num_chunks; slot++) {
+        memcpy(&entry, &victim[slot * sizeof(NAND_PackEntry)], sizeof(entry));
+        if (entry.logical_page >= NAND_NUM_LOGICAL_PAGES ||
+            __map_get(entry.logical_page) != MAP_ENTRY(phys, slot + 1) ||
+            entry.offset < NAND_PACK_HEADER_SIZE || entry.length > PAGE_DATA_SIZE - entry.offset) {
+            continue;
+        }
+
+        if (reclaim_count == NAND_PACK_MAX_CHUNKS || reclaim_fill + entry.length > PAGE_DATA_SIZE) {
+            status = __ftl_flush_reclaim_pack(hspi);
+            if (status != Ret_Success) {
+                break;
+            }
+        }
+        if (reclaim_count == 0) {
+            memset(page_buffer, 0xFF, NAND_PACK_HEADER_SIZE);
+            reclaim_fill = NAND_PACK_HEADER_SIZE;
+        }
+
+        memcpy(&page_buffer[reclaim_fill], &victim[entry.offset], entry.length);
+        entry.offset = reclaim_fill;
+        memcpy(&page_buffer[reclaim_count * sizeof(NAND_PackEntry)], &entry, sizeof(entry));
+        reclaim_from[reclaim_count] = MAP_ENTRY(phys, slot + 1);
+        reclaim_fill += entry.length;
+        reclaim_count++;
+    }
+
+    __pool_release(victim);
+    return status;
+}
+
+/**
+    @brief Programs the page being compacted and moves its chunks' mappings there.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __ftl_flush_reclaim_pack(SPI_HandleTypeDef *hspi) {
+    SPI_Params data = { .buffer = page_buffer, .length = PAGE_DATA_SIZE };
+    NAND_PackEntry entry;
+    NAND_PhysPage phys;
+    NAND_ReturnType status;
+    uint32_t txn_copied[NAND_PACK_MAX_CHUNKS];
+    uint8_t num_txn_copied = 0;
+
+    if (reclaim_count == 0) {
+        return Ret_Success;
+    }
+
+    /* called while reclaiming, so this never reclaims and leaves page_buffer alone */
+    status = __ftl_reserve_page(hspi, STREAM_RECLAIM);
+    if (status != Ret_Success) {
+        return status;
+    }
+    status = __ftl_program_tagged(hspi, STREAM_RECLAIM, PAGE_TAG_PACKED, reclaim_count, &data, 1, &phys);
+    if (status != Ret_Success) {
+        return status;
+    }
+
+    for (uint8_t slot = 0; slot < reclaim_count; slot++) {
+        memcpy(&entry, &page_buffer[slot * sizeof(NAND_PackEntry)], sizeof(entry));
+        if (__map_get(entry.logical_page) == reclaim_from[slot]) {
+            __ftl_drop_mapping(entry.logical_page);
+            __map_set(entry.logical_page, MAP_ENTRY(phys, slot + 1));
+            valid_count[phys / NUM_PAGES_PER_BLOCK]++;
+            if (txn_open && __ftl_txn_find(entry.logical_page) < txn_count) {
+                txn_copied[num_txn_copied++] = entry.logical_page;
+            }
+        }
+    }
+
+    reclaim_count = 0;
+
+    /* as in __ftl_reclaim_block, the transaction's copies must stay newer than these */
+    for (uint8_t i = 0; i < num_txn_copied; i++) {
+        status = __ftl_reclaim_txn_page(hspi, txn_pages[__ftl_txn_find(txn_copied[i])].phys, txn_copied[i]);
+        if (status != Ret_Success) {
+            return status;
+        }
+    }
+
+    return Ret_Success;
+}
+
+#endif
@@ -22,30 +22,518 @@
 
 ********************************************************************************/
 
+#ifndef NAND_M79A_H
+#define NAND_M79A_H
+
 #include "nand_m79a_lld.h"
+#include "nand_lz.h"
+#include "nand_crc.h"
+#include "nand_trace.h"
+#include "nand_pool.h"
 
 // TODO:
-// Write higher level functions such as:
-//    NAND_Write(start_addr, *buffer, length)
-//    NAND_Read(start_addr, end_addr, *buffer) 
-//    NAND_Erase(start_addr, end_addr)
+// Manage bad blocks, ECC and locking.
+// Possibly more difficult features such as wear leveling
+
+/******************************************************************************
+ *                          Flash Translation Layer
+ *****************************************************************************/
 
-// Enable easy memory mapping of filled and available locations
-// Manage writing appropriate amount of data to each page
+/*
+    Logical pages are written out-of-place: every write goes to the next free page of the
+    open block and the mapping table is updated to point at it. Each programmed page carries
+    a tag in its spare area so that the mapping can be rebuilt by scanning at NAND_Init.
 
-// Map logical addresses from 0x0 to 0xMAX_STORAGE to page numbers, blocks inside the nand IC
+    The FTL manages NAND_FTL_NUM_BLOCKS blocks starting at NAND_FTL_FIRST_BLOCK. Of these,
+    NAND_FTL_SPARE_BLOCKS are kept as over-provisioning for space reclamation and bad blocks.
+    RAM use is 2 bytes per logical page (see NAND_MAP_EXTENTS and NAND_MAP_DEMAND) plus 2
+    bytes per block.
+*/
+#define NAND_FTL_FIRST_BLOCK        0
+#define NAND_FTL_NUM_BLOCKS         64
+#define NAND_FTL_SPARE_BLOCKS       8
+#define NAND_FTL_GC_THRESHOLD       2   /* reclaim space when this few free blocks remain */
 
-// Manage bad blocks, ECC and locking. 
-// Possibly more difficult features such as wear leveling
+/*
+    Space reclamation only copies pages; the reclaimed block joins a dirty pool and is
+    erased later by NAND_Idle, so that writes find pre-erased blocks and never wait for an
+    erase. When opening a block leaves fewer than NAND_FTL_POOL_LOW_WATERMARK free blocks,
+    NAND_Idle also reclaims ahead of time until NAND_FTL_POOL_TARGET blocks are free. Writes
+    only erase themselves if NAND_Idle cannot keep up and the free pool drops to
+    NAND_FTL_GC_THRESHOLD. Those last blocks are left to the reclamation done by writes:
+    once the pool is down to them, NAND_Idle only reclaims blocks that fit into the open
+    reclamation block, which takes the copies, trim checkpoints and moved records.
+
+    Which blocks are known to be erased is persisted in free list records. After a reboot,
+    blocks that merely look erased but are not in the newest record (an erase may have been
+    cut short by power loss) are put back in the dirty pool and erased again.
+*/
+#define NAND_FTL_POOL_LOW_WATERMARK 4
+#define NAND_FTL_POOL_TARGET        6
+
+/*
+    Block summaries. With NAND_BLOCK_SUMMARY set to 1, the last page of every block is kept
+    for a summary of the others: the tag each was programmed with, or none if its program
+    failed. It is programmed when the block fills up, before the next one is opened, and
+    NAND_Init reads it instead of the tags of the block's other pages. A mount then reads
+    two pages per full block (the summary, and the first page for the bad-block mark and
+    whether the block is erased) instead of one per page. Blocks without a summary, such as
+    those open at power loss, are still scanned page by page.
+
+    Costs one page per block, taken out of the logical capacity so that over-provisioning
+    stays the same, and NAND_FTL_PAGES_PER_BLOCK * 16 bytes of RAM per append point to
+    collect the tags of the open blocks.
+*/
+#ifndef NAND_BLOCK_SUMMARY
+    #define NAND_BLOCK_SUMMARY      0
+#endif
+#define NAND_FTL_PAGES_PER_BLOCK    (NUM_PAGES_PER_BLOCK - NAND_BLOCK_SUMMARY)   /* pages for anything but summaries */
+
+#define NAND_NUM_LOGICAL_PAGES      ((NAND_FTL_NUM_BLOCKS - NAND_FTL_SPARE_BLOCKS) * NAND_FTL_PAGES_PER_BLOCK)
+#define NAND_LOGICAL_SIZE_BYTES     ((uint32_t) NAND_NUM_LOGICAL_PAGES * PAGE_DATA_SIZE)
+
+#if (NAND_FTL_NUM_BLOCKS * NUM_PAGES_PER_BLOCK) >= 0xFFFE
+    #error "NAND_FTL_NUM_BLOCKS too large for 16-bit physical page numbers"
+#endif
+
+/*
+    Write streams. Each stream appends to its own open block, so pages expected to live
+    about as long end up in the same blocks, which then tend to go stale all at once and
+    are reclaimed with few or no copies. Pages copied by space reclamation go to an open
+    block of their own, and trim and free list records to the hot stream.
+
+    Without a hint, pages are classified by update frequency: writes of each logical page
+    are counted in 2 bits of RAM, and all counts are halved every NAND_STREAM_DECAY_WRITES
+    writes. A page written again before its count decays is hot. The counts start from zero
+    at NAND_Init. Costs 1 byte of RAM per 4 logical pages.
+*/
+typedef enum {
+    NAND_STREAM_HOT,
+    NAND_STREAM_COLD,
+    NAND_NUM_STREAMS,
+    NAND_STREAM_AUTO = 0xFF,    // classify each page by its update frequency
+} NAND_Stream;
+
+#define NAND_STREAM_DECAY_WRITES    NAND_NUM_LOGICAL_PAGES
+
+/* page index within the FTL region: (block - NAND_FTL_FIRST_BLOCK) * NUM_PAGES_PER_BLOCK + page */
+typedef uint16_t NAND_PhysPage;
+#define NAND_PAGE_PENDING           0xFFFE  /* compressed chunk still waiting in the pack buffer */
+
+/*
+    Optional transparent compression. With NAND_COMPRESSION set to 1, each logical page
+    written is compressed with nand_lz and appended to a pack buffer in RAM. The pack buffer
+    is programmed as one page when the next chunk does not fit or on NAND_Sync, so several
+    logical pages cost one page program and far fewer SPI bytes. Pages that do not shrink
+    below NAND_PACK_RAW_THRESHOLD are stored uncompressed as usual.
+
+    A packed page starts with a directory of NAND_PACK_MAX_CHUNKS entries, followed by the
+    compressed chunks. The mapping then holds (physical page, slot) for every logical page,
+    slot 0 meaning an uncompressed page.
+
+    Costs 6 KB of RAM for the pack, compression and scratch buffers, plus 2 more bytes per
+    logical page. Writes are only durable after the pack buffer is flushed by NAND_Sync.
+*/
+#ifndef NAND_COMPRESSION
+    #define NAND_COMPRESSION        0
+#endif
+#define NAND_PACK_MAX_CHUNKS        8
+
+typedef struct {
+    uint32_t logical_page;
+    uint16_t offset;        // byte offset of the compressed chunk in the page
+    uint16_t length;        // compressed length in bytes
+} NAND_PackEntry;
+
+#define NAND_PACK_HEADER_SIZE       (NAND_PACK_MAX_CHUNKS * sizeof(NAND_PackEntry))
+#define NAND_PACK_RAW_THRESHOLD     ((PAGE_DATA_SIZE - NAND_PACK_HEADER_SIZE) / 2)
+
+/* mapping table entry: physical page in the low 16 bits, pack slot + 1 above */
+#if NAND_COMPRESSION
+    typedef uint32_t NAND_MapEntry;
+#else
+    typedef NAND_PhysPage NAND_MapEntry;
+#endif
+#define NAND_MAP_UNMAPPED           ((NAND_MapEntry) 0xFFFFFFFF)
+#define MAP_ENTRY(phys, slot)       ((NAND_MapEntry) (((uint32_t) (slot) << 16) | (phys)))
+#define MAP_PHYS(entry)             ((NAND_PhysPage) ((entry) & 0xFFFF))
+#define MAP_SLOT(entry)             ((uint16_t) ((uint32_t) (entry) >> 16))
+
+/*
+    Optional extent mapping. With NAND_MAP_EXTENTS set to 1, the per-page mapping table is
+    replaced by a sorted array of extents, each mapping a run of consecutive logical pages
+    to a run of consecutive physical pages. Sequential writes land on consecutive pages of
+    the open block (and of the next block, which is usually adjacent), so a long sequential
+    object costs one extent. Lookups are a binary search.
+
+    RAM is 6 bytes per extent for NAND_EXTENT_MAX extents instead of 2 bytes per logical
+    page, so it scales with fragmentation rather than capacity. Once fewer than
+    NAND_EXTENT_RESERVE extents are free, writes fail with Ret_MemoryOverflow and trims
+    have to merge extents again; only a trim inside a single extent needs one. Each page
+    copied by space reclamation may split an extent in two, so the reserve covers copying
+    a whole block, and reclamation only picks blocks whose copies fit in the extents left.
+    Mount maps the newest copies in logical order, so a table that fit before power loss
+    fits again. Not available with compression.
+*/
+#ifndef NAND_MAP_EXTENTS
+    #define NAND_MAP_EXTENTS        0
+#endif
+#define NAND_EXTENT_MAX             256
+#define NAND_EXTENT_RESERVE         (2 * NAND_FTL_PAGES_PER_BLOCK)
+
+#if NAND_MAP_EXTENTS && NAND_COMPRESSION
+    #error "NAND_MAP_EXTENTS does not support NAND_COMPRESSION"
+#endif
+#if NAND_MAP_EXTENTS && NAND_EXTENT_RESERVE >= NAND_EXTENT_MAX
+    #error "NAND_EXTENT_MAX must be above NAND_EXTENT_RESERVE"
+#endif
+
+/*
+    Optional in-place appends. With NAND_PARTIAL_PROGRAM set to 1, a write covering part of a
+    logical page is programmed into the page's current copy when the ECC sectors it falls in
+    are still erased there (see NAND_Page_Append), instead of rewriting the whole page
+    elsewhere. Data appended a sector at a time, such as a log of records, then costs one
+    partial program per NAND_ECC_SECTOR_SIZE bytes rather than a page read-modify-write each.
+    The first sectors, which share their spare area with the tag, are written with the tag
+    and never appended to.
+
+    An append cut short by power loss leaves uncorrectable errors in the sectors it was
+    programming, where an out-of-place write keeps the old copy. Not available with compression.
+*/
+#ifndef NAND_PARTIAL_PROGRAM
+    #define NAND_PARTIAL_PROGRAM    0
+#endif
+
+#if NAND_PARTIAL_PROGRAM && NAND_COMPRESSION
+    #error "NAND_PARTIAL_PROGRAM does not support NAND_COMPRESSION"
+#endif
+
+/*
+    End-to-end data checks. With NAND_PAGE_CRC set to 1, every page the FTL programs carries
+    the CRC32C of its data area in its tag (see nand_crc.h), and every read of host data
+    checks it: NAND_Read, the merges of partial writes and the copies made by space
+    reclamation. On-die ECC covers the cells; this also covers the SPI transfers in both
+    directions, where a glitch at a fast clock corrupts data without any error.
+
+    A page that does not match is read up to NAND_PAGE_CRC_ATTEMPTS times in all, since
+    transfer errors rarely repeat, and then reported as Ret_CorruptData. Each mismatch also
+    counts as a failed read towards slowing the SPI clock (see NAND_Calibrate_Clock). Space
+    reclamation moves a page that still does not match with its original CRC, so it keeps
+    reading as corrupt. A read of part of a page transfers the whole page to check it.
+    Not available with NAND_PARTIAL_PROGRAM, whose appends change data after the tag is
+    written.
+*/
+#ifndef NAND_PAGE_CRC
+    #define NAND_PAGE_CRC           0
+#endif
+#define NAND_PAGE_CRC_ATTEMPTS      3
+
+#if NAND_PAGE_CRC && NAND_PARTIAL_PROGRAM
+    #error "NAND_PAGE_CRC does not support NAND_PARTIAL_PROGRAM"
+#endif
+
+/*
+    Optional demand-paged mapping. With NAND_MAP_DEMAND set to 1, the mapping table is kept
+    on flash in NAND_MAP_PAGES translation pages of NAND_MAP_ENTRIES_PER_PAGE entries each.
+    RAM holds a directory with the newest copy of every translation page, and a cache of
+    NAND_MAP_CACHE_SEGMENTS segments of NAND_MAP_SEGMENT_ENTRIES consecutive entries. A miss
+    reads one segment into the least recently used clean slot, so sequential access only
+    misses once per segment.
+
+    Updates dirty the cached segment only. Once more than NAND_MAP_DIRTY_SEGMENTS segments
+    are dirty, the translation page of the least recently used one is programmed again with
+    all of its dirty segments. They need not be written for durability: at NAND_Init, pages
+    newer than the translation page covering them claim the mapping again, so only blocks
+    written since are scanned twice. NAND_Txn_Begin writes back every dirty segment.
+    Space reclamation lets all but two slots go dirty while it copies pages, then writes
+    back down to the limit once, so its own updates are gathered into few translation pages.
+
+    RAM is (2 * NAND_MAP_SEGMENT_ENTRIES + 8) bytes per cached segment plus 6 bytes per
+    translation page, instead of 2 bytes per logical page. Not available with extents or
+    compression.
+*/
+#ifndef NAND_MAP_DEMAND
+    #define NAND_MAP_DEMAND         0
+#endif
+#define NAND_MAP_SEGMENT_ENTRIES    16
+#define NAND_MAP_CACHE_SEGMENTS     32
+#define NAND_MAP_DIRTY_SEGMENTS     12
+#define NAND_MAP_ENTRIES_PER_PAGE   (PAGE_DATA_SIZE / sizeof(NAND_PhysPage))
+#define NAND_MAP_PAGES              ((NAND_NUM_LOGICAL_PAGES + NAND_MAP_ENTRIES_PER_PAGE - 1) / NAND_MAP_ENTRIES_PER_PAGE)
+
+#if NAND_MAP_DEMAND && (NAND_MAP_EXTENTS || NAND_COMPRESSION)
+    #error "NAND_MAP_DEMAND does not support NAND_MAP_EXTENTS or NAND_COMPRESSION"
+#endif
+#if (PAGE_DATA_SIZE / 2) % NAND_MAP_SEGMENT_ENTRIES != 0
+    #error "NAND_MAP_SEGMENT_ENTRIES must divide the entries of a translation page"
+#endif
+
+typedef struct {
+    uint16_t logical_start;
+    NAND_PhysPage physical_start;
+    uint16_t length;        // pages in the run
+} NAND_Extent;
+
+/* cached run of mapping entries, see NAND_MAP_DEMAND */
+typedef struct {
+    uint16_t segment;       // first logical page / NAND_MAP_SEGMENT_ENTRIES, 0xFFFF if empty
+    uint8_t  dirty;         // changed since its translation page was last programmed
+    uint32_t used;          // map_clock at the last lookup
+    NAND_PhysPage entries[NAND_MAP_SEGMENT_ENTRIES];
+} NAND_MapSegment;
+
+/* Page types recorded in the spare area tag */
+typedef enum {
+    PAGE_TAG_DATA   = 0x01,
+    PAGE_TAG_TRIM   = 0x02,
+    PAGE_TAG_PACKED = 0x03,
+    PAGE_TAG_FREE   = 0x04,
+    PAGE_TAG_STATS  = 0x05,
+    PAGE_TAG_TXN    = 0x06,
+    PAGE_TAG_COMMIT = 0x07,
+    PAGE_TAG_MAP    = 0x08,
+    PAGE_TAG_SUMMARY = 0x09,
+    PAGE_TAG_NONE   = 0x00,     // summary entry of a page whose program failed
+    PAGE_TAG_ERASED = 0xFF,
+} PageTagType;
+
+/* Spare area tag, written at SPARE_USER_OFFSET of every page programmed by the FTL */
+typedef struct {
+    uint8_t  type;          // PageTagType
+    uint8_t  reserved[3];
+    uint32_t logical_page;  // data: logical page stored here; trim: number of ranges; packed: number of chunks;
+                            // free list, statistics: number of blocks; commit: transaction ID;
+                            // translation page: its index; summary: number of entries
+    uint32_t sequence;      // global write sequence number, newest copy wins during mount
+    uint32_t txn;           // transaction the page was written by, 0 outside transactions
+    uint32_t crc;           // CRC32C of the data area with NAND_PAGE_CRC, 0 otherwise
+} PageTag;
+
+/* Summary of one page of a block, as recorded in the summary page with NAND_BLOCK_SUMMARY */
+typedef struct {
+    uint8_t  type;          // PageTagType of the page, PAGE_TAG_NONE if its program failed
+    uint8_t  reserved[3];
+    uint32_t logical_page;  // as in the page's tag
+    uint32_t sequence;
+    uint32_t txn;
+} NAND_SummaryEntry;
+#define NAND_SUMMARY_ENTRIES        (NUM_PAGES_PER_BLOCK - 1)
+
+/*
+    Trims are made durable with trim records: pages whose data area holds a list of discarded
+    logical page ranges. At mount, a trim record unmaps any copy of its pages that is older
+    than the record itself. Before a block holding trim records is erased, all currently
+    unmapped ranges are written out as a fresh set of records, which supersedes every older one.
+*/
+typedef struct {
+    uint32_t first_page;
+    uint32_t num_pages;
+} NAND_TrimRange;
+#define NAND_TRIM_RANGES_PER_PAGE   (PAGE_DATA_SIZE / sizeof(NAND_TrimRange))
+
+/* free list record: one bit per block, set if the block is erased */
+#define FREE_LIST_SIZE              ((NAND_FTL_NUM_BLOCKS + 7) / 8)
+
+/*
+    Atomic transactions. Pages written between NAND_Txn_Begin and NAND_Txn_Commit are
+    programmed out-of-place like any other write, but tagged with the transaction ID and
+    kept out of the mapping. NAND_Txn_Commit programs one commit record and then switches
+    the mapping of every page at once, so the data itself is written only once.
+
+    At mount, pages of the newest transaction only count if its commit record is on flash.
+    If not, they are superseded: the committed copy of each page is programmed again (or a
+    trim record written if it had none), so that a later transaction can never resurrect
+    them. The newest commit record is rewritten before its block is erased.
+
+    At most NAND_TXN_MAX_PAGES distinct logical pages per transaction, at 12 bytes of RAM each.
+*/
+#define NAND_TXN_MAX_PAGES          16
+
+/* a commit maps its pages with no chance to write back in between */
+#if NAND_MAP_DEMAND && NAND_MAP_DIRTY_SEGMENTS + NAND_TXN_MAX_PAGES >= NAND_MAP_CACHE_SEGMENTS
+    #error "NAND_MAP_CACHE_SEGMENTS must exceed NAND_MAP_DIRTY_SEGMENTS + NAND_TXN_MAX_PAGES"
+#endif
+
+typedef struct {
+    uint32_t logical_page;
+    NAND_PhysPage phys;     // newest copy written by the transaction
+    uint32_t sequence;      // its sequence number, only used during mount
+} NAND_TxnPage;
+
+/*
+    Endurance statistics. Counters are kept in RAM and saved as a statistics record by
+    NAND_Sync whenever they changed, by NAND_Idle after every block erase and otherwise once
+    NAND_STATS_SAVE_INTERVAL pages were programmed since the last save, so up to that many
+    programs' worth of counts are lost on power loss.
+    Costs 4 bytes of RAM per block for the erase counts.
+*/
+#define NAND_STATS_SAVE_INTERVAL    1024
+#define NAND_STATS_BUCKETS          8
+
+#if (NAND_FTL_NUM_BLOCKS * 4 + 64) > PAGE_DATA_SIZE
+    #error "NAND_FTL_NUM_BLOCKS too large for the statistics record"
+#endif
+
+/* statistics record, as saved on flash */
+typedef struct {
+    uint64_t host_bytes_written;
+    uint64_t pages_programmed;
+    uint64_t blocks_erased;
+    uint32_t ecc_results[NUM_ECC_RESULTS];
+    uint16_t factory_bad_blocks;
+    uint16_t reserved;
+    uint32_t erase_count[NAND_FTL_NUM_BLOCKS];
+} NAND_StatsRecord;
+
+/* lifetime statistics reported by NAND_Get_Stats */
+typedef struct {
+    uint64_t host_bytes_written;    // bytes accepted by NAND_Write
+    uint64_t pages_programmed;      // every page program: host data, copies and records
+    uint32_t write_amplification;   // bytes programmed per host byte written, times 1000
+    uint64_t blocks_erased;
+
+    /* erase counts over the blocks that are not bad */
+    uint32_t erase_min;
+    uint32_t erase_avg;
+    uint32_t erase_max;
+    uint32_t erase_p50;
+    uint32_t erase_p90;
+    uint32_t erase_p99;
+    uint16_t erase_histogram[NAND_STATS_BUCKETS];   // blocks per erase count range, from erase_min
+    uint32_t erase_bucket_width;                    // erase counts covered by each bucket
+
+    uint16_t bad_blocks;
+    uint16_t grown_bad_blocks;      // retired since the first NAND_Init
+    uint32_t ecc_results[NUM_ECC_RESULTS];  // page reads by on-die ECC outcome
+} NAND_Stats;
+
+/*
+    SPI clock calibration. With NAND_CLOCK_CALIBRATION set to 1, NAND_Init raises the SPI
+    clock from the reference setting of NAND_SPI_Init to the fastest one that reliably reads
+    back a known pattern, less a safety margin (see NAND_Calibrate_Clock). The pattern is
+    kept in NAND_CLOCK_CAL_BLOCK, outside the FTL region. When page reads start failing,
+    the clock is slowed down at once and NAND_Idle calibrates again with more margin.
+*/
+#ifndef NAND_CLOCK_CALIBRATION
+    #define NAND_CLOCK_CALIBRATION  0
+#endif
+#define NAND_CLOCK_CAL_BLOCK        (NAND_FTL_FIRST_BLOCK + NAND_FTL_NUM_BLOCKS)
+
+#if NAND_CLOCK_CAL_BLOCK >= NAND_FTL_FIRST_BLOCK && NAND_CLOCK_CAL_BLOCK < NAND_FTL_FIRST_BLOCK + NAND_FTL_NUM_BLOCKS
+    #error "NAND_CLOCK_CAL_BLOCK must lie outside the FTL region"
+#endif
+
+#if NAND_TRACE && NAND_TRACE_FIRST_BLOCK < NAND_FTL_FIRST_BLOCK + NAND_FTL_NUM_BLOCKS && NAND_TRACE_FIRST_BLOCK + NAND_TRACE_NUM_BLOCKS > NAND_FTL_FIRST_BLOCK
+    #error "The trace region (NAND_TRACE_FIRST_BLOCK) must lie outside the FTL region"
+#endif
+#if NAND_TRACE && NAND_CLOCK_CALIBRATION && NAND_CLOCK_CAL_BLOCK >= NAND_TRACE_FIRST_BLOCK && NAND_CLOCK_CAL_BLOCK < NAND_TRACE_FIRST_BLOCK + NAND_TRACE_NUM_BLOCKS
+    #error "NAND_CLOCK_CAL_BLOCK must lie outside the trace region"
+#endif
+
+#if NAND_POOL_BUFFERS < 1 + NAND_COMPRESSION
+    #error "NAND_COMPRESSION needs two NAND_POOL_BUFFERS"
+#endif
+
+/* Block states kept in RAM */
+typedef enum {
+    BLOCK_FREE,
+    BLOCK_OPEN,
+    BLOCK_FULL,
+    BLOCK_DIRTY,    // nothing valid left, waiting to be erased
+    BLOCK_BAD,
+} BlockState;
 
 /******************************************************************************
  *                              Internal Functions
  *****************************************************************************/
 
-NAND_ReturnType __map_logical_addr(NAND_Addr *address, PhysicalAddrs *addr_struct);
+/* API bodies, run with the device lock held (see nand_os.h) */
+NAND_ReturnType __ftl_init(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_read(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length);
+NAND_ReturnType __ftl_write_stream(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length, uint8_t stream);
+NAND_ReturnType __ftl_sync(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_idle(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_trim(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint32_t length);
+NAND_ReturnType __ftl_txn_begin(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_txn_write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length);
+NAND_ReturnType __ftl_txn_commit(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_txn_abort(SPI_HandleTypeDef *hspi);
+void __ftl_get_stats(NAND_Stats *stats);
 
+NAND_ReturnType __map_logical_addr(NAND_Addr *address, PhysicalAddrs *addr_struct);
+NAND_MapEntry __map_get(uint32_t logical_page);
+NAND_ReturnType __map_set(uint32_t logical_page, NAND_MapEntry entry);
+void __map_clear(void);
+NAND_ReturnType __map_reserve(void);
+NAND_ReturnType __map_reserve_trim(uint32_t first_page, uint32_t end_page);
+uint32_t __map_trim_head(uint32_t first_page, uint32_t end_page);
+#if NAND_MAP_EXTENTS
+uint16_t __map_upper_bound(uint32_t logical_page);
+NAND_ReturnType __map_insert_extent(uint16_t index, NAND_Extent *extent);
+void __map_remove_extent(uint16_t index);
+#endif
+#if NAND_MAP_DEMAND
+NAND_MapSegment *__map_load(uint32_t segment);
+#endif
+void __map_physical_page(NAND_PhysPage phys, uint16_t column, PhysicalAddrs *addr_struct);
 
+NAND_ReturnType __ftl_mount(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_mount_claim(SPI_HandleTypeDef *hspi, uint32_t logical_page, NAND_MapEntry entry, uint32_t sequence);
+#if NAND_MAP_EXTENTS
+NAND_ReturnType __ftl_mount_extents(SPI_HandleTypeDef *hspi, uint32_t newest_txn);
+NAND_ReturnType __ftl_mount_window(SPI_HandleTypeDef *hspi, NAND_MapEntry *window, uint32_t first, uint32_t newest_txn);
+NAND_ReturnType __ftl_mount_window_summary(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *summarized);
+NAND_ReturnType __ftl_mount_window_tag(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint8_t summarized, PageTag *tag);
+#endif
+void __ftl_drop_mapping(uint32_t logical_page);
+NAND_ReturnType __ftl_read_tag(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, PageTag *tag);
+#if NAND_PAGE_CRC
+NAND_ReturnType __ftl_read_checked(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint8_t *buffer);
+#endif
+uint8_t __ftl_classify(uint32_t logical_page);
+NAND_ReturnType __ftl_reserve_page(SPI_HandleTypeDef *hspi, uint8_t stream);
+NAND_ReturnType __ftl_program_tagged(SPI_HandleTypeDef *hspi, uint8_t stream, uint8_t type, uint32_t logical_page, SPI_Params *data, uint8_t num_data, NAND_PhysPage *phys);
+NAND_ReturnType __ftl_program_page(SPI_HandleTypeDef *hspi, uint8_t stream, uint32_t logical_page, SPI_Params *data, uint8_t num_data);
+#if NAND_BLOCK_SUMMARY
+NAND_ReturnType __ftl_write_summary(SPI_HandleTypeDef *hspi, uint8_t stream);
+NAND_ReturnType __ftl_read_summary(SPI_HandleTypeDef *hspi, uint16_t block, PageTag *tag);
+#endif
+#if NAND_PARTIAL_PROGRAM
+NAND_ReturnType __ftl_append(SPI_HandleTypeDef *hspi, uint32_t logical_page, uint16_t offset, uint8_t *buffer, uint16_t length, uint8_t *appended);
+uint8_t __ftl_all_erased(uint8_t *data, uint16_t length);
+#endif
+NAND_ReturnType __ftl_write_trim_record(SPI_HandleTypeDef *hspi, uint32_t first_page, uint32_t num_pages);
+NAND_ReturnType __ftl_checkpoint_trims(SPI_HandleTypeDef *hspi);
+uint8_t __ftl_checkpoint_unmapped(uint32_t logical_page);
+NAND_ReturnType __ftl_apply_trim_records(SPI_HandleTypeDef *hspi, uint16_t block);
 
+#if NAND_COMPRESSION
+NAND_ReturnType __ftl_write_compressed(SPI_HandleTypeDef *hspi, uint32_t logical_page, uint8_t *data, uint8_t stream);
+NAND_ReturnType __ftl_read_chunk(SPI_HandleTypeDef *hspi, NAND_MapEntry entry, uint16_t offset, uint8_t *buffer, uint16_t length);
+NAND_ReturnType __ftl_flush_pack(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_reclaim_packed(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint32_t num_chunks);
+NAND_ReturnType __ftl_flush_reclaim_pack(SPI_HandleTypeDef *hspi);
+#endif
+NAND_ReturnType __ftl_reclaim_block(SPI_HandleTypeDef *hspi, uint8_t may_open);
+NAND_ReturnType __ftl_erase_dirty_block(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_write_free_list(SPI_HandleTypeDef *hspi);
+uint8_t __ftl_free_list_stale(void);
+NAND_ReturnType __ftl_write_stats(SPI_HandleTypeDef *hspi);
+uint8_t __ftl_stats_changed(void);
+uint32_t __stats_erase_rank(uint16_t rank);
+uint8_t __ftl_txn_find(uint32_t logical_page);
+NAND_ReturnType __ftl_mount_txn_page(SPI_HandleTypeDef *hspi, PageTag *tag, NAND_PhysPage phys, uint32_t *newest_txn);
+NAND_ReturnType __ftl_reclaim_txn_page(SPI_HandleTypeDef *hspi, NAND_PhysPage phys, uint32_t logical_page);
+NAND_ReturnType __ftl_txn_rollback(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __ftl_write_commit(SPI_HandleTypeDef *hspi, uint32_t txn);
+NAND_ReturnType __ftl_retire_block(SPI_HandleTypeDef *hspi, uint16_t block);
+#if NAND_MAP_DEMAND
+NAND_ReturnType __ftl_write_map_page(SPI_HandleTypeDef *hspi, uint16_t index, uint8_t stream);
+NAND_ReturnType __ftl_program_map_page(SPI_HandleTypeDef *hspi, uint16_t index, uint8_t stream);
+NAND_ReturnType __ftl_flush_map(SPI_HandleTypeDef *hspi, uint16_t keep);
+NAND_ReturnType __ftl_mount_replay(SPI_HandleTypeDef *hspi, uint32_t newest_txn);
+uint8_t __ftl_tag_owns(PageTag *tag, uint32_t logical_page);
+#endif
 
 /******************************************************************************
  *                              List of APIs
@@ -53,10 +541,20 @@ NAND_ReturnType __map_logical_addr(NAND_Addr *address, PhysicalAddrs *addr_struc
 
 NAND_ReturnType NAND_Init(SPI_HandleTypeDef *hspi);
 
+NAND_ReturnType NAND_Read(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length);
+NAND_ReturnType NAND_Write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length);
+NAND_ReturnType NAND_Write_Stream(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length, uint8_t stream);
+NAND_ReturnType NAND_Trim(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint32_t length);
+NAND_ReturnType NAND_Sync(SPI_HandleTypeDef *hspi);
 
+NAND_ReturnType NAND_Txn_Begin(SPI_HandleTypeDef *hspi);
+NAND_ReturnType NAND_Txn_Write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length);
+NAND_ReturnType NAND_Txn_Commit(SPI_HandleTypeDef *hspi);
+NAND_ReturnType NAND_Txn_Abort(SPI_HandleTypeDef *hspi);
 
+NAND_ReturnType NAND_Idle(SPI_HandleTypeDef *hspi);
+uint8_t NAND_Idle_Pending(void);
 
+void NAND_Get_Stats(NAND_Stats *stats);
 
-
-
-
+#endif
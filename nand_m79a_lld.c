@@ -22,6 +22,46 @@
 ********************************************************************************/
 
 #include "nand_m79a_lld.h"
+#include "nand_trace.h"
+#include "nand_pool.h"
+
+#if PARAM_PAGE_SIZE > NAND_POOL_ARENA_SIZE
+    #error "NAND_POOL_ARENA_SIZE too small for the parameter page"
+#endif
+
+#ifdef NAND_AUTODETECT
+NAND_Geometry nand_geometry;    // filled in by NAND_Read_Param_Page
+#else
+NAND_Geometry nand_geometry = {
+    .page_data_size    = PAGE_DATA_SIZE,
+    .page_spare_size   = PAGE_SPARE_SIZE,
+    .pages_per_block   = NUM_PAGES_PER_BLOCK,
+    .num_blocks        = NUM_BLOCKS,
+    .num_dies          = NUM_DIES,
+    .num_planes        = PLANE_MASK + 1,
+    .programs_per_page = NUM_PROGRAMS_PER_PAGE,
+    .die_block_bits    = DIE_BLOCK_BITS,
+    .plane_mask        = PLANE_MASK,
+};
+#endif
+
+/* die currently selected in the die select register */
+static uint8_t selected_die;
+
+/* status register as last read while waiting for an operation */
+static uint8_t last_status;
+
+/* page reads since power on, by on-die ECC outcome */
+static uint32_t ecc_counts[NUM_ECC_RESULTS];
+
+/* SPI clock setting, margin kept below the fastest reliable one, and failed page reads
+ * counted towards a recalibration, see NAND_Calibrate_Clock */
+static uint8_t  clock_step = NAND_SPI_CLOCK_SLOWEST;
+static uint8_t  clock_margin = NAND_CLOCK_MARGIN;
+static uint8_t  clock_calibrating;
+static uint8_t  clock_recalibrate;
+static uint16_t window_reads;
+static uint8_t  window_errors;
 
 
 /******************************************************************************
@@ -44,6 +84,7 @@ NAND_ReturnType NAND_Reset(SPI_HandleTypeDef *hspi) {
 
     NAND_SPI_ReturnType SPI_Status = NAND_SPI_Send(hspi, &transmit);
     NAND_Wait(T_POR);	// wait for T_POR = 1.25 ms after reset
+    selected_die = 0;
 
     if (SPI_Status != SPI_OK) {
         return Ret_ResetFailed;
@@ -57,39 +98,15 @@ NAND_ReturnType NAND_Reset(SPI_HandleTypeDef *hspi) {
     @brief Waits until device is ready for further instructions
     @note Waits until OIP bit in the Status Register resets again, indicating
     that the NAND Flash is ready for further instructions. If OIP = 1,
-    operation is ongoing, i.e. device is busy.
-
-    Assumption: the device keeps outputting the status register contents
-    until another command is issued. This is shown in pages 17 and 31.
-    TODO: confirm with an oscilloscope.
+    operation is ongoing, i.e. device is busy. Polls for as long as the longest
+    operation (a block erase) may take, sleeping in between; see __wait_ready.
 
     @return NAND_ReturnType
+    @retval Ret_NANDBusy
     @retval Ret_Success
 */
 NAND_ReturnType NAND_Wait_Until_Ready(SPI_HandleTypeDef *hspi) {
-    uint8_t timeout_counter = 0;
-    uint8_t max_attempts = 2;
-
-    /* SPI Transaction set up */
-    uint8_t data_rx;
-    SPI_Params rx = { .buffer = &data_rx, .length = 1 };
-
-    /* check once if any operations in progress */
-    NAND_ReturnType status = NAND_Check_Busy(hspi);
-
-    /* if busy, keep polling for until reaching max_attempts. if still busy, return busy */
-    if (status == Ret_NANDBusy) {
-        while (CHECK_OIP(data_rx)) {
-            if (timeout_counter < max_attempts) {
-                NAND_SPI_Receive(hspi, &rx);
-                NAND_Wait(1);
-                timeout_counter += 1;
-            } else {
-                return Ret_NANDBusy;
-            }
-        }
-    }
-    return Ret_Success;
+    return __wait_ready(hspi, 0, T_BERS_MAX_US);
 }
 
 /******************************************************************************
@@ -112,7 +129,7 @@ NAND_ReturnType NAND_Read_ID(SPI_HandleTypeDef *hspi, NAND_ID *nand_ID) {
     SPI_Params tx = { .buffer = data_tx, .length = 2 };
     SPI_Params rx = { .buffer = data_rx, .length = 2 };
 
-    NAND_SPI_SendReceive(hspi, &tx, &rx);
+    NAND_SPI_SendReceive(hspi, &tx, &rx, 1);
 
     nand_ID -> manufacturer_ID = data_rx[0]; // second last byte from transmission
     nand_ID -> device_ID       = data_rx[1]; // last byte
@@ -120,6 +137,89 @@ NAND_ReturnType NAND_Read_ID(SPI_HandleTypeDef *hspi, NAND_ID *nand_ID) {
     return Ret_Success;
 }
 
+/**
+    @brief Reads the parameter page and fills in geometry from it.
+    @note The page is read with CFG set to parameter page mode, which is restored
+          afterwards. The first of the redundant copies whose CRC matches is used.
+          Only parts sharing the page and block layout of this driver are accepted. The page
+          is read into the nand_pool arena.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow
+    @retval Ret_ReadFailed
+    @retval Ret_WrongType
+    @retval Ret_Success
+*/
+NAND_ReturnType NAND_Read_Param_Page(SPI_HandleTypeDef *hspi, NAND_Geometry *geometry) {
+    uint8_t *param_page;
+    uint16_t arena_mark = __pool_mark();
+    uint8_t cfg_reg;
+    uint8_t copy;
+    PhysicalAddrs addr = { .die = 0, .rowAddr = PARAM_PAGE_ROW };
+    NAND_ReturnType status = Ret_ReadFailed;
+
+    if (NAND_Get_Features(hspi, SPI_NAND_CFG_REG_ADDR, &cfg_reg) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+    if (NAND_Set_Features(hspi, SPI_NAND_CFG_REG_ADDR, (cfg_reg & ~SPI_NAND_CFG) | SPI_NAND_CFG_PARAM_PAGE) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+
+    param_page = __pool_alloc(PARAM_PAGE_SIZE);
+    for (copy = 0; param_page != NULL && copy < PARAM_PAGE_COPIES; copy++) {
+        addr.colAddr = copy * PARAM_PAGE_SIZE;
+        if (NAND_Page_Read(hspi, &addr, param_page, PARAM_PAGE_SIZE) != Ret_Success) {
+            break;
+        }
+        if (param_page[0] == 'O' && param_page[1] == 'N' && param_page[2] == 'F' && param_page[3] == 'I' &&
+            __param_page_crc(param_page) == (param_page[254] | (param_page[255] << 8))) {
+            status = Ret_Success;
+            break;
+        }
+    }
+
+    /* back to normal array access */
+    if (NAND_Set_Features(hspi, SPI_NAND_CFG_REG_ADDR, cfg_reg) != Ret_Success || status != Ret_Success) {
+        __pool_reset(arena_mark);
+        return (param_page == NULL) ? Ret_MemoryOverflow : Ret_ReadFailed;
+    }
+
+    /* little endian fields, see ONFI parameter page definition */
+    uint32_t data_size       = param_page[80] | (param_page[81] << 8) | ((uint32_t) param_page[82] << 16) | ((uint32_t) param_page[83] << 24);
+    uint16_t spare_size      = param_page[84] | (param_page[85] << 8);
+    uint32_t pages_per_block = param_page[92] | (param_page[93] << 8) | ((uint32_t) param_page[94] << 16) | ((uint32_t) param_page[95] << 24);
+    uint32_t blocks_per_die  = param_page[96] | (param_page[97] << 8) | ((uint32_t) param_page[98] << 16) | ((uint32_t) param_page[99] << 24);
+    uint8_t  num_dies        = param_page[100];
+    uint8_t  num_programs    = param_page[110];
+    uint8_t  plane_bits      = param_page[113] & 0x0F;
+    __pool_reset(arena_mark);
+
+    if (data_size != PAGE_DATA_SIZE || spare_size != PAGE_SPARE_SIZE || pages_per_block != NUM_PAGES_PER_BLOCK ||
+        num_dies < 1 || num_dies > 2 || plane_bits > 1) {
+        return Ret_WrongType;
+    }
+
+    /* blocks per die must be a power of two that fits the row address */
+    geometry -> die_block_bits = 0;
+    while ((1UL << geometry -> die_block_bits) < blocks_per_die) {
+        geometry -> die_block_bits++;
+    }
+    if ((1UL << geometry -> die_block_bits) != blocks_per_die || geometry -> die_block_bits > ROW_ADDRESS_BLOCK_BITS) {
+        return Ret_WrongType;
+    }
+
+    geometry -> page_data_size    = data_size;
+    geometry -> page_spare_size   = spare_size;
+    geometry -> pages_per_block   = pages_per_block;
+    geometry -> num_blocks        = blocks_per_die * num_dies;
+    geometry -> num_dies          = num_dies;
+    geometry -> num_planes        = 1 << plane_bits;
+    geometry -> plane_mask        = geometry -> num_planes - 1;
+    geometry -> programs_per_page = num_programs;
+
+    return Ret_Success;
+}
+
 /******************************************************************************
  *                              Feature Operations
  *****************************************************************************/
@@ -138,6 +238,7 @@ NAND_ReturnType NAND_Check_Busy(SPI_HandleTypeDef *hspi) {
     uint8_t status_reg;
     
     NAND_Get_Features(hspi, SPI_NAND_STATUS_REG_ADDR, &status_reg);
+    last_status = status_reg;
     if (CHECK_OIP(status_reg)) { // if OIP bit is set
         return Ret_NANDBusy;
     } else {
@@ -165,7 +266,7 @@ NAND_ReturnType NAND_Get_Features(SPI_HandleTypeDef *hspi, RegisterAddr reg_addr
     SPI_Params tx = { .buffer = command, .length = 2 };
     SPI_Params rx = { .buffer = reg,     .length = 1 };
 
-    NAND_SPI_ReturnType status = NAND_SPI_SendReceive(hspi, &tx, &rx);
+    NAND_SPI_ReturnType status = NAND_SPI_SendReceive(hspi, &tx, &rx, 1);
 
     if (status == SPI_OK) {
         return Ret_Success;
@@ -212,7 +313,23 @@ NAND_ReturnType NAND_Set_Features(SPI_HandleTypeDef *hspi, RegisterAddr reg_addr
 
 /**
     @brief Read bytes stored in a page.
-    @note Command sequence:
+    @note See NAND_Page_Read_Segments.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+*/
+NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length) {
+    SPI_Params segment = {.buffer = buffer, .length = length};
+
+    return NAND_Page_Read_Segments(hspi, addr, &segment, 1);
+}
+
+/**
+    @brief Read bytes stored in a page into several buffers.
+    @note Consecutive bytes starting at addr->colAddr fill the segments in order, e.g. data
+          into one buffer and spare into another, in a single cache read.
+          Command sequence:
             1) Send page read command to read data from page to cache
             2) Wait until OIP bit resets in status register
             3) Read data from cache
@@ -221,11 +338,24 @@ NAND_ReturnType NAND_Set_Features(SPI_HandleTypeDef *hspi, RegisterAddr reg_addr
     @retval Ret_ReadFailed
     @retval Ret_Success
 */
-NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length) {
-    
+NAND_ReturnType NAND_Page_Read_Segments(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments) {
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __page_read(hspi, addr, segments, num_segments);
+    NAND_TRACE_END(NAND_TRACE_PAGE_READ, trace_start, addr->block * NUM_PAGES_PER_BLOCK + addr->page,
+                   __segments_length(segments, num_segments), addr->colAddr & ((1 << COL_ADDRESS_BITS) - 1), status);
+    return status;
+}
+
+/* NAND_Page_Read_Segments without the trace record */
+NAND_ReturnType __page_read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments) {
+
     NAND_SPI_ReturnType status;
 
-    if (length > PAGE_SIZE) {
+    if (__segments_length(segments, num_segments) > PAGE_SIZE) {
+        return Ret_ReadFailed;
+    }
+
+    if (__select_die(hspi, addr) != Ret_Success) {
         return Ret_ReadFailed;
     }
 
@@ -238,23 +368,27 @@ NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uin
     status = NAND_SPI_Send(hspi, &tx_page_read);
 
     if (status != SPI_OK) {
+        __clock_track(hspi, 1);
         return Ret_ReadFailed;
     }
 
     /* Command 2: Wait for data to be loaded into cache */
-    if (NAND_Wait_Until_Ready(hspi) != Ret_Success) {
+    if (__wait_ready(hspi, T_RD_TYP_US, T_RD_MAX_US) != Ret_Success) {
         return Ret_ReadFailed;
     }
 
+    /* the status read while waiting also carries the ECC outcome of this page */
+    NAND_ECCResult ecc = __ecc_result(last_status);
+    ecc_counts[ecc]++;
+
     /* Command 3: READ FROM CACHE. See datasheet page 18 for details */
     uint32_t col = addr->colAddr;
     uint8_t command_cache_read[4] = {SPI_NAND_READ_CACHE_X1, (col >> 8), (col & 0xFF), DUMMY_BYTE};
 
     SPI_Params tx_cache_read = {.buffer = command_cache_read, .length = 4};
-    SPI_Params rx_cache_read = {.buffer = buffer, .length = length};
-    // TODO: Check if we can read just 2048 data bits per page. Datasheet shows 2176 bytes including the spare locations.  
 
-    status = NAND_SPI_SendReceive(hspi, &tx_cache_read, &rx_cache_read);
+    status = NAND_SPI_SendReceive(hspi, &tx_cache_read, segments, num_segments);
+    __clock_track(hspi, status != SPI_OK || ecc == ECC_UNCORRECTABLE);
 
     if (status != SPI_OK) {
         return Ret_ReadFailed;
@@ -263,6 +397,83 @@ NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uin
     return Ret_Success;
 }
 
+/**
+    @brief Reads parts of several pages in one call, pipelining the page reads.
+    @note Requests are served by die, plane, block and page, whatever their order in the
+          array; requests for the same page share one array read, with a cache read each.
+          The pages of one die and plane form a chain: READ PAGE CACHE RANDOM moves the page
+          read before into the cache register and loads the next one from the array while
+          the previous one is shifted out, and READ PAGE CACHE LAST ends the chain. A page
+          then costs its transfer plus tRCBSY instead of a separate tRD wait and status
+          polling. The status of every request is set: Ret_AddressInvalid if it runs past
+          the end of the page, Ret_ReadFailed if it could not be read, else Ret_Success.
+          The order is kept in the nand_pool arena, 2 bytes per request.
+
+    @return NAND_ReturnType
+    @retval Ret_MemoryOverflow: no room in the arena for the order; nothing was read
+    @retval Ret_ReadFailed: at least one request did not succeed, see their status
+    @retval Ret_Success
+*/
+NAND_ReturnType NAND_Page_Read_Batch(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t count) {
+    uint16_t arena_mark = __pool_mark();
+    uint16_t *order = __pool_alloc(count * sizeof(uint16_t));
+    uint16_t num_valid = 0;
+    NAND_ReturnType status = Ret_Success;
+
+    if (order == NULL) {
+        for (uint16_t i = 0; i < count; i++) {
+            requests[i].status = Ret_MemoryOverflow;
+        }
+        return Ret_MemoryOverflow;
+    }
+
+    /* insertion sort, stable so that the requests of a page are read in the given order */
+    for (uint16_t i = 0; i < count; i++) {
+        int32_t column = requests[i].addr.colAddr & ((1 << COL_ADDRESS_BITS) - 1);
+        if (requests[i].length > PAGE_SIZE - column) {
+            requests[i].status = Ret_AddressInvalid;
+            continue;
+        }
+        requests[i].status = Ret_Success;
+
+        uint16_t j = num_valid++;
+        while (j > 0 && __batch_before(&requests[i].addr, &requests[order[j - 1]].addr)) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (uint16_t first = 0, end; first < num_valid; first = end) {
+        PhysicalAddrs *addr = &requests[order[first]].addr;
+        for (end = first + 1; end < num_valid; end++) {
+            if (requests[order[end]].addr.die != addr->die || requests[order[end]].addr.plane != addr->plane) {
+                break;
+            }
+        }
+        __batch_chain(hspi, requests, &order[first], end - first);
+    }
+    __pool_reset(arena_mark);
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (requests[i].status != Ret_Success) {
+            status = Ret_ReadFailed;
+        }
+    }
+    return status;
+}
+
+/**
+    @brief Copies the number of page reads since power on for each on-die ECC outcome.
+    @note Counted from the status register read while waiting for each page read, so
+          keeping count costs no extra SPI transfers.
+*/
+void NAND_Get_ECC_Counts(uint32_t counts[NUM_ECC_RESULTS]) {
+    for (uint8_t i = 0; i < NUM_ECC_RESULTS; i++) {
+        counts[i] = ecc_counts[i];
+    }
+}
+
 
 /******************************************************************************
  *                              Write Operations
@@ -276,7 +487,22 @@ NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uin
  */
 /**
     @brief Write data to a page.
-    @note Command sequence:
+    @note See NAND_Page_Program_Segments.
+    @return
+    @retval
+*/
+NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length) {
+    SPI_Params segment = {.buffer = buffer, .length = length};
+
+    return NAND_Page_Program_Segments(hspi, addr, &segment, 1);
+}
+
+/**
+    @brief Write data gathered from several buffers to a page.
+    @note The segments are loaded back to back starting at addr->colAddr, in one PROGRAM LOAD
+          transaction; together they may cover the spare area (up to PAGE_SIZE bytes).
+          Bytes not loaded stay 0xFF.
+          Command sequence:
             1) WRITE ENABLE
             2) PROGRAM LOAD : load data into cache register
             3) PROGRAM EXECUTE : transfers data from cache to main array and waits until OIP bit is cleared
@@ -284,11 +510,24 @@ NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uin
     @return
     @retval
 */
-NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length) {
+NAND_ReturnType NAND_Page_Program_Segments(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments) {
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __page_program(hspi, addr, segments, num_segments);
+    NAND_TRACE_END(NAND_TRACE_PAGE_PROGRAM, trace_start, addr->block * NUM_PAGES_PER_BLOCK + addr->page,
+                   __segments_length(segments, num_segments), addr->colAddr & ((1 << COL_ADDRESS_BITS) - 1), status);
+    return status;
+}
+
+/* NAND_Page_Program_Segments without the trace record */
+NAND_ReturnType __page_program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments) {
 
     NAND_SPI_ReturnType status;
 
-    if (length > PAGE_DATA_SIZE) {
+    if (__segments_length(segments, num_segments) > PAGE_SIZE) {
+        return Ret_ProgramFailed;
+    }
+
+    if (__select_die(hspi, addr) != Ret_Success) {
         return Ret_ProgramFailed;
     }
 
@@ -300,10 +539,8 @@ NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr,
     uint8_t command_load[3] = {SPI_NAND_PROGRAM_LOAD_X1, (col >> 8), (col & 0xFF)};
 
     SPI_Params tx_cmd = {.buffer = command_load, .length = 3};
-    SPI_Params tx_data = {.buffer = buffer, .length = PAGE_DATA_SIZE}; 
-    // TODO: Check if we can write just 2048 data bits per page. Datasheet shows 2176 bytes including the spare locations.  
 
-    status = NAND_SPI_Send_Command_Data(hspi, &tx_cmd, &tx_data);
+    status = NAND_SPI_Send_Command_Data(hspi, &tx_cmd, segments, num_segments);
 
     if (status != SPI_OK) {
         return Ret_ProgramFailed;
@@ -322,18 +559,50 @@ NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr,
     }
 
     /* Make sure the device is ready and then disable writes. */
-    if (NAND_Wait_Until_Ready(hspi) != Ret_Success) {
+    if (__wait_ready(hspi, T_PROG_TYP_US, T_PROG_MAX_US) != Ret_Success) {
         return Ret_ProgramFailed;
     }
+    uint8_t program_failed = last_status & SPI_NAND_PF;
 
     /* Command 4: WRITE DISABLE */
     __write_disable(hspi);
 
-    // TODO: check program fail bit in status register and return that. 
+    /* P_FAIL: the program failed, or the block is locked */
+    if (program_failed) {
+        return Ret_ProgramFailed;
+    }
 
     return Ret_Success;
 }
 
+/**
+    @brief Programs length bytes at addr->colAddr into a page that has already been programmed,
+           leaving the rest of it as it is.
+    @note Partial page programming: the range is padded with 0xFF to whole ECC sectors, which
+          must still be erased (see NAND_ECC_SECTOR_SIZE), and the page can be programmed at
+          most NUM_PROGRAMS_PER_PAGE times between erases. programs holds how many times the
+          page has been programmed so far; it is checked and then incremented.
+          PROGRAM LOAD resets the whole cache register to 0xFF before loading the range, so
+          the padding needs no transfer and every other sector is programmed with 0xFF, which
+          leaves it unchanged. PROGRAM LOAD RANDOM keeps the cache contents instead, which
+          after a page read are that page's data, so it is not used here.
+
+    @return NAND_ReturnType
+    @retval Ret_ProgramFailed: range outside the data area, or no programs left for the page
+    @retval Return values of NAND_Page_Program_Segments
+*/
+NAND_ReturnType NAND_Page_Append(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length, uint8_t *programs) {
+    uint32_t column = addr->colAddr & ((1 << COL_ADDRESS_BITS) - 1);
+    SPI_Params segment = {.buffer = buffer, .length = length};
+
+    if (length == 0 || column + length > PAGE_DATA_SIZE || *programs >= NUM_PROGRAMS_PER_PAGE) {
+        return Ret_ProgramFailed;
+    }
+
+    (*programs)++;
+    return NAND_Page_Program_Segments(hspi, addr, &segment, 1);
+}
+
 
 /******************************************************************************
  *                              Erase Operations
@@ -359,13 +628,26 @@ NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr,
     @retval
 */
 NAND_ReturnType NAND_Block_Erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr) {
+    uint32_t trace_start = NAND_TRACE_START();
+    NAND_ReturnType status = __block_erase(hspi, addr);
+    NAND_TRACE_END(NAND_TRACE_BLOCK_ERASE, trace_start, addr->block * NUM_PAGES_PER_BLOCK, 0, 0, status);
+    return status;
+}
+
+/* NAND_Block_Erase without the trace record */
+NAND_ReturnType __block_erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr) {
+
+    if (__select_die(hspi, addr) != Ret_Success) {
+        return Ret_EraseFailed;
+    }
 
     /* Command 1: WRITE ENABLE */
     __write_enable(hspi);
 
     /* Command 2: BLOCK ERASE. See datasheet page 35 for details */
-    uint32_t block = addr->block; // TODO: datasheet simply specifies block address. assuming that's the 11-bit block number padded with dummy bits. check.
-    uint8_t command[4] = {SPI_NAND_BLOCK_ERASE, (block >> 16), (block >> 8), (block & 0xFF)};
+    /* Takes the same 24-bit row address as page operations; the page bits are ignored. */
+    uint32_t row = addr->rowAddr;
+    uint8_t command[4] = {SPI_NAND_BLOCK_ERASE, (row >> 16), (row >> 8), (row & 0xFF)};
 
     SPI_Params tx_cmd = {.buffer = command, .length = 4};
     if (NAND_SPI_Send(hspi, &tx_cmd) != SPI_OK) {
@@ -373,20 +655,212 @@ NAND_ReturnType NAND_Block_Erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr) {
     }
 
     /* Command 3: wait for device to be ready again */
-    if (NAND_Wait_Until_Ready(hspi) != Ret_Success) {
+    if (__wait_ready(hspi, T_BERS_TYP_US, T_BERS_MAX_US) != Ret_Success) {
         return Ret_EraseFailed;
     }
+    uint8_t erase_failed = last_status & SPI_NAND_EF;
 
     /* Command 4: WRITE DISABLE */
     __write_disable(hspi);
 
-    // TODO: check erase fail bit in status register and return that
+    /* E_FAIL: the erase failed, or the block is locked */
+    if (erase_failed) {
+        return Ret_EraseFailed;
+    }
 
     return Ret_Success;
 
 }
 
 
+/******************************************************************************
+ *                              Bulk Programming
+ *****************************************************************************/
+
+/**
+    @brief Programs a raw image, as built by tools/nand_image, onto num_blocks blocks
+           starting at first_block.
+    @note The image holds PAGE_SIZE bytes (data, then spare) for every page of every block,
+          and source is called once per page for the next one. page is a PAGE_SIZE buffer
+          for it. Each good block is erased first. Pages that are all 0xFF are skipped.
+          On-die ECC must stay enabled (the power-on default): the image leaves the ECC
+          parity bytes erased and the device fills them in.
+
+          Blocks are erased and pages programmed as by NAND_Block_Erase and
+          NAND_Page_Program_Segments, one PROGRAM LOAD per page, without a trace record for
+          each. Factory bad blocks are skipped; their part of the image must be empty, i.e.
+          the image was built with this device's bad block table.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid
+    @retval Ret_Failed: the image has data for a block that is bad on this device
+    @retval Ret_ReadFailed: source failed, or the bad block mark could not be read
+    @retval Ret_EraseFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+*/
+NAND_ReturnType NAND_Image_Program(SPI_HandleTypeDef *hspi, uint16_t first_block, uint16_t num_blocks, uint8_t *page, NAND_ImageSource source, void *context) {
+    PhysicalAddrs addr;
+    SPI_Params segment = {.buffer = page, .length = PAGE_SIZE};
+    uint8_t bad_block_byte;
+
+    if (first_block + num_blocks > NUM_BLOCKS) {
+        return Ret_AddressInvalid;
+    }
+
+    for (uint16_t block = first_block; block < first_block + num_blocks; block++) {
+        __block_address(block, 0, BAD_BLOCK_BYTE, &addr);
+        if (NAND_Page_Read(hspi, &addr, &bad_block_byte, 1) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        uint8_t bad = (bad_block_byte != 0xFF);
+
+        if (!bad && __block_erase(hspi, &addr) != Ret_Success) {
+            return Ret_EraseFailed;
+        }
+
+        for (uint16_t page_num = 0; page_num < NUM_PAGES_PER_BLOCK; page_num++) {
+            if (source(context, page) != Ret_Success) {
+                return Ret_ReadFailed;
+            }
+
+            uint16_t i = 0;
+            while (i < PAGE_SIZE && page[i] == 0xFF) {
+                i++;
+            }
+            if (i == PAGE_SIZE) {
+                continue;
+            }
+            if (bad) {
+                return Ret_Failed;
+            }
+
+            __block_address(block, page_num, 0, &addr);
+            if (__page_program(hspi, &addr, &segment, 1) != Ret_Success) {
+                return Ret_ProgramFailed;
+            }
+        }
+    }
+
+    return Ret_Success;
+}
+
+
+/******************************************************************************
+ *                           SPI Clock Calibration
+ *****************************************************************************/
+
+/**
+    @brief Raises the SPI clock to the fastest setting that transfers reliably, less a margin.
+    @note Starting from the reference setting (NAND_SPI_CLOCK_SLOWEST), each faster setting
+          must pass NAND_CLOCK_PASSES checks in a row: READ ID returns the ID read at the
+          reference setting, and page 0 of block reads back a known pattern. The search stops
+          at the first failure. The clock then settles NAND_CLOCK_MARGIN steps below the
+          fastest passing setting, plus one step for every recalibration requested because of
+          failed reads (see NAND_Clock_Calibration_Pending).
+
+          block is reserved for the pattern, which is written at the reference setting when
+          it does not read back; that costs a block erase and a page program the first time.
+          page is a PAGE_DATA_SIZE buffer. The search takes about as long as
+          2 * NAND_CLOCK_PASSES page reads at the reference setting. On failure the clock is
+          left at the reference setting.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid: block does not exist or is bad
+    @retval Ret_Failed: the SPI clock could not be changed
+    @retval Ret_EraseFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_ReadFailed: the pattern does not read back even at the reference setting
+    @retval Ret_Success
+*/
+NAND_ReturnType NAND_Calibrate_Clock(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *page) {
+    PhysicalAddrs addr;
+    NAND_ID reference_ID;
+    uint8_t fastest = NAND_SPI_CLOCK_SLOWEST;
+    NAND_ReturnType status;
+
+    if (block >= NUM_BLOCKS) {
+        return Ret_AddressInvalid;
+    }
+
+    /* the previous setting had too many failed reads despite its margin */
+    if (clock_recalibrate && clock_margin < NAND_SPI_CLOCK_SLOWEST) {
+        clock_margin++;
+    }
+    clock_recalibrate = 0;
+    window_reads = 0;
+    window_errors = 0;
+
+    if (NAND_SPI_Set_Clock(hspi, NAND_SPI_CLOCK_SLOWEST) != SPI_OK) {
+        return Ret_Failed;
+    }
+    clock_step = NAND_SPI_CLOCK_SLOWEST;
+    clock_calibrating = 1;
+
+    NAND_Read_ID(hspi, &reference_ID);
+    __block_address(block, 0, 0, &addr);
+    status = __clock_check(hspi, &addr, &reference_ID, page);
+    if (status != Ret_Success) {
+        status = __clock_write_pattern(hspi, block, page);
+        if (status == Ret_Success) {
+            status = __clock_check(hspi, &addr, &reference_ID, page);
+        }
+    }
+
+    while (status == Ret_Success && fastest > 0) {
+        uint8_t passes = 0;
+
+        if (NAND_SPI_Set_Clock(hspi, fastest - 1) != SPI_OK) {
+            status = Ret_Failed;
+            break;
+        }
+        while (passes < NAND_CLOCK_PASSES && __clock_check(hspi, &addr, &reference_ID, page) == Ret_Success) {
+            passes++;
+        }
+        if (passes < NAND_CLOCK_PASSES) {
+            break;
+        }
+        fastest--;
+    }
+
+    clock_calibrating = 0;
+    if (status == Ret_Success) {
+        clock_step = (fastest + clock_margin < NAND_SPI_CLOCK_SLOWEST) ? fastest + clock_margin : NAND_SPI_CLOCK_SLOWEST;
+    }
+    if (NAND_SPI_Set_Clock(hspi, clock_step) != SPI_OK) {
+        clock_step = NAND_SPI_CLOCK_SLOWEST;
+        NAND_SPI_Set_Clock(hspi, clock_step);
+        return Ret_Failed;
+    }
+
+    /* a command garbled at a failing setting must not leave writes enabled */
+    __write_disable(hspi);
+
+    return status;
+}
+
+/**
+    @brief Returns the SPI clock step in use (0 is the fastest).
+    @note NAND_SPI_CLOCK_SLOWEST, the reference setting, until NAND_Calibrate_Clock is called.
+*/
+uint8_t NAND_Get_Clock_Step(void) {
+    return clock_step;
+}
+
+/**
+    @brief Tells whether failed page reads slowed the SPI clock down since the last calibration.
+    @note Once NAND_CLOCK_ERROR_LIMIT of NAND_CLOCK_WINDOW page reads fail (SPI error or
+          uncorrectable ECC), the clock drops one step right away. Worn pages are not told
+          apart from transfer errors, so this only ever makes the clock more conservative.
+          Call NAND_Calibrate_Clock between operations to settle on a new setting.
+
+    @return 1 if NAND_Calibrate_Clock should be called again, 0 otherwise.
+*/
+uint8_t NAND_Clock_Calibration_Pending(void) {
+    return clock_recalibrate;
+}
+
+
 /******************************************************************************
  *                              Move Operations
  *****************************************************************************/
@@ -425,3 +899,291 @@ NAND_SPI_ReturnType __write_disable(SPI_HandleTypeDef *hspi) {
     SPI_Params transmit = { .buffer = &command, .length = 1 };
     return NAND_SPI_Send(hspi, &transmit);
 }
+
+/* total number of bytes described by a scatter-gather list */
+uint32_t __segments_length(SPI_Params *segments, uint8_t num_segments) {
+    uint32_t length = 0;
+    for (uint8_t i = 0; i < num_segments; i++) {
+        length += segments[i].length;
+    }
+    return length;
+}
+
+/* decodes the ECC status bits; reserved codes are counted as uncorrectable */
+NAND_ECCResult __ecc_result(uint8_t status_reg) {
+    switch ((status_reg & SPI_NAND_ECC) >> 4) {
+        case 0x0: return ECC_NO_ERRORS;
+        case 0x1: return ECC_CORRECTED_1_3;
+        case 0x3: return ECC_CORRECTED_4_6;
+        case 0x5: return ECC_CORRECTED_7_8;
+        default:  return ECC_UNCORRECTABLE;
+    }
+}
+
+/* physical address of a page of a block, starting at column */
+void __block_address(uint16_t block, uint16_t page, uint16_t column, PhysicalAddrs *addr) {
+    uint16_t die_block = block & ((1 << DIE_BLOCK_BITS) - 1);
+
+    addr->die     = block >> DIE_BLOCK_BITS;
+    addr->plane   = die_block & PLANE_MASK;
+    addr->block   = block;
+    addr->page    = page;
+    addr->rowAddr = ((uint32_t) die_block << ROW_ADDRESS_PAGE_BITS) | page;
+    addr->colAddr = ((uint32_t) (die_block & PLANE_MASK) << COL_ADDRESS_BITS) | column;
+}
+
+/**
+    @brief Waits for the array operation in progress to end, releasing the CPU meanwhile.
+    @note Sleeps through typical_us, the typical duration of the operation, then polls the
+          status register every NAND_POLL_INTERVAL_US until OIP clears. Gives up once max_us
+          plus NAND_WAIT_SLACK_US have passed. The final status is left in last_status.
+
+    @return NAND_ReturnType
+    @retval Ret_NANDBusy
+    @retval Ret_Success
+*/
+NAND_ReturnType __wait_ready(SPI_HandleTypeDef *hspi, uint32_t typical_us, uint32_t max_us) {
+    uint32_t start = NAND_OS_Time_us();
+
+    if (typical_us > 0) {
+        NAND_OS_Sleep_us(typical_us);
+    }
+    while (NAND_Check_Busy(hspi) != Ret_Success) {
+        if (NAND_OS_Time_us() - start > max_us + NAND_WAIT_SLACK_US) {
+            return Ret_NANDBusy;
+        }
+        NAND_OS_Sleep_us(NAND_POLL_INTERVAL_US);
+    }
+    return Ret_Success;
+}
+
+/* byte of the calibration pattern at column: alternating bits, walking ones, walking
+ * zeros and pseudo-random bytes, a quarter of the page each */
+uint8_t __clock_pattern(uint16_t column) {
+    switch (column / (PAGE_DATA_SIZE / 4)) {
+        case 0:  return (column & 1) ? 0xAA : 0x55;
+        case 1:  return 1 << (column & 7);
+        case 2:  return ~(1 << (column & 7));
+        default: return ((uint32_t) column * 0x9E3779B1UL) >> 24;
+    }
+}
+
+/* one calibration check at the current clock: READ ID and the pattern page both read back intact */
+NAND_ReturnType __clock_check(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, NAND_ID *reference_ID, uint8_t *page) {
+    NAND_ID nand_ID;
+
+    NAND_Read_ID(hspi, &nand_ID);
+    if (nand_ID.manufacturer_ID != reference_ID->manufacturer_ID || nand_ID.device_ID != reference_ID->device_ID) {
+        return Ret_WrongID;
+    }
+
+    if (NAND_Page_Read(hspi, addr, page, PAGE_DATA_SIZE) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+    for (uint16_t i = 0; i < PAGE_DATA_SIZE; i++) {
+        if (page[i] != __clock_pattern(i)) {
+            return Ret_ReadFailed;
+        }
+    }
+    return Ret_Success;
+}
+
+/* erases block and programs the calibration pattern into its first page, unless the block is bad */
+NAND_ReturnType __clock_write_pattern(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *page) {
+    PhysicalAddrs addr;
+    uint8_t bad_block_byte;
+
+    __block_address(block, 0, BAD_BLOCK_BYTE, &addr);
+    if (NAND_Page_Read(hspi, &addr, &bad_block_byte, 1) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+    if (bad_block_byte != 0xFF) {
+        return Ret_AddressInvalid;
+    }
+
+    for (uint16_t i = 0; i < PAGE_DATA_SIZE; i++) {
+        page[i] = __clock_pattern(i);
+    }
+
+    __block_address(block, 0, 0, &addr);
+    if (NAND_Block_Erase(hspi, &addr) != Ret_Success) {
+        return Ret_EraseFailed;
+    }
+    return NAND_Page_Program(hspi, &addr, page, PAGE_DATA_SIZE);
+}
+
+/* counts a page read towards the failure rate at the current clock; too many failures drop
+ * the clock one step and request a recalibration */
+void __clock_track(SPI_HandleTypeDef *hspi, uint8_t failed) {
+    if (clock_calibrating) {
+        return;
+    }
+
+    window_reads++;
+    window_errors += failed;
+    if (window_errors >= NAND_CLOCK_ERROR_LIMIT) {
+        if (clock_step < NAND_SPI_CLOCK_SLOWEST && NAND_SPI_Set_Clock(hspi, clock_step + 1) == SPI_OK) {
+            clock_step++;
+            clock_recalibrate = 1;
+        }
+        window_reads = 0;
+        window_errors = 0;
+    } else if (window_reads >= NAND_CLOCK_WINDOW) {
+        window_reads = 0;
+        window_errors = 0;
+    }
+}
+
+/**
+    @brief Points the die select register at addr->die if another die is selected.
+    @note Compiles to nothing for single die parts.
+*/
+NAND_ReturnType __select_die(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr) {
+    if (NUM_DIES == 1 || addr->die == selected_die) {
+        return Ret_Success;
+    }
+    if (NAND_Set_Features(hspi, SPI_NAND_DIE_SEL_REG_ADDR, addr->die ? SPI_NAND_DS0 : 0) != Ret_Success) {
+        return Ret_Failed;
+    }
+    selected_die = addr->die;
+    return Ret_Success;
+}
+
+/* ONFI CRC-16 over the first 254 bytes of the parameter page: polynomial 0x8005, initial value 0x4F4E */
+uint16_t __param_page_crc(uint8_t *param_page) {
+    uint16_t crc = 0x4F4E;
+    for (uint8_t i = 0; i < PARAM_PAGE_SIZE - 2; i++) {
+        crc ^= (uint16_t) param_page[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* 1 if page a is read before page b in a batch: by die, plane, then row */
+uint8_t __batch_before(PhysicalAddrs *a, PhysicalAddrs *b) {
+    if (a->die != b->die) {
+        return a->die < b->die;
+    }
+    if (a->plane != b->plane) {
+        return a->plane < b->plane;
+    }
+    return a->rowAddr < b->rowAddr;
+}
+
+/* sends a command that loads a page towards the cache register and waits for it; addr is
+ * NULL for READ PAGE CACHE LAST, which takes no address */
+NAND_ReturnType __batch_load(SPI_HandleTypeDef *hspi, uint8_t command, PhysicalAddrs *addr, uint32_t typical_us, uint32_t max_us) {
+    uint32_t row = (addr != NULL) ? addr->rowAddr : 0;
+    uint8_t command_load[4] = {command, (row >> 16), (row >> 8), (row & 0xFF)};
+
+    SPI_Params tx_load = {.buffer = command_load, .length = (addr != NULL) ? 4 : 1};
+
+    if (NAND_SPI_Send(hspi, &tx_load) != SPI_OK) {
+        __clock_track(hspi, 1);
+        return Ret_ReadFailed;
+    }
+    if (__wait_ready(hspi, typical_us, max_us) != Ret_Success) {
+        return Ret_ReadFailed;
+    }
+    return Ret_Success;
+}
+
+/* reads the requests order[0..count) of the page in the cache register out of it, and
+ * records the page read, which started at start */
+void __batch_output(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t *order, uint16_t count, uint32_t start) {
+    NAND_ECCResult ecc = __ecc_result(last_status);
+    uint32_t length = 0;
+    uint8_t failed = 0;
+
+    ecc_counts[ecc]++;
+
+    for (uint16_t i = 0; i < count; i++) {
+        NAND_ReadRequest *request = &requests[order[i]];
+        uint32_t col = request->addr.colAddr;
+        uint8_t command_cache_read[4] = {SPI_NAND_READ_CACHE_X1, (col >> 8), (col & 0xFF), DUMMY_BYTE};
+
+        SPI_Params tx_cache_read = {.buffer = command_cache_read, .length = 4};
+        SPI_Params rx = {.buffer = request->buffer, .length = request->length};
+
+        if (NAND_SPI_SendReceive(hspi, &tx_cache_read, &rx, 1) != SPI_OK) {
+            request->status = Ret_ReadFailed;
+            failed = 1;
+        }
+        length += request->length;
+    }
+    __clock_track(hspi, failed || ecc == ECC_UNCORRECTABLE);
+
+    NAND_TRACE_END(NAND_TRACE_PAGE_READ, start,
+                   requests[order[0]].addr.block * NUM_PAGES_PER_BLOCK + requests[order[0]].addr.page, length,
+                   requests[order[0]].addr.colAddr & ((1 << COL_ADDRESS_BITS) - 1), failed ? Ret_ReadFailed : Ret_Success);
+}
+
+/* marks the requests order[0..count) of a page that could not be read */
+void __batch_fail(NAND_ReadRequest *requests, uint16_t *order, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        requests[order[i]].status = Ret_ReadFailed;
+    }
+}
+
+/**
+    @brief Reads the requests order[0..count), sorted and all on one die and plane, as one
+           chain of cache reads. See NAND_Page_Read_Batch.
+    @note A page alone is read with PAGE READ. After a failed step the chain starts over
+          with a PAGE READ of the next page.
+*/
+void __batch_chain(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t *order, uint16_t count) {
+    uint16_t next = 0;              // first request of the next page to load
+    uint16_t loaded = 0;            // first request of the page loaded before it
+    uint16_t num_loaded = 0;        // requests of that page, 0 at the start of a chain
+    uint32_t loaded_start = 0;
+
+    if (__select_die(hspi, &requests[order[0]].addr) != Ret_Success) {
+        __batch_fail(requests, order, count);
+        return;
+    }
+
+    while (next < count) {
+        uint16_t num = 1;
+        while (next + num < count && requests[order[next + num]].addr.rowAddr == requests[order[next]].addr.rowAddr) {
+            num++;
+        }
+        uint32_t start = NAND_TRACE_START();
+
+        if (num_loaded == 0) {
+            if (__batch_load(hspi, SPI_NAND_PAGE_READ, &requests[order[next]].addr, T_RD_TYP_US, T_RD_MAX_US) != Ret_Success) {
+                __batch_fail(requests, &order[next], num);
+            } else if (next + num == count) {
+                __batch_output(hspi, requests, &order[next], num, start);
+            } else {
+                loaded       = next;
+                num_loaded   = num;
+                loaded_start = start;
+            }
+            next += num;
+            continue;
+        }
+
+        /* the page before waits for its array read to finish, then moves to the cache register */
+        if (__batch_load(hspi, SPI_NAND_READ_PAGE_CACHE_RANDOM, &requests[order[next]].addr,
+                         T_RCBSY_TYP_US, T_RD_MAX_US + T_RCBSY_MAX_US) != Ret_Success) {
+            __batch_fail(requests, &order[loaded], num_loaded);
+            num_loaded = 0;
+            continue;
+        }
+        __batch_output(hspi, requests, &order[loaded], num_loaded, loaded_start);
+        loaded       = next;
+        num_loaded   = num;
+        loaded_start = start;
+        next += num;
+    }
+
+    if (num_loaded > 0) {
+        if (__batch_load(hspi, SPI_NAND_READ_PAGE_CACHE_LAST, NULL, T_RCBSY_TYP_US, T_RD_MAX_US + T_RCBSY_MAX_US) != Ret_Success) {
+            __batch_fail(requests, &order[loaded], num_loaded);
+        } else {
+            __batch_output(hspi, requests, &order[loaded], num_loaded, loaded_start);
+        }
+    }
+}
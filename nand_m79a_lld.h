@@ -22,6 +22,9 @@
 
 ********************************************************************************/
 
+#ifndef NAND_M79A_LLD_H
+#define NAND_M79A_LLD_H
+
 #include "nand_spi.h"
 
 /* Functions Return Codes */
@@ -31,9 +34,9 @@ typedef enum {
     Ret_ResetFailed,
     Ret_WrongID,
     Ret_NANDBusy,
-    // Ret_AddressInvalid,
+    Ret_AddressInvalid,
     Ret_RegAddressInvalid,
-    // Ret_MemoryOverflow,
+    Ret_MemoryOverflow,
     // Ret_BlockEraseFailed,
     // Ret_PageNrInvalid,
     // Ret_SubSectorNrInvalid,
@@ -52,13 +55,29 @@ typedef enum {
     // Ret_SectorLocked,
     // Ret_SectorUnlocked,
     // Ret_SectorLockDownFailed,
-    Ret_WrongType
+    Ret_WrongType,
+    Ret_PageNotMapped,
+    Ret_CorruptData
 } NAND_ReturnType;
 
-/* List of supported devices */
-#define MT29F2G01ABAGD
+/* List of supported devices. Define exactly one.
+ *
+ * Naming a part builds the driver for that part only: its geometry is a set of constants
+ * and address translation compiles down to fixed shifts and masks. NAND_AUTODETECT builds
+ * one image for every part below; NAND_Init then reads the geometry from the parameter
+ * page into nand_geometry and addresses are translated with the shifts and masks stored
+ * there. All of these parts share the page and block layout, only the block count, the
+ * number of planes and the number of dies differ. */
+// #define MT29F1G01ABAFD                           /* 1 Gb: 1024 blocks, 1 plane */
+#define MT29F2G01ABAGD                              /* 2 Gb: 2048 blocks, 2 planes */
+// #define MT29F4G01ADAGD                           /* 4 Gb: 2 dies of 2048 blocks, 2 planes */
+// #define NAND_AUTODETECT
+
+#if (defined(MT29F1G01ABAFD) + defined(MT29F2G01ABAGD) + defined(MT29F4G01ADAGD) + defined(NAND_AUTODETECT)) > 1
+    #error "Define only one supported device, or NAND_AUTODETECT"
+#endif
 
-#ifdef MT29F2G01ABAGD
+#if defined(MT29F1G01ABAFD) || defined(MT29F2G01ABAGD) || defined(MT29F4G01ADAGD) || defined(NAND_AUTODETECT)
 
     /* device ID */
     typedef struct {
@@ -66,19 +85,82 @@ typedef enum {
         uint8_t device_ID;
     } NAND_ID;
     #define NAND_ID_MANUFACTURER    0x2C
-    #define NAND_ID_DEVICE          0x24
+
+    /* Geometry descriptor. Constant when a part is named above, read from the parameter
+     * page at NAND_Init with NAND_AUTODETECT. */
+    typedef struct {
+        uint16_t page_data_size;        // data bytes per page
+        uint16_t page_spare_size;       // spare bytes per page
+        uint16_t pages_per_block;
+        uint16_t num_blocks;            // blocks across all dies
+        uint8_t  num_dies;
+        uint8_t  num_planes;
+        uint8_t  programs_per_page;     // partial page programs allowed between erases (NOP)
+        /* derived for address translation */
+        uint8_t  die_block_bits;        // log2(blocks per die)
+        uint16_t plane_mask;            // num_planes - 1
+    } NAND_Geometry;
+    extern NAND_Geometry nand_geometry;
 
     /* device details, see Memory Mapping (Datasheet page 11) */
     #define FLASH_WIDTH             8               /* Flash data width */
-    #define FLASH_SIZE_BYTES        0x10000000      /* Flash size in bytes */
-    #define NUM_BLOCKS              2048            /* Total number of blocks in the device*/
     #define NUM_PAGES_PER_BLOCK     64              /* Number of pages per block*/
     #define PAGE_SIZE               2176            /* Page size in bytes */
     #define PAGE_DATA_SIZE          2048            /* Page data size in bytes */
     #define PAGE_SPARE_SIZE         128             /* Page spare size in bytes*/
+    #define PAGE_DATA_BITS          11              /* log2(PAGE_DATA_SIZE) */
+
+    #if defined(MT29F1G01ABAFD)
+        #define NAND_ID_DEVICE          0x14
+        #define NUM_BLOCKS              1024        /* Total number of blocks in the device*/
+        #define NUM_DIES                1
+        #define DIE_BLOCK_BITS          10          /* log2(blocks per die) */
+        #define PLANE_MASK              0
+        #define NUM_PROGRAMS_PER_PAGE   4
+    #elif defined(MT29F2G01ABAGD)
+        #define NAND_ID_DEVICE          0x24
+        #define NUM_BLOCKS              2048
+        #define NUM_DIES                1
+        #define DIE_BLOCK_BITS          11
+        #define PLANE_MASK              1
+        #define NUM_PROGRAMS_PER_PAGE   4
+    #elif defined(MT29F4G01ADAGD)
+        #define NAND_ID_DEVICE          0x36
+        #define NUM_BLOCKS              4096
+        #define NUM_DIES                2
+        #define DIE_BLOCK_BITS          11
+        #define PLANE_MASK              1
+        #define NUM_PROGRAMS_PER_PAGE   4
+    #else
+        #define NUM_BLOCKS              (nand_geometry.num_blocks)
+        #define NUM_DIES                (nand_geometry.num_dies)
+        #define DIE_BLOCK_BITS          (nand_geometry.die_block_bits)
+        #define PLANE_MASK              (nand_geometry.plane_mask)
+        #define NUM_PROGRAMS_PER_PAGE   (nand_geometry.programs_per_page)
+    #endif
+
+    #define FLASH_SIZE_BYTES        ((uint32_t) NUM_BLOCKS * NUM_PAGES_PER_BLOCK * PAGE_DATA_SIZE)
+
+    /* Parameter page (ONFI layout), read with CFG set to SPI_NAND_CFG_PARAM_PAGE */
+    #define PARAM_PAGE_ROW              0x01
+    #define PARAM_PAGE_SIZE             256
+    #define PARAM_PAGE_COPIES           3
 
     #define BAD_BLOCK_BYTE          PAGE_DATA_SIZE
-    #define BAD_BLOCK_VALUE         0x00;
+    #define BAD_BLOCK_VALUE         0x00
+
+    /* Spare area usage. Byte 0 holds the bad-block mark and is never written by software.
+     * The upper half of the spare area holds the on-die ECC parity. */
+    #define SPARE_USER_OFFSET       4               /* first spare byte free for software metadata */
+    #define SPARE_USER_SIZE         60              /* spare bytes free for software metadata */
+
+    /* On-die ECC protects the data area in sectors, each together with NAND_ECC_SPARE_SIZE
+     * bytes of the spare area (sector n: PAGE_DATA_SIZE + n * NAND_ECC_SPARE_SIZE). Parity is
+     * set when a sector is programmed, so a sector takes one program between erases; a sector
+     * programmed all 0xFF still reads as erased. See NAND_Page_Append. */
+    #define NAND_ECC_SECTOR_SIZE    512
+    #define NAND_ECC_SECTORS        (PAGE_DATA_SIZE / NAND_ECC_SECTOR_SIZE)
+    #define NAND_ECC_SPARE_SIZE     16
 
     /*
     Page data only:
@@ -95,23 +177,25 @@ typedef enum {
     /* ADDRESSING DEFINITIONS (see Datasheet page 11) */
     typedef uint32_t NAND_Addr; // logical address type. Max FLASH_SIZE_BYTES
 
-    #define ROW_ADDRESS_BLOCK_BITS   11
+    #define ROW_ADDRESS_BLOCK_BITS   11                 // within one die
     #define ROW_ADDRESS_PAGE_BITS    6
     #define ROW_ADDRESS_BITS         24
     #define COL_ADDRESS_BITS         12
     typedef struct {
-        uint16_t plane       : 1;                       // 1 bit to specify plane number
-        uint16_t block       : ROW_ADDRESS_BLOCK_BITS;  // block number
-        uint16_t page        : ROW_ADDRESS_PAGE_BITS;   // page number
-        uint32_t rowAddr     : ROW_ADDRESS_BITS;        // block/page address
-        uint32_t colAddr     : COL_ADDRESS_BITS;        // starting address within a page for writes
+        uint16_t die         : 1;                           // die number, set in the die select register
+        uint16_t plane       : 1;                           // 1 bit to specify plane number
+        uint16_t block       : ROW_ADDRESS_BLOCK_BITS + 1;  // block number across dies
+        uint16_t page        : ROW_ADDRESS_PAGE_BITS;       // page number
+        uint32_t rowAddr     : ROW_ADDRESS_BITS;            // block/page address within the die
+        uint32_t colAddr     : COL_ADDRESS_BITS + 1;        // plane select bit + starting address within a page
     } PhysicalAddrs;
 
     /* physical address macros; Input address must be of type NAND_Addr */
-    #define ADDRESS_2_BLOCK(Address)    ((uint16_t) (Address >> 17))   // divide by 131072 (2^17 bytes per block)
-    #define ADDRESS_2_PLANE(Address)    (ADDRESS_2_BLOCK(Address) & 1) // get the last bit of the block number
-    #define ADDRESS_2_PAGE(Address)     ((uint16_t) ((Address >> 11) & 0x3F))
-    #define ADDRESS_2_COL(Address)      ((uint32_t) (Address & 0x07FF)) // take last 11 bits of address
+    #define ADDRESS_2_BLOCK(Address)    ((uint16_t) ((Address) >> (PAGE_DATA_BITS + ROW_ADDRESS_PAGE_BITS)))
+    #define ADDRESS_2_DIE(Address)      (ADDRESS_2_BLOCK(Address) >> DIE_BLOCK_BITS)
+    #define ADDRESS_2_PLANE(Address)    (ADDRESS_2_BLOCK(Address) & PLANE_MASK) // the plane is the last bit of the block number on two plane parts
+    #define ADDRESS_2_PAGE(Address)     ((uint16_t) (((Address) >> PAGE_DATA_BITS) & (NUM_PAGES_PER_BLOCK - 1)))
+    #define ADDRESS_2_COL(Address)      ((uint32_t) ((Address) & (PAGE_DATA_SIZE - 1)))
 
     /* bit macros */
     #define CHECK_OIP(status_reg)       (status_reg & SPI_NAND_OIP) // returns 1 if OIP bit is 1 and device is busy
@@ -186,6 +270,7 @@ typedef enum {
     */
     typedef enum {
         SPI_NAND_CFG    = (1 << 7) | (1 << 6) | (1 << 1), 
+        SPI_NAND_CFG_PARAM_PAGE = (1 << 6),     /* CFG = 010: parameter page */
         SPI_NAND_LOT_EN = (1 << 5),
         SPI_NAND_ECC_EN = (1 << 4),
     } ConfigRegBits;
@@ -225,6 +310,16 @@ typedef enum {
         SPI_NAND_OIP   = (1 << 0), /* operation in progress */
     } StatusRegBits;
 
+    /* On-die ECC outcome of a page read, decoded from the status register ECC bits */
+    typedef enum {
+        ECC_NO_ERRORS,
+        ECC_CORRECTED_1_3,
+        ECC_CORRECTED_4_6,
+        ECC_CORRECTED_7_8,
+        ECC_UNCORRECTABLE,
+        NUM_ECC_RESULTS,
+    } NAND_ECCResult;
+
     /* Die Select Register Definitions (see Datasheet page 37)
     *   DR6     - DS0
     *   others  - reserved
@@ -243,10 +338,44 @@ typedef enum {
     } PageReadMode;
 
     /* Time constants, in ms (see datasheet pages )
-     * These are rounded up to the nearest ms for use with HAL_Delay() */
+     * These are rounded up to the nearest ms for use with NAND_Wait() */
     #define T_POR           2    /* Power-On/Reset Time : Minimum time after power on or reset: 1.25 ms */
-    #define TIME_MAX_ERS    0
-    #define TIME_MAX_PGM    0
+
+    /* Array operation times in us, typical and maximum (see datasheet AC characteristics).
+     * Waits sleep through the typical time, then poll the status register every
+     * NAND_POLL_INTERVAL_US until the maximum plus NAND_WAIT_SLACK_US has passed. */
+    #define T_RD_TYP_US             25      /* PAGE READ into the cache */
+    #define T_RD_MAX_US             70
+    #define T_RCBSY_TYP_US          3       /* READ PAGE CACHE RANDOM/LAST, once the array read before it is done */
+    #define T_RCBSY_MAX_US          25
+    #define T_PROG_TYP_US           200     /* PROGRAM EXECUTE */
+    #define T_PROG_MAX_US           600
+    #define T_BERS_TYP_US           2000    /* BLOCK ERASE */
+    #define T_BERS_MAX_US           10000
+    #define NAND_POLL_INTERVAL_US   20
+    #define NAND_WAIT_SLACK_US      1000    /* covers the timer resolution of the OS port */
+
+    /* Supplies the next PAGE_SIZE bytes (data, then spare) of a raw image to NAND_Image_Program.
+     * Returns Ret_Success, or anything else to stop programming. */
+    typedef NAND_ReturnType (*NAND_ImageSource)(void *context, uint8_t *page);
+
+    /* One read of NAND_Page_Read_Batch: length bytes of the page at addr (from
+     * __block_address) starting at its column, into buffer. status is filled in. */
+    typedef struct {
+        PhysicalAddrs addr;
+        uint8_t *buffer;
+        uint16_t length;
+        NAND_ReturnType status;
+    } NAND_ReadRequest;
+
+    /* SPI clock calibration, see NAND_Calibrate_Clock. The clock settles NAND_CLOCK_MARGIN
+     * steps (a factor of 2 each) below the fastest one that passed NAND_CLOCK_PASSES checks
+     * in a row. Once NAND_CLOCK_ERROR_LIMIT page reads within NAND_CLOCK_WINDOW fail, the
+     * clock drops a step and a recalibration with one more step of margin is requested. */
+    #define NAND_CLOCK_MARGIN       1
+    #define NAND_CLOCK_PASSES       8
+    #define NAND_CLOCK_WINDOW       1024
+    #define NAND_CLOCK_ERROR_LIMIT  4
 
 #endif
 
@@ -256,6 +385,24 @@ typedef enum {
  *****************************************************************************/
 NAND_SPI_ReturnType __write_enable(SPI_HandleTypeDef *hspi);
 NAND_SPI_ReturnType __write_disable(SPI_HandleTypeDef *hspi);
+NAND_ReturnType __select_die(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr);
+uint16_t __param_page_crc(uint8_t *param_page);
+uint32_t __segments_length(SPI_Params *segments, uint8_t num_segments);
+NAND_ECCResult __ecc_result(uint8_t status_reg);
+void __block_address(uint16_t block, uint16_t page, uint16_t column, PhysicalAddrs *addr);
+NAND_ReturnType __wait_ready(SPI_HandleTypeDef *hspi, uint32_t typical_us, uint32_t max_us);
+uint8_t __clock_pattern(uint16_t column);
+NAND_ReturnType __clock_check(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, NAND_ID *reference_ID, uint8_t *page);
+NAND_ReturnType __clock_write_pattern(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *page);
+void __clock_track(SPI_HandleTypeDef *hspi, uint8_t failed);
+NAND_ReturnType __page_read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments);
+NAND_ReturnType __page_program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments);
+NAND_ReturnType __block_erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr);
+uint8_t __batch_before(PhysicalAddrs *a, PhysicalAddrs *b);
+NAND_ReturnType __batch_load(SPI_HandleTypeDef *hspi, uint8_t command, PhysicalAddrs *addr, uint32_t typical_us, uint32_t max_us);
+void __batch_output(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t *order, uint16_t count, uint32_t start);
+void __batch_fail(NAND_ReadRequest *requests, uint16_t *order, uint16_t count);
+void __batch_chain(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t *order, uint16_t count);
 
 /******************************************************************************
  *                            List of APIs
@@ -267,7 +414,7 @@ NAND_ReturnType NAND_Wait_Until_Ready(SPI_HandleTypeDef *hspi);
 
 /* identification operations */
 NAND_ReturnType NAND_Read_ID(SPI_HandleTypeDef *hspi, NAND_ID *nand_ID);
-// NAND_ReturnType NAND_Read_Param_Page(SPI_HandleTypeDef *hspi, param_page_t *ppage);
+NAND_ReturnType NAND_Read_Param_Page(SPI_HandleTypeDef *hspi, NAND_Geometry *geometry);
 
 /* feature operations */
 NAND_ReturnType NAND_Check_Busy(SPI_HandleTypeDef *hspi);
@@ -276,15 +423,28 @@ NAND_ReturnType NAND_Set_Features(SPI_HandleTypeDef *hspi, RegisterAddr reg_addr
 
 /* read operations */
 NAND_ReturnType NAND_Page_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length);
+NAND_ReturnType NAND_Page_Read_Segments(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments);
+NAND_ReturnType NAND_Page_Read_Batch(SPI_HandleTypeDef *hspi, NAND_ReadRequest *requests, uint16_t count);
+void NAND_Get_ECC_Counts(uint32_t counts[NUM_ECC_RESULTS]);
 // NAND_ReturnType NAND_Spare_Read(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer);
 
 /* write operations */
 NAND_ReturnType NAND_Page_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length);
+NAND_ReturnType NAND_Page_Program_Segments(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, SPI_Params *segments, uint8_t num_segments);
+NAND_ReturnType NAND_Page_Append(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr, uint8_t *buffer, uint16_t length, uint8_t *programs);
 // NAND_ReturnType NAND_Spare_Program(SPI_HandleTypeDef *hspi, PhysicalAddrs *addrs, uint8_t *buffer);
 
 /* erase operation */
 NAND_ReturnType NAND_Block_Erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr);
 
+/* bulk programming of raw images, see tools/nand_image.c */
+NAND_ReturnType NAND_Image_Program(SPI_HandleTypeDef *hspi, uint16_t first_block, uint16_t num_blocks, uint8_t *page, NAND_ImageSource source, void *context);
+
+/* SPI clock calibration */
+NAND_ReturnType NAND_Calibrate_Clock(SPI_HandleTypeDef *hspi, uint16_t block, uint8_t *page);
+uint8_t NAND_Get_Clock_Step(void);
+uint8_t NAND_Clock_Calibration_Pending(void);
+
 /* internal data move operations */
 // NAND_ReturnType NAND_Copy_Back(SPI_HandleTypeDef *hspi, NAND_Addr src_addr, NAND_Addr dest_addr);
 
@@ -292,3 +452,5 @@ NAND_ReturnType NAND_Block_Erase(SPI_HandleTypeDef *hspi, PhysicalAddrs *addr);
 // NAND_ReturnType NAND_Lock(void);
 // NAND_ReturnType NAND_Unlock(NAND_Addr start_block, NAND_Addr end_block);
 // NAND_ReturnType NAND_Read_Lock_Status(NAND_Addr block_addr);
+
+#endif
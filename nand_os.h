@@ -0,0 +1,66 @@
+
+/************************** NAND OS Abstraction ***********************************
+
+   Filename:    nand_os.h
+   Description: Operating system hooks used by the drivers to sleep, yield, serialize
+                  access to the device and wait for interrupts.
+
+   Version:     0.1
+   Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_OS_H
+#define NAND_OS_H
+
+#include <stdint.h>
+
+/* List of supported ports. Define exactly one; its nand_os_<port>.c implements the hooks
+ * below and the other ports compile to nothing.
+ *
+ * An RTOS port maps the hooks onto the kernel: under FreeRTOS, NAND_OS_Sleep_us is vTaskDelay
+ * rounded up to ticks, NAND_OS_Yield is taskYIELD, the lock is a recursive mutex and the
+ * event a binary semaphore given with xSemaphoreGiveFromISR. */
+#define NAND_OS_BAREMETAL                           /* HAL_Delay and polling, no locking */
+// #define NAND_OS_POSIX                            /* pthreads, for hosts and simulators */
+
+#if (defined(NAND_OS_BAREMETAL) + defined(NAND_OS_POSIX)) != 1
+    #error "Define exactly one NAND_OS port"
+#endif
+
+/******************************************************************************
+ *                                  List of APIs
+ *****************************************************************************/
+
+    /* Time. Sleeps release the CPU to other tasks and may last longer than asked. Ports
+     * may yield or return at once instead of sleeping for less than their tick. */
+    void NAND_OS_Sleep_us(uint32_t microseconds);
+    void NAND_OS_Yield(void);
+    uint32_t NAND_OS_Time_us(void);
+
+    /* Device lock, held by every nand_m79a and nand_blockdev API call. Must be recursive:
+     * the APIs call each other. Tasks calling nand_m79a_lld directly take it themselves. */
+    void NAND_OS_Lock(void);
+    void NAND_OS_Unlock(void);
+
+    /* Transfer complete event. NAND_OS_Wait_Event returns 1 once NAND_OS_Signal_From_ISR was
+     * called since the last successful wait, or 0 after timeout_us. */
+    uint8_t NAND_OS_Wait_Event(uint32_t timeout_us);
+    void NAND_OS_Signal_From_ISR(void);
+
+/******************************************************************************/
+
+#endif
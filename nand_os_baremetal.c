@@ -0,0 +1,92 @@
+/************************** NAND OS Abstraction ***********************************
+
+    Filename:    nand_os_baremetal.c
+    Description: Bare-metal port of the OS hooks: sleeps are HAL_Delay, events are a flag set
+                from the interrupt handler and polled, and there is nothing to lock.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include "nand_os.h"
+
+#ifdef NAND_OS_BAREMETAL
+
+#include "stm32l0xx_hal.h"
+
+/* set by NAND_OS_Signal_From_ISR, cleared by NAND_OS_Wait_Event */
+static volatile uint8_t event_flag;
+
+/**
+    @brief Waits for at least the given time.
+    @note The HAL tick is 1 ms, so shorter sleeps return at once. Without other tasks to run,
+          that only turns the callers' waits into back to back status polls.
+*/
+void NAND_OS_Sleep_us(uint32_t microseconds) {
+    if (microseconds >= 1000) {
+        HAL_Delay(microseconds / 1000);
+    }
+}
+
+/**
+    @brief Nothing else to run.
+*/
+void NAND_OS_Yield(void) {
+}
+
+/**
+    @brief Returns a free running time in microseconds, with the 1 ms resolution of the HAL tick.
+*/
+uint32_t NAND_OS_Time_us(void) {
+    return HAL_GetTick() * 1000;
+}
+
+/**
+    @brief A single thread of execution needs no lock.
+*/
+void NAND_OS_Lock(void) {
+}
+
+void NAND_OS_Unlock(void) {
+}
+
+/**
+    @brief Polls the event flag until it is set or timeout_us passes.
+
+    @return 1 if the event was signalled, 0 on timeout
+*/
+uint8_t NAND_OS_Wait_Event(uint32_t timeout_us) {
+    uint32_t start = NAND_OS_Time_us();
+
+    while (!event_flag) {
+        /* the tick resolution makes the timeout up to 1 ms longer */
+        if (timeout_us == 0 || NAND_OS_Time_us() - start > timeout_us + 1000) {
+            return 0;
+        }
+    }
+    event_flag = 0;
+    return 1;
+}
+
+/**
+    @brief Sets the event flag. Safe to call from an interrupt handler.
+*/
+void NAND_OS_Signal_From_ISR(void) {
+    event_flag = 1;
+}
+
+#endif
@@ -0,0 +1,133 @@
+/************************** NAND OS Abstraction ***********************************
+
+    Filename:    nand_os_posix.c
+    Description: POSIX threads port of the OS hooks, for running the drivers on a host
+                against a simulated device, with several threads sharing it.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+/* before any system header; harmless when another port is selected */
+#define _XOPEN_SOURCE 700
+
+#include "nand_os.h"
+
+#ifdef NAND_OS_POSIX
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+static pthread_once_t  init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t device_lock;
+
+/* transfer complete event: a binary semaphore made of a flag, a mutex and a condition */
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  event_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t         event_flag;
+
+/* the device lock must be recursive, which has no static initializer */
+static void __os_init(void) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&device_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+    @brief Sleeps for at least the given time, resuming after interruptions by signals.
+*/
+void NAND_OS_Sleep_us(uint32_t microseconds) {
+    struct timespec remaining = { .tv_sec = microseconds / 1000000, .tv_nsec = (microseconds % 1000000) * 1000L };
+
+    while (nanosleep(&remaining, &remaining) != 0) {
+    }
+}
+
+/**
+    @brief Lets other threads of the same priority run.
+*/
+void NAND_OS_Yield(void) {
+    sched_yield();
+}
+
+/**
+    @brief Returns a free running time in microseconds.
+*/
+uint32_t NAND_OS_Time_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+    @brief Takes the recursive device lock.
+*/
+void NAND_OS_Lock(void) {
+    pthread_once(&init_once, __os_init);
+    pthread_mutex_lock(&device_lock);
+}
+
+void NAND_OS_Unlock(void) {
+    pthread_mutex_unlock(&device_lock);
+}
+
+/**
+    @brief Blocks until the event is signalled or timeout_us passes.
+
+    @return 1 if the event was signalled, 0 on timeout
+*/
+uint8_t NAND_OS_Wait_Event(uint32_t timeout_us) {
+    struct timespec deadline;
+    uint8_t signalled;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_us / 1000000;
+    deadline.tv_nsec += (timeout_us % 1000000) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&event_lock);
+    while (!event_flag) {
+        if (pthread_cond_timedwait(&event_cond, &event_lock, &deadline) != 0) {
+            break;
+        }
+    }
+    signalled = event_flag;
+    event_flag = 0;
+    pthread_mutex_unlock(&event_lock);
+
+    return signalled;
+}
+
+/**
+    @brief Signals the event. Here the "interrupt handler" is any other thread.
+*/
+void NAND_OS_Signal_From_ISR(void) {
+    pthread_mutex_lock(&event_lock);
+    event_flag = 1;
+    pthread_cond_signal(&event_cond);
+    pthread_mutex_unlock(&event_lock);
+}
+
+#endif
@@ -0,0 +1,134 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_pool.c
+    Description: Statically sized page buffers and scratch memory, leased to the drivers for
+                 the length of an operation instead of declared on the caller's stack.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include "nand_pool.h"
+
+#if NAND_POOL_BUFFERS < 1 || NAND_POOL_BUFFERS > 255
+    #error "NAND_POOL_BUFFERS must be between 1 and 255"
+#endif
+
+#define POOL_WORDS(bytes)       (((bytes) + 3) / 4)
+
+static uint32_t buffers[NAND_POOL_BUFFERS][POOL_WORDS(PAGE_DATA_SIZE)];
+static uint8_t  returned[NAND_POOL_BUFFERS];    // indexes of buffers given back, last on top
+static uint8_t  num_returned;
+static uint8_t  num_fresh;                      // buffers[num_fresh..] were never leased
+static uint8_t  buffers_high_water;
+
+static uint32_t arena[POOL_WORDS(NAND_POOL_ARENA_SIZE)];
+static uint16_t arena_top;                      // bytes allocated, in whole words
+static uint16_t arena_high_water;
+
+static uint32_t failures;
+
+
+/******************************************************************************
+ *                              Statistics
+ *****************************************************************************/
+
+/**
+    @brief Fills in the current use and high-water marks of the pool and the arena.
+ */
+void NAND_Pool_Get_Stats(NAND_PoolStats *stats) {
+    NAND_OS_Lock();
+    stats -> buffers_in_use     = num_fresh - num_returned;
+    stats -> buffers_high_water = buffers_high_water;
+    stats -> arena_used         = arena_top;
+    stats -> arena_high_water   = arena_high_water;
+    stats -> failures           = failures;
+    NAND_OS_Unlock();
+}
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+/**
+    @brief Leases a page buffer of PAGE_DATA_SIZE bytes, word aligned.
+    @note Buffers given back are reused first, the most recent one first.
+
+    @return the buffer, or NULL if all NAND_POOL_BUFFERS are leased
+ */
+uint8_t *__pool_acquire(void) {
+    uint8_t *buffer = NULL;
+
+    NAND_OS_Lock();
+    if (num_returned > 0) {
+        buffer = (uint8_t *) buffers[returned[--num_returned]];
+    } else if (num_fresh < NAND_POOL_BUFFERS) {
+        buffer = (uint8_t *) buffers[num_fresh++];
+    } else {
+        failures++;
+    }
+    if (buffer != NULL && num_fresh - num_returned > buffers_high_water) {
+        buffers_high_water = num_fresh - num_returned;
+    }
+    NAND_OS_Unlock();
+
+    return buffer;
+}
+
+/* gives back a buffer from __pool_acquire */
+void __pool_release(uint8_t *buffer) {
+    NAND_OS_Lock();
+    returned[num_returned++] = ((uint32_t *) buffer - buffers[0]) / POOL_WORDS(PAGE_DATA_SIZE);
+    NAND_OS_Unlock();
+}
+
+/**
+    @brief Allocates size bytes of scratch memory, word aligned, from the arena.
+    @note Freed by __pool_reset to a mark taken before; take the mark first.
+
+    @return the memory, or NULL if the arena has not enough left
+ */
+void *__pool_alloc(uint16_t size) {
+    void *memory = NULL;
+
+    NAND_OS_Lock();
+    if (POOL_WORDS(size) <= POOL_WORDS(NAND_POOL_ARENA_SIZE) - arena_top / 4) {
+        memory = &arena[arena_top / 4];
+        arena_top += POOL_WORDS(size) * 4;
+        if (arena_top > arena_high_water) {
+            arena_high_water = arena_top;
+        }
+    } else {
+        failures++;
+    }
+    NAND_OS_Unlock();
+
+    return memory;
+}
+
+/* the current top of the arena, to go back to with __pool_reset */
+uint16_t __pool_mark(void) {
+    return arena_top;
+}
+
+/* frees everything allocated from the arena since mark was taken */
+void __pool_reset(uint16_t mark) {
+    NAND_OS_Lock();
+    arena_top = mark;
+    NAND_OS_Unlock();
+}
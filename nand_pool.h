@@ -0,0 +1,74 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_pool.h
+    Description: Statically sized page buffers and scratch memory, leased to the drivers for
+                 the length of an operation instead of declared on the caller's stack.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_POOL_H
+#define NAND_POOL_H
+
+#include <stddef.h>
+
+#include "nand_m79a_lld.h"
+
+/*
+    Page buffers (PAGE_DATA_SIZE bytes, word aligned) that an operation needs only while it
+    runs come from a pool of NAND_POOL_BUFFERS, and smaller scratch memory whose size
+    depends on the configuration (the parameter page, the pages of a trim checkpoint) from an
+    arena of NAND_POOL_ARENA_SIZE bytes. Both are static, so the drivers' worst case RAM is
+    known at link time, and no call puts more than a few dozen bytes on the task's stack.
+    Buffers that hold state between calls (the FTL's staging and pack buffers, the block
+    device cache, the submission queue's run) stay with their modules.
+
+    A lease is taken and returned in constant time. Leases nest at most two deep: a partial
+    page merge in NAND_Write or NAND_Txn_Write, and with NAND_COMPRESSION the packed page
+    copied by space reclamation during it, so one buffer is enough without compression.
+    The arena is released in the reverse order of allocation. NAND_Pool_Get_Stats reports the
+    high-water marks of both, to size them down for an application.
+*/
+#define NAND_POOL_BUFFERS       2
+#define NAND_POOL_ARENA_SIZE    256
+
+typedef struct {
+    uint8_t  buffers_in_use;
+    uint8_t  buffers_high_water;    // most buffers leased at once since power on
+    uint16_t arena_used;            // bytes
+    uint16_t arena_high_water;
+    uint32_t failures;              // leases and allocations refused since power on
+} NAND_PoolStats;
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+uint8_t *__pool_acquire(void);
+void __pool_release(uint8_t *buffer);
+void *__pool_alloc(uint16_t size);
+uint16_t __pool_mark(void);
+void __pool_reset(uint16_t mark);
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+void NAND_Pool_Get_Stats(NAND_PoolStats *stats);
+
+#endif
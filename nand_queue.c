@@ -0,0 +1,266 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_queue.c
+    Description: Lock-free submission queue that lets interrupt handlers hand writes to
+                 a worker task, in front of NAND_Write.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include <string.h>
+
+#include "nand_queue.h"
+
+/* first ring position of the lap that pos is in */
+#define QUEUE_LAP(pos)      ((pos) & ~(uint32_t) (NAND_QUEUE_SLOTS - 1))
+
+/* the ring; zeroed slots are free for the first lap */
+static NAND_QueueSlot slots[NAND_QUEUE_SLOTS];
+static uint32_t enqueue_pos;                // next position to claim, shared by producers
+static uint32_t dequeue_pos;                // next position to drain, worker only
+
+/* adjacent submissions gathered into one logical page, worker only */
+static uint8_t  run_buffer[PAGE_DATA_SIZE];
+static NAND_Addr run_start;
+static uint16_t run_length;
+
+static uint32_t submitted;
+static uint32_t rejected;                   // updated by producers
+static uint16_t high_water;
+
+
+/******************************************************************************
+ *                              Submission
+ *****************************************************************************/
+
+/**
+    @brief Queues a write of length bytes at a logical address, to be done by the worker.
+    @note Safe from interrupt handlers and tasks alike, without locks or waiting. The data
+          is copied, so buffer may be reused on return. Runs in constant time, except for
+          one retry each time another producer claims a slot between this one's reads,
+          which takes a preempting interrupt handler on a single core.
+
+    @return NAND_ReturnType
+    @retval Ret_AddressInvalid: empty, longer than NAND_QUEUE_SLOT_SIZE, or out of range
+    @retval Ret_MemoryOverflow: every slot is taken; nothing was queued
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Queue_Write(NAND_Addr *address, uint8_t *buffer, uint16_t length) {
+    NAND_QueueSlot *slot;
+    uint32_t pos;
+
+    if (length == 0 || length > NAND_QUEUE_SLOT_SIZE ||
+        *address >= NAND_LOGICAL_SIZE_BYTES || length > NAND_LOGICAL_SIZE_BYTES - *address) {
+        return Ret_AddressInvalid;
+    }
+
+    /* claim a position: its slot must have been released for exactly this lap of the ring */
+    pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &slots[pos & (NAND_QUEUE_SLOTS - 1)];
+        int32_t lag = (int32_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - QUEUE_LAP(pos));
+
+        if (lag == 0) {
+            if (__queue_cas(&enqueue_pos, pos, pos + 1)) {
+                break;
+            }
+        } else if (lag < 0) {
+            /* the worker has not drained this slot since the previous lap */
+            uint32_t count = __atomic_load_n(&rejected, __ATOMIC_RELAXED);
+            while (!__queue_cas(&rejected, count, count + 1)) {
+                count = __atomic_load_n(&rejected, __ATOMIC_RELAXED);
+            }
+            return Ret_MemoryOverflow;
+        }
+        /* another producer claimed it first */
+        pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    slot->address = *address;
+    slot->length  = length;
+    memcpy(slot->data, buffer, length);
+
+    /* hand the slot to the worker */
+    __atomic_store_n(&slot->sequence, QUEUE_LAP(pos) + 1, __ATOMIC_RELEASE);
+    return Ret_Success;
+}
+
+/**
+    @brief Returns the number of slots claimed by producers and not yet drained.
+    @note Use it to wake the worker, or to throttle producers before they are refused.
+ */
+uint16_t NAND_Queue_Pending(void) {
+    return __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE) - __atomic_load_n(&dequeue_pos, __ATOMIC_ACQUIRE);
+}
+
+
+/******************************************************************************
+ *                                  Worker
+ *****************************************************************************/
+
+/**
+    @brief Drains every finished submission into the page buffer, writing each logical page
+           with NAND_Write once it is complete.
+    @note Call from one context only. Stops at the first slot whose producer is still
+          copying its data. Takes the device lock for each write (see nand_os.h), so
+          producers are never held up by it. On a write error the submission stays
+          queued and the next call tries again.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Write
+ */
+NAND_ReturnType NAND_Queue_Process(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status;
+
+    for (;;) {
+        NAND_QueueSlot *slot = &slots[dequeue_pos & (NAND_QUEUE_SLOTS - 1)];
+        uint16_t in_use = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED) - dequeue_pos;
+
+        if (in_use > high_water) {
+            high_water = in_use;
+        }
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != QUEUE_LAP(dequeue_pos) + 1) {
+            return Ret_Success;
+        }
+
+        status = __queue_stage(hspi, slot);
+        if (status != Ret_Success) {
+            return status;
+        }
+
+        /* free the slot for the next lap */
+        __atomic_store_n(&slot->sequence, QUEUE_LAP(dequeue_pos) + NAND_QUEUE_SLOTS, __ATOMIC_RELEASE);
+        __atomic_store_n(&dequeue_pos, dequeue_pos + 1, __ATOMIC_RELEASE);
+        submitted++;
+    }
+}
+
+/**
+    @brief Writes out everything queued so far, including a partly filled page, and makes
+           it durable with NAND_Sync.
+    @note Worker context only.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Write and NAND_Sync
+ */
+NAND_ReturnType NAND_Queue_Flush(SPI_HandleTypeDef *hspi) {
+    NAND_ReturnType status = NAND_Queue_Process(hspi);
+
+    if (status == Ret_Success && run_length > 0) {
+        status = __queue_write_run(hspi);
+    }
+    if (status != Ret_Success) {
+        return status;
+    }
+    return NAND_Sync(hspi);
+}
+
+/**
+    @brief Copies the queue counters.
+ */
+void NAND_Queue_Get_Stats(NAND_QueueStats *stats) {
+    stats->submitted  = submitted;
+    stats->rejected   = __atomic_load_n(&rejected, __ATOMIC_RELAXED);
+    stats->high_water = high_water;
+}
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+/**
+    @brief Atomically replaces *target with desired if it still holds expected.
+    @note ARMv6-M (Cortex-M0+) has no exclusive load and store, so there the compare and
+          store run with interrupts masked; that is three instructions, not a lock.
+
+    @return 1 if the value was replaced, 0 otherwise
+ */
+uint8_t __queue_cas(uint32_t *target, uint32_t expected, uint32_t desired) {
+#if defined(__ARM_ARCH_6M__)
+    uint32_t primask = __get_PRIMASK();
+    uint8_t swapped = 0;
+
+    __disable_irq();
+    if (*(volatile uint32_t *) target == expected) {
+        *(volatile uint32_t *) target = desired;
+        swapped = 1;
+    }
+    __set_PRIMASK(primask);
+    return swapped;
+#else
+    return __atomic_compare_exchange_n(target, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+    @brief Adds a submission to the page buffer, writing the buffered run out first if the
+           submission does not continue it, and whenever the run reaches the end of a page.
+    @note A submission may straddle two pages. If a write fails part way through, the
+          submission is staged again from its start by the next attempt, which rewrites
+          the same bytes.
+
+    @return NAND_ReturnType
+    @retval Return values of NAND_Write
+ */
+NAND_ReturnType __queue_stage(SPI_HandleTypeDef *hspi, NAND_QueueSlot *slot) {
+    NAND_ReturnType status;
+    uint16_t done = 0;
+
+    while (done < slot->length) {
+        NAND_Addr addr = slot->address + done;
+        uint16_t offset = addr % PAGE_DATA_SIZE;
+        uint16_t chunk = slot->length - done;
+
+        if (run_length > 0 && addr != run_start + run_length) {
+            status = __queue_write_run(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+        if (run_length == 0) {
+            run_start = addr;
+        }
+
+        if (chunk > PAGE_DATA_SIZE - offset) {
+            chunk = PAGE_DATA_SIZE - offset;
+        }
+        memcpy(&run_buffer[offset], &slot->data[done], chunk);
+        run_length += chunk;
+        done += chunk;
+
+        if ((run_start + run_length) % PAGE_DATA_SIZE == 0) {
+            status = __queue_write_run(hspi);
+            if (status != Ret_Success) {
+                return status;
+            }
+        }
+    }
+    return Ret_Success;
+}
+
+/* writes the buffered run, which lies within one logical page */
+NAND_ReturnType __queue_write_run(SPI_HandleTypeDef *hspi) {
+    NAND_Addr addr = run_start;
+    NAND_ReturnType status = NAND_Write(hspi, &addr, &run_buffer[run_start % PAGE_DATA_SIZE], run_length);
+
+    if (status == Ret_Success) {
+        run_length = 0;
+    }
+    return status;
+}
@@ -0,0 +1,90 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_queue.h
+    Description: Lock-free submission queue that lets interrupt handlers hand writes to
+                 a worker task, in front of NAND_Write.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_QUEUE_H
+#define NAND_QUEUE_H
+
+#include "nand_m79a.h"
+
+/*
+    NAND_Queue_Write copies a write into a free slot of a bounded ring and returns at once.
+    It takes no lock and never waits, so any number of interrupt handlers and tasks may
+    submit at the same time, even preempting each other. When every slot is taken it
+    returns Ret_MemoryOverflow and nothing is queued; the caller decides whether to drop
+    or retry the data.
+
+    A single worker (one task, or the main loop) calls NAND_Queue_Process, which drains the
+    ring in submission order. Consecutive submissions to adjacent addresses are gathered in
+    a page buffer and written with one NAND_Write per logical page. A partly filled page is
+    held back until it fills, a submission to another address arrives, or NAND_Queue_Flush
+    is called; until then NAND_Read returns the older data.
+
+    Costs NAND_QUEUE_SLOTS * (NAND_QUEUE_SLOT_SIZE + 12) bytes of RAM plus one page buffer.
+*/
+#define NAND_QUEUE_SLOTS            16      /* power of two */
+#define NAND_QUEUE_SLOT_SIZE        256     /* largest single submission, in bytes */
+
+#if (NAND_QUEUE_SLOTS & (NAND_QUEUE_SLOTS - 1)) != 0
+    #error "NAND_QUEUE_SLOTS must be a power of two"
+#endif
+
+/* Ring slot. For ring position pos in the lap starting at position lap, the slot is free
+ * while sequence == lap and holds a finished submission once sequence == lap + 1. The
+ * worker releases it for the next lap by setting lap + NAND_QUEUE_SLOTS. */
+typedef struct {
+    uint32_t  sequence;
+    NAND_Addr address;
+    uint16_t  length;
+    uint8_t   data[NAND_QUEUE_SLOT_SIZE];
+} NAND_QueueSlot;
+
+/* counters for sizing the ring, see NAND_Queue_Get_Stats */
+typedef struct {
+    uint32_t submitted;     // submissions written out by the worker
+    uint32_t rejected;      // submissions refused because every slot was taken
+    uint16_t high_water;    // most slots in use, as seen by the worker
+} NAND_QueueStats;
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+uint8_t __queue_cas(uint32_t *target, uint32_t expected, uint32_t desired);
+NAND_ReturnType __queue_stage(SPI_HandleTypeDef *hspi, NAND_QueueSlot *slot);
+NAND_ReturnType __queue_write_run(SPI_HandleTypeDef *hspi);
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+/* producers: any context */
+NAND_ReturnType NAND_Queue_Write(NAND_Addr *address, uint8_t *buffer, uint16_t length);
+uint16_t NAND_Queue_Pending(void);
+
+/* the single worker */
+NAND_ReturnType NAND_Queue_Process(SPI_HandleTypeDef *hspi);
+NAND_ReturnType NAND_Queue_Flush(SPI_HandleTypeDef *hspi);
+void NAND_Queue_Get_Stats(NAND_QueueStats *stats);
+
+#endif
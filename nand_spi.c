@@ -80,10 +80,10 @@
 
 
 /**
-	@brief Calls HAL_Delay() for stated number of milliseconds
+	@brief Sleeps for stated number of milliseconds, releasing the CPU to other tasks.
 */
 void NAND_Wait(uint8_t milliseconds){
-   HAL_Delay(milliseconds);
+   NAND_OS_Sleep_us((uint32_t) milliseconds * 1000);
 };
 
 
@@ -98,7 +98,7 @@ NAND_SPI_ReturnType NAND_SPI_Send(SPI_HandleTypeDef *hspi, SPI_Params *data_send
 	HAL_StatusTypeDef send_status;
 
 	__nand_spi_cs_low();
-	send_status = HAL_SPI_Transmit(hspi, data_send->buffer, data_send->length, NAND_SPI_TIMEOUT);
+	send_status = __nand_spi_transmit(hspi, data_send->buffer, data_send->length);
 	__nand_spi_cs_high();
 
 	if (send_status != HAL_OK) {
@@ -112,13 +112,19 @@ NAND_SPI_ReturnType NAND_SPI_Send(SPI_HandleTypeDef *hspi, SPI_Params *data_send
 
 /**
 	@brief NAND Data transmit: this function is used to send and receive read data from NAND.
+	@note The received bytes are scattered over num_recv segments in order, all within one
+	      chip select transaction. Zero length segments are skipped.
 */
-NAND_SPI_ReturnType NAND_SPI_SendReceive(SPI_HandleTypeDef *hspi, SPI_Params *data_send, SPI_Params *data_recv) {
+NAND_SPI_ReturnType NAND_SPI_SendReceive(SPI_HandleTypeDef *hspi, SPI_Params *data_send, SPI_Params *data_recv, uint8_t num_recv) {
 	HAL_StatusTypeDef transmit_status;
 
 	__nand_spi_cs_low();
-	HAL_SPI_Transmit(hspi, data_send->buffer, data_send->length, NAND_SPI_TIMEOUT);
-	transmit_status = HAL_SPI_Receive(hspi, data_recv->buffer, data_recv->length, NAND_SPI_TIMEOUT);
+	transmit_status = __nand_spi_transmit(hspi, data_send->buffer, data_send->length);
+	for (uint8_t i = 0; i < num_recv && transmit_status == HAL_OK; i++) {
+		if (data_recv[i].length > 0) {
+			transmit_status = __nand_spi_receive(hspi, data_recv[i].buffer, data_recv[i].length);
+		}
+	}
 	__nand_spi_cs_high();
 
 	if (transmit_status != HAL_OK) {
@@ -136,7 +142,7 @@ NAND_SPI_ReturnType NAND_SPI_Receive(SPI_HandleTypeDef *hspi, SPI_Params *data_r
 	HAL_StatusTypeDef receive_status;
 
 	__nand_spi_cs_low();
-	receive_status = HAL_SPI_Receive(hspi, data_recv->buffer, data_recv->length, NAND_SPI_TIMEOUT);
+	receive_status = __nand_spi_receive(hspi, data_recv->buffer, data_recv->length);
 	__nand_spi_cs_high();
 
 	if (receive_status != HAL_OK) {
@@ -152,13 +158,20 @@ NAND_SPI_ReturnType NAND_SPI_Receive(SPI_HandleTypeDef *hspi, SPI_Params *data_r
 
 /**
 	@brief NAND Data input: this function is used to write data to NAND.
+	@note The data is gathered from num_send segments in order, all within one chip select
+	      transaction, so callers need not copy them into one buffer first. Zero length
+	      segments are skipped.
 */
-NAND_SPI_ReturnType NAND_SPI_Send_Command_Data(SPI_HandleTypeDef *hspi, SPI_Params *cmd_send, SPI_Params *data_send) {
+NAND_SPI_ReturnType NAND_SPI_Send_Command_Data(SPI_HandleTypeDef *hspi, SPI_Params *cmd_send, SPI_Params *data_send, uint8_t num_send) {
 	HAL_StatusTypeDef send_status;
 
 	__nand_spi_cs_low();
-	HAL_SPI_Transmit(hspi, cmd_send->buffer, cmd_send->length, NAND_SPI_TIMEOUT);
-	send_status = HAL_SPI_Transmit(hspi, data_send->buffer, data_send->length, NAND_SPI_TIMEOUT);
+	send_status = __nand_spi_transmit(hspi, cmd_send->buffer, cmd_send->length);
+	for (uint8_t i = 0; i < num_send && send_status == HAL_OK; i++) {
+		if (data_send[i].length > 0) {
+			send_status = __nand_spi_transmit(hspi, data_send[i].buffer, data_send[i].length);
+		}
+	}
 	__nand_spi_cs_high();
 
 	if (send_status != HAL_OK) {
@@ -168,6 +181,42 @@ NAND_SPI_ReturnType NAND_SPI_Send_Command_Data(SPI_HandleTypeDef *hspi, SPI_Para
 	}
 };
 
+/******************************************************************************
+ *                              Bus Configuration
+ *****************************************************************************/
+
+/**
+	@brief Sets the SPI clock to one of NAND_SPI_CLOCK_STEPS prescaler settings.
+	@note Step 0 is the fastest. Only the prescaler is changed; the other settings stay as
+	      configured in hspi->Init. Must not be called while chip select is low.
+*/
+NAND_SPI_ReturnType NAND_SPI_Set_Clock(SPI_HandleTypeDef *hspi, uint8_t step) {
+	static const uint32_t prescalers[NAND_SPI_CLOCK_STEPS] = {
+		SPI_BAUDRATEPRESCALER_2,  SPI_BAUDRATEPRESCALER_4,  SPI_BAUDRATEPRESCALER_8,   SPI_BAUDRATEPRESCALER_16,
+		SPI_BAUDRATEPRESCALER_32, SPI_BAUDRATEPRESCALER_64, SPI_BAUDRATEPRESCALER_128, SPI_BAUDRATEPRESCALER_256,
+	};
+
+	if (step >= NAND_SPI_CLOCK_STEPS) {
+		return SPI_Fail;
+	}
+
+	hspi->Init.BaudRatePrescaler = prescalers[step];
+	if (HAL_SPI_Init(hspi) != HAL_OK) {
+		return SPI_Fail;
+	} else {
+		return SPI_OK;
+	}
+};
+
+/**
+	@brief Signals the end of a DMA transfer to the task waiting for it.
+	@note Call from HAL_SPI_TxCpltCallback, HAL_SPI_TxRxCpltCallback and HAL_SPI_ErrorCallback
+	      for the NAND's SPI handle when NAND_SPI_DMA is set.
+*/
+void NAND_SPI_Transfer_Complete_ISR(void) {
+	NAND_OS_Signal_From_ISR();
+};
+
 /******************************************************************************
  *                              Internal Functions
  *****************************************************************************/
@@ -189,3 +238,55 @@ void __nand_spi_cs_high(void){
 	HAL_GPIO_WritePin(NAND_NCS_PORT, NAND_NCS_PIN, GPIO_PIN_SET);
 };
 
+
+/**
+	@brief Sends bytes within the current chip select transaction.
+	@note With NAND_SPI_DMA, long transfers run by DMA while the calling task sleeps.
+*/
+HAL_StatusTypeDef __nand_spi_transmit(SPI_HandleTypeDef *hspi, uint8_t *buffer, uint16_t length) {
+#if NAND_SPI_DMA
+	if (length >= NAND_SPI_DMA_MIN_LENGTH) {
+		NAND_OS_Wait_Event(0);	// drop a completion left over from an aborted transfer
+		if (HAL_SPI_Transmit_DMA(hspi, buffer, length) != HAL_OK) {
+			return HAL_ERROR;
+		}
+		return __nand_spi_dma_wait(hspi);
+	}
+#endif
+	return HAL_SPI_Transmit(hspi, buffer, length, NAND_SPI_TIMEOUT);
+};
+
+
+/**
+	@brief Receives bytes within the current chip select transaction.
+	@note With NAND_SPI_DMA, long transfers run by DMA while the calling task sleeps.
+*/
+HAL_StatusTypeDef __nand_spi_receive(SPI_HandleTypeDef *hspi, uint8_t *buffer, uint16_t length) {
+#if NAND_SPI_DMA
+	if (length >= NAND_SPI_DMA_MIN_LENGTH) {
+		NAND_OS_Wait_Event(0);	// drop a completion left over from an aborted transfer
+		if (HAL_SPI_Receive_DMA(hspi, buffer, length) != HAL_OK) {
+			return HAL_ERROR;
+		}
+		return __nand_spi_dma_wait(hspi);
+	}
+#endif
+	return HAL_SPI_Receive(hspi, buffer, length, NAND_SPI_TIMEOUT);
+};
+
+
+/**
+	@brief Sleeps until the DMA transfer started last completes or fails.
+	@note A transfer that does not complete within NAND_SPI_TIMEOUT ms is aborted.
+*/
+HAL_StatusTypeDef __nand_spi_dma_wait(SPI_HandleTypeDef *hspi) {
+	if (!NAND_OS_Wait_Event((uint32_t) NAND_SPI_TIMEOUT * 1000)) {
+		HAL_SPI_Abort(hspi);
+		return HAL_TIMEOUT;
+	}
+	if (HAL_SPI_GetError(hspi) != HAL_SPI_ERROR_NONE) {
+		return HAL_ERROR;
+	} else {
+		return HAL_OK;
+	}
+};
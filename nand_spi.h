@@ -23,7 +23,11 @@
 
 ********************************************************************************/
 
+#ifndef NAND_SPI_H
+#define NAND_SPI_H
+
 #include "stm32l0xx_hal.h"
+#include "nand_os.h"
 
 #define NAND_NCS_PIN    GPIO_PIN_12
 #define NAND_SCK_PIN    GPIO_PIN_13
@@ -38,13 +42,28 @@
 #define DUMMY_BYTE         0x00
 #define NAND_SPI_TIMEOUT   100
 
+/* SPI clock settings for NAND_SPI_Set_Clock. Step 0 is the fastest (peripheral clock / 2) and
+ * each step halves the clock, down to the reference setting of NAND_SPI_Init (/ 256). */
+#define NAND_SPI_CLOCK_STEPS    8
+#define NAND_SPI_CLOCK_SLOWEST  (NAND_SPI_CLOCK_STEPS - 1)
+
+/* Optional DMA transfers. With NAND_SPI_DMA set to 1, transfers of at least
+ * NAND_SPI_DMA_MIN_LENGTH bytes (page data) run by DMA while the calling task sleeps in
+ * NAND_OS_Wait_Event. The application must then call NAND_SPI_Transfer_Complete_ISR from
+ * HAL_SPI_TxCpltCallback, HAL_SPI_TxRxCpltCallback and HAL_SPI_ErrorCallback of the NAND's
+ * SPI handle. Shorter transfers are not worth setting up DMA for and stay polled. */
+#ifndef NAND_SPI_DMA
+    #define NAND_SPI_DMA        0
+#endif
+#define NAND_SPI_DMA_MIN_LENGTH 64
+
 /* using custom return type to keep higher layers as platform-agnostic as possible */
 typedef enum {
     SPI_OK,
     SPI_Fail
 } NAND_SPI_ReturnType;
 
-/* SPI Transaction Parameters */
+/* SPI Transaction Parameters. Arrays of these describe scatter-gather transfers. */
 typedef struct {
     uint8_t *buffer;
     uint16_t length;
@@ -56,6 +75,9 @@ typedef struct {
 
     void __nand_spi_cs_low(void); 
     void __nand_spi_cs_high(void); 
+    HAL_StatusTypeDef __nand_spi_transmit(SPI_HandleTypeDef *hspi, uint8_t *buffer, uint16_t length);
+    HAL_StatusTypeDef __nand_spi_receive(SPI_HandleTypeDef *hspi, uint8_t *buffer, uint16_t length);
+    HAL_StatusTypeDef __nand_spi_dma_wait(SPI_HandleTypeDef *hspi);
 
 /******************************************************************************
  *                                  List of APIs
@@ -66,9 +88,15 @@ typedef struct {
 
     /* Wrapper functions for sending and receiving data */
     NAND_SPI_ReturnType NAND_SPI_Send(SPI_HandleTypeDef *hspi, SPI_Params *data_send);
-    NAND_SPI_ReturnType NAND_SPI_SendReceive(SPI_HandleTypeDef *hspi, SPI_Params *data_send, SPI_Params *data_recv);
+    NAND_SPI_ReturnType NAND_SPI_SendReceive(SPI_HandleTypeDef *hspi, SPI_Params *data_send, SPI_Params *data_recv, uint8_t num_recv);
     NAND_SPI_ReturnType NAND_SPI_Receive(SPI_HandleTypeDef *hspi, SPI_Params *data_recv);
 
-    NAND_SPI_ReturnType NAND_SPI_Send_Command_Data(SPI_HandleTypeDef *hspi, SPI_Params *cmd_send, SPI_Params *data_send);
+    NAND_SPI_ReturnType NAND_SPI_Send_Command_Data(SPI_HandleTypeDef *hspi, SPI_Params *cmd_send, SPI_Params *data_send, uint8_t num_send);
+
+    /* Bus configuration */
+    NAND_SPI_ReturnType NAND_SPI_Set_Clock(SPI_HandleTypeDef *hspi, uint8_t step);
+    void NAND_SPI_Transfer_Complete_ISR(void);
 
 /******************************************************************************/
+
+#endif
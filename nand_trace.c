@@ -0,0 +1,232 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_trace.c
+    Description: Optional trace of driver operations (what, where, how much, when and for
+                 how long) in a RAM ring, saved to a reserved flash region or read out by
+                 the application, for replay on a host with tools/nand_replay.c.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.    Date            Comments
+
+    0.1     Jan 2022        In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#include "nand_trace.h"
+
+#if NAND_TRACE
+
+#define LOG_PAGES               ((uint32_t) NAND_TRACE_NUM_BLOCKS * NUM_PAGES_PER_BLOCK)
+#define LOG_UNKNOWN             0xFFFFFFFF
+
+static NAND_TraceRecord ring[NAND_TRACE_RECORDS];
+static uint32_t ring_head;                  // records appended since power on
+static uint32_t ring_tail;                  // records taken out or overwritten since power on
+static uint32_t dropped;                    // overwritten since last reported
+static uint8_t  enabled = 1;
+
+/* the log in the reserved region */
+static uint32_t log_page = LOG_UNKNOWN;     // next page to program, from the start of the region
+static uint32_t log_sequence;               // sequence number of that page
+
+
+/******************************************************************************
+ *                              Trace Records
+ *****************************************************************************/
+
+/**
+    @brief Starts or stops recording. Recording is on after power on.
+ */
+void NAND_Trace_Enable(uint8_t enable) {
+    NAND_OS_Lock();
+    enabled = enable;
+    NAND_OS_Unlock();
+}
+
+/**
+    @brief Moves up to max_records of the oldest records into records.
+
+    @return number of records copied
+ */
+uint32_t NAND_Trace_Read(NAND_TraceRecord *records, uint32_t max_records) {
+    uint32_t count = 0;
+
+    NAND_OS_Lock();
+    while (count < max_records && ring_tail != ring_head) {
+        records[count++] = ring[ring_tail % NAND_TRACE_RECORDS];
+        ring_tail++;
+    }
+    NAND_OS_Unlock();
+
+    return count;
+}
+
+/**
+    @brief Returns the number of records overwritten before they were read or saved, since
+           the last call or NAND_Trace_Save.
+ */
+uint32_t NAND_Trace_Dropped(void) {
+    NAND_OS_Lock();
+    uint32_t count = dropped;
+    dropped = 0;
+    NAND_OS_Unlock();
+
+    return count;
+}
+
+/**
+    @brief Programs all records in the ring into the reserved region and removes them.
+    @note Fills one page per NAND_TRACE_RECORDS_PER_PAGE records, the last one partly.
+          Entering a block erases it first, which drops the oldest pages of the log; blocks
+          with a bad-block mark are skipped. The first call after power on reads the header
+          of every page in the region to find where the log ends. Operations done here are
+          not recorded.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_EraseFailed
+    @retval Ret_ProgramFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType NAND_Trace_Save(SPI_HandleTypeDef *hspi) {
+    PhysicalAddrs addr;
+    NAND_TracePageHeader header;
+    NAND_ReturnType status = Ret_Success;
+    uint8_t bad_block_mark;
+
+    NAND_OS_Lock();
+    uint8_t was_enabled = enabled;
+    enabled = 0;
+
+    if (log_page == LOG_UNKNOWN) {
+        status = __trace_find_end(hspi);
+    }
+
+    while (status == Ret_Success && ring_tail != ring_head) {
+        uint16_t block = NAND_TRACE_FIRST_BLOCK + log_page / NUM_PAGES_PER_BLOCK;
+        uint16_t page  = log_page % NUM_PAGES_PER_BLOCK;
+
+        if (page == 0) {
+            __block_address(block, 0, BAD_BLOCK_BYTE, &addr);
+            if (NAND_Page_Read(hspi, &addr, &bad_block_mark, 1) != Ret_Success) {
+                status = Ret_ReadFailed;
+                break;
+            }
+            if (bad_block_mark != 0xFF) {
+                log_page = (log_page + NUM_PAGES_PER_BLOCK) % LOG_PAGES;
+                continue;
+            }
+            if (NAND_Block_Erase(hspi, &addr) != Ret_Success) {
+                status = Ret_EraseFailed;
+                break;
+            }
+        }
+
+        /* header, then the records, which may wrap around the end of the ring */
+        uint32_t count = ring_head - ring_tail;
+        if (count > NAND_TRACE_RECORDS_PER_PAGE) {
+            count = NAND_TRACE_RECORDS_PER_PAGE;
+        }
+        uint32_t first = ring_tail % NAND_TRACE_RECORDS;
+        uint32_t run   = (count < NAND_TRACE_RECORDS - first) ? count : NAND_TRACE_RECORDS - first;
+
+        header.magic    = NAND_TRACE_MAGIC;
+        header.sequence = log_sequence;
+        header.count    = count;
+        header.dropped  = dropped;
+
+        SPI_Params segments[3] = {
+            { .buffer = (uint8_t *) &header,        .length = sizeof(header) },
+            { .buffer = (uint8_t *) &ring[first],   .length = run * sizeof(NAND_TraceRecord) },
+            { .buffer = (uint8_t *) ring,           .length = (count - run) * sizeof(NAND_TraceRecord) },
+        };
+
+        __block_address(block, page, 0, &addr);
+        log_page = (log_page + 1) % LOG_PAGES;
+        log_sequence++;
+
+        if (NAND_Page_Program_Segments(hspi, &addr, segments, (count > run) ? 3 : 2) != Ret_Success) {
+            status = Ret_ProgramFailed;
+            break;
+        }
+        ring_tail += count;
+        dropped    = 0;
+    }
+
+    enabled = was_enabled;
+    NAND_OS_Unlock();
+
+    return status;
+}
+
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+/**
+    @brief Appends a record for an operation that began at start (NAND_OS_Time_us) and just
+           returned status. Overwrites the oldest record if the ring is full.
+    @note Called with the device lock held.
+ */
+void __trace_record(uint8_t op, uint32_t start, uint32_t address, uint32_t length, uint16_t arg, uint8_t status) {
+    if (!enabled) {
+        return;
+    }
+    if (ring_head - ring_tail == NAND_TRACE_RECORDS) {
+        ring_tail++;
+        dropped++;
+    }
+
+    NAND_TraceRecord *record = &ring[ring_head % NAND_TRACE_RECORDS];
+    record -> time_us     = start;
+    record -> duration_us = NAND_OS_Time_us() - start;
+    record -> address     = address;
+    record -> length      = length;
+    record -> op          = op;
+    record -> status      = status;
+    record -> arg         = arg;
+    ring_head++;
+}
+
+/**
+    @brief Finds the page after the newest one of the log in the reserved region, and the
+           sequence number to continue with.
+
+    @return NAND_ReturnType
+    @retval Ret_ReadFailed
+    @retval Ret_Success
+ */
+NAND_ReturnType __trace_find_end(SPI_HandleTypeDef *hspi) {
+    PhysicalAddrs addr;
+    NAND_TracePageHeader header;
+    uint32_t newest = LOG_UNKNOWN;
+
+    log_sequence = 0;
+    for (uint32_t i = 0; i < LOG_PAGES; i++) {
+        __block_address(NAND_TRACE_FIRST_BLOCK + i / NUM_PAGES_PER_BLOCK, i % NUM_PAGES_PER_BLOCK, 0, &addr);
+        if (NAND_Page_Read(hspi, &addr, (uint8_t *) &header, sizeof(header)) != Ret_Success) {
+            return Ret_ReadFailed;
+        }
+        if (header.magic == NAND_TRACE_MAGIC && (newest == LOG_UNKNOWN || header.sequence >= log_sequence)) {
+            newest       = i;
+            log_sequence = header.sequence + 1;
+        }
+    }
+
+    log_page = (newest == LOG_UNKNOWN) ? 0 : (newest + 1) % LOG_PAGES;
+    return Ret_Success;
+}
+
+#endif
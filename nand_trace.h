@@ -0,0 +1,118 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_trace.h
+    Description: Optional trace of driver operations (what, where, how much, when and for
+                 how long) in a RAM ring, saved to a reserved flash region or read out by
+                 the application, for replay on a host with tools/nand_replay.c.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Version History.
+
+    Ver.        Date            Comments
+
+    0.1        Jan 2022         In Development
+
+********************************************************************************
+
+    The following functions are available in this library:
+
+
+********************************************************************************/
+
+#ifndef NAND_TRACE_H
+#define NAND_TRACE_H
+
+#include "nand_m79a_lld.h"
+
+/*
+    With NAND_TRACE set to 1, every nand_m79a API call and every page read, page program and
+    block erase of nand_m79a_lld appends a record to a ring of NAND_TRACE_RECORDS records in
+    RAM, 20 bytes each; once the ring is full, the oldest records are overwritten. A record is
+    appended when its operation returns, so an API call comes after the page operations it
+    caused. Timestamps come from NAND_OS_Time_us and have the resolution of the OS port.
+
+    The application takes records out with NAND_Trace_Read, e.g. to send them to a host, or
+    has NAND_Trace_Save program them into NAND_TRACE_NUM_BLOCKS blocks starting at
+    NAND_TRACE_FIRST_BLOCK, outside the FTL region. Saved pages form a log that wraps around,
+    erasing its oldest block; the data area of the region, dumped as is, is a trace file for
+    tools/nand_replay.c, and so is a file of records from NAND_Trace_Read.
+*/
+#ifndef NAND_TRACE
+    #define NAND_TRACE          0
+#endif
+#define NAND_TRACE_RECORDS      256
+#define NAND_TRACE_FIRST_BLOCK  65
+#define NAND_TRACE_NUM_BLOCKS   4
+
+/* Traced operations. Those of nand_m79a_lld start at NAND_TRACE_LLD. */
+typedef enum {
+    NAND_TRACE_INIT         = 0x01,
+    NAND_TRACE_READ         = 0x02,
+    NAND_TRACE_WRITE        = 0x03,
+    NAND_TRACE_TRIM         = 0x04,
+    NAND_TRACE_SYNC         = 0x05,
+    NAND_TRACE_IDLE         = 0x06,
+    NAND_TRACE_TXN_BEGIN    = 0x07,
+    NAND_TRACE_TXN_WRITE    = 0x08,
+    NAND_TRACE_TXN_COMMIT   = 0x09,
+    NAND_TRACE_TXN_ABORT    = 0x0A,
+    NAND_TRACE_LLD          = 0x40,
+    NAND_TRACE_PAGE_READ    = 0x40,
+    NAND_TRACE_PAGE_PROGRAM = 0x41,
+    NAND_TRACE_BLOCK_ERASE  = 0x42,
+} NAND_TraceOp;
+
+typedef struct {
+    uint32_t time_us;       // NAND_OS_Time_us when the operation started
+    uint32_t duration_us;
+    uint32_t address;       // API calls: logical address; page operations: block * NUM_PAGES_PER_BLOCK + page
+    uint32_t length;        // bytes transferred, 0 for erases and calls without data
+    uint8_t  op;            // NAND_TraceOp
+    uint8_t  status;        // NAND_ReturnType returned
+    uint16_t arg;           // writes: stream; page operations: column
+} NAND_TraceRecord;
+
+/* Data area of a page saved by NAND_Trace_Save: this header, then count records */
+typedef struct {
+    uint32_t magic;         // NAND_TRACE_MAGIC
+    uint32_t sequence;      // of the page in the log, the newest is the highest
+    uint32_t count;
+    uint32_t dropped;       // records overwritten in the ring before this page was saved
+} NAND_TracePageHeader;
+#define NAND_TRACE_MAGIC            0x4352544E  /* "NTRC" */
+#define NAND_TRACE_RECORDS_PER_PAGE ((PAGE_DATA_SIZE - sizeof(NAND_TracePageHeader)) / sizeof(NAND_TraceRecord))
+
+/* Record an operation: take the start time before it, and append the record after */
+#if NAND_TRACE
+    #define NAND_TRACE_START()                                      NAND_OS_Time_us()
+    #define NAND_TRACE_END(op, start, address, length, arg, status) __trace_record(op, start, address, length, arg, status)
+#else
+    #define NAND_TRACE_START()                                      0
+    #define NAND_TRACE_END(op, start, address, length, arg, status) ((void) (start))
+#endif
+
+#if NAND_TRACE
+
+/******************************************************************************
+ *                              Internal Functions
+ *****************************************************************************/
+
+void __trace_record(uint8_t op, uint32_t start, uint32_t address, uint32_t length, uint16_t arg, uint8_t status);
+NAND_ReturnType __trace_find_end(SPI_HandleTypeDef *hspi);
+
+/******************************************************************************
+ *                              List of APIs
+ *****************************************************************************/
+
+void NAND_Trace_Enable(uint8_t enable);
+uint32_t NAND_Trace_Read(NAND_TraceRecord *records, uint32_t max_records);
+uint32_t NAND_Trace_Dropped(void);
+NAND_ReturnType NAND_Trace_Save(SPI_HandleTypeDef *hspi);
+
+#endif
+
+#endif
@@ -0,0 +1,351 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_sim.c
+    Description: Simulated SPI NAND behind the host HAL stand-in, with a virtual clock, so
+                 that host tools can run the drivers unchanged and time what they do.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nand_sim.h"
+#include "nand_m79a_lld.h"
+
+#ifdef NAND_AUTODETECT
+    #error "Select a part in nand_m79a_lld.h to simulate"
+#endif
+
+#define MAX_COMMAND     (PAGE_SIZE + 8)
+
+GPIO_TypeDef nand_sim_gpiob;
+
+static uint8_t *blocks[NUM_BLOCKS];             // allocated on the first program
+static uint32_t erase_count[NUM_BLOCKS];
+static uint8_t  cache[PAGE_SIZE];
+static uint8_t  data_reg[PAGE_SIZE];            // last page read from the array
+static uint8_t  command[MAX_COMMAND];           // bytes sent since chip select went low
+static uint32_t command_length;
+static uint32_t received;                       // bytes received since chip select went low
+static uint8_t  selected;
+
+static uint8_t  status_reg;
+static uint8_t  config_reg = SPI_NAND_ECC_EN;
+static uint8_t  lock_reg;
+static uint8_t  die_reg;
+
+static double   clock_hz = 32e6;                // peripheral clock the SPI prescaler divides
+static uint32_t prescaler = 2;
+static uint64_t now_ns;
+static uint64_t busy_until_ns;
+static uint64_t array_busy_until_ns;            // end of the array read behind a cache read
+static NAND_SimCounters counters;
+static uint8_t  event_flag;
+
+
+/******************************************************************************
+ *                              Simulator Control
+ *****************************************************************************/
+
+/**
+    @brief Erases the whole device, resets the clock and counters, and sets the peripheral
+           clock the SPI prescaler divides.
+ */
+void NAND_Sim_Reset(double peripheral_clock_hz) {
+    for (uint32_t block = 0; block < NUM_BLOCKS; block++) {
+        free(blocks[block]);
+        blocks[block] = NULL;
+    }
+    memset(erase_count, 0, sizeof(erase_count));
+    memset(&counters, 0, sizeof(counters));
+    clock_hz            = peripheral_clock_hz;
+    now_ns              = 0;
+    busy_until_ns       = 0;
+    array_busy_until_ns = 0;
+    status_reg          = 0;
+    die_reg             = 0;
+}
+
+uint64_t NAND_Sim_Time_ns(void) {
+    return now_ns;
+}
+
+void NAND_Sim_Get_Counters(NAND_SimCounters *result) {
+    *result = counters;
+}
+
+uint32_t NAND_Sim_Erase_Count(uint16_t block) {
+    return (block < NUM_BLOCKS) ? erase_count[block] : 0;
+}
+
+/* 1 if every byte of the block reads 0xFF */
+uint8_t NAND_Sim_Is_Erased(uint16_t block) {
+    if (block >= NUM_BLOCKS || blocks[block] == NULL) {
+        return block < NUM_BLOCKS;
+    }
+    for (uint32_t i = 0; i < (uint32_t) NUM_PAGES_PER_BLOCK * PAGE_SIZE; i++) {
+        if (blocks[block][i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/******************************************************************************
+ *                              Device
+ *****************************************************************************/
+
+/* block addressed by a row address, taking the selected die into account */
+static uint32_t row_block(const uint8_t *row) {
+    uint32_t address = ((uint32_t) row[0] << 16) | ((uint32_t) row[1] << 8) | row[2];
+    uint32_t die     = (die_reg & SPI_NAND_DS0) ? 1 : 0;
+
+    return ((die << DIE_BLOCK_BITS) | (address >> ROW_ADDRESS_PAGE_BITS)) % NUM_BLOCKS;
+}
+
+static uint8_t *page_of(const uint8_t *row) {
+    uint32_t block = row_block(row);
+    uint32_t page  = row[2] & (NUM_PAGES_PER_BLOCK - 1);
+
+    if (blocks[block] == NULL) {
+        blocks[block] = malloc((size_t) NUM_PAGES_PER_BLOCK * PAGE_SIZE);
+        memset(blocks[block], 0xFF, (size_t) NUM_PAGES_PER_BLOCK * PAGE_SIZE);
+    }
+    return &blocks[block][page * PAGE_SIZE];
+}
+
+static uint32_t column_of(const uint8_t *column) {
+    return (((uint32_t) column[0] << 8) | column[1]) & ((1 << COL_ADDRESS_BITS) - 1);
+}
+
+/* carries out the command sent while chip select was low */
+static void execute(void) {
+    if (command_length == 0) {
+        return;
+    }
+
+    switch (command[0]) {
+    case SPI_NAND_RESET:
+        status_reg = 0;
+        die_reg    = 0;
+        break;
+    case SPI_NAND_WRITE_ENABLE:
+        status_reg |= SPI_NAND_WEL;
+        break;
+    case SPI_NAND_WRITE_DISABLE:
+        status_reg &= ~SPI_NAND_WEL;
+        break;
+    case SPI_NAND_SET_FEATURES:
+        if (command_length >= 3 && command[1] == SPI_NAND_CFG_REG_ADDR) {
+            config_reg = command[2];
+        } else if (command_length >= 3 && command[1] == SPI_NAND_BLKLOCK_REG_ADDR) {
+            lock_reg = command[2];
+        } else if (command_length >= 3 && command[1] == SPI_NAND_DIE_SEL_REG_ADDR) {
+            die_reg = command[2];
+        }
+        break;
+    case SPI_NAND_PAGE_READ:
+        if (command_length >= 4) {
+            memcpy(data_reg, page_of(&command[1]), PAGE_SIZE);
+            memcpy(cache, data_reg, PAGE_SIZE);
+            busy_until_ns = array_busy_until_ns = now_ns + T_RD_TYP_US * 1000ULL;
+            counters.page_reads++;
+        }
+        break;
+    case SPI_NAND_READ_PAGE_CACHE_RANDOM:
+    case SPI_NAND_READ_PAGE_CACHE_LAST: {
+        /* the page read before moves to the cache once its array read is done; RANDOM then
+         * reads the next page into the data register while the cache is read out */
+        uint64_t start_ns = (now_ns > array_busy_until_ns) ? now_ns : array_busy_until_ns;
+        memcpy(cache, data_reg, PAGE_SIZE);
+        busy_until_ns = start_ns + T_RCBSY_TYP_US * 1000ULL;
+        if (command[0] == SPI_NAND_READ_PAGE_CACHE_RANDOM && command_length >= 4) {
+            memcpy(data_reg, page_of(&command[1]), PAGE_SIZE);
+            array_busy_until_ns = start_ns + T_RD_TYP_US * 1000ULL;
+            counters.page_reads++;
+        }
+        break;
+    }
+    case SPI_NAND_PROGRAM_LOAD_X1:
+        memset(cache, 0xFF, sizeof(cache));
+        /* fall through */
+    case SPI_NAND_PROGRAM_LOAD_RANDOM_X1:
+        if (command_length >= 3) {
+            uint32_t column = column_of(&command[1]);
+            for (uint32_t i = 3; i < command_length && column < PAGE_SIZE; i++) {
+                cache[column++] = command[i];
+            }
+        }
+        break;
+    case SPI_NAND_PROGRAM_EXEC:
+        if (command_length >= 4 && (status_reg & SPI_NAND_WEL)) {
+            uint8_t *page = page_of(&command[1]);
+            for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+                page[i] &= cache[i];
+            }
+            busy_until_ns = now_ns + T_PROG_TYP_US * 1000ULL;
+            status_reg &= ~SPI_NAND_WEL;
+            counters.page_programs++;
+        }
+        break;
+    case SPI_NAND_BLOCK_ERASE:
+        if (command_length >= 4 && (status_reg & SPI_NAND_WEL)) {
+            uint32_t block = row_block(&command[1]);
+            free(blocks[block]);
+            blocks[block] = NULL;
+            erase_count[block]++;
+            busy_until_ns = now_ns + T_BERS_TYP_US * 1000ULL;
+            status_reg &= ~SPI_NAND_WEL;
+            counters.block_erases++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* the next byte the device shifts out for the command being received */
+static uint8_t output(void) {
+    switch (command[0]) {
+    case SPI_NAND_READ_ID:
+        return (received == 0) ? NAND_ID_MANUFACTURER : NAND_ID_DEVICE;
+    case SPI_NAND_GET_FEATURES:
+        if (command[1] == SPI_NAND_STATUS_REG_ADDR) {
+            return status_reg | ((now_ns < busy_until_ns) ? SPI_NAND_OIP : 0);
+        } else if (command[1] == SPI_NAND_CFG_REG_ADDR) {
+            return config_reg;
+        } else if (command[1] == SPI_NAND_BLKLOCK_REG_ADDR) {
+            return lock_reg;
+        } else {
+            return die_reg;
+        }
+    case SPI_NAND_READ_CACHE_X1: {
+        uint32_t column = column_of(&command[1]) + received;
+        return (column < PAGE_SIZE) ? cache[column] : 0xFF;
+    }
+    default:
+        return 0xFF;
+    }
+}
+
+/* bus time of a transfer */
+static void transfer_time(uint32_t bytes) {
+    now_ns += NAND_SIM_CALL_OVERHEAD_NS + (uint64_t) (bytes * 8 * 1e9 * prescaler / clock_hz);
+    counters.bus_bytes += bytes;
+}
+
+
+/******************************************************************************
+ *                              HAL
+ *****************************************************************************/
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+    (void) port;
+    (void) pin;
+
+    if (state == GPIO_PIN_RESET) {
+        command_length = 0;
+        received       = 0;
+        selected       = 1;
+    } else if (selected) {
+        execute();
+        selected = 0;
+    }
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi) {
+    prescaler = 2u << (hspi->Init.BaudRatePrescaler >> 3);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+    (void) hspi;
+    (void) timeout;
+
+    for (uint16_t i = 0; i < size && command_length < MAX_COMMAND; i++) {
+        command[command_length++] = data[i];
+    }
+    transfer_time(size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+    (void) hspi;
+    (void) timeout;
+
+    for (uint16_t i = 0; i < size; i++) {
+        data[i] = output();
+        received++;
+    }
+    transfer_time(size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size) {
+    HAL_SPI_Transmit(hspi, data, size, 0);
+    NAND_SPI_Transfer_Complete_ISR();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size) {
+    HAL_SPI_Receive(hspi, data, size, 0);
+    NAND_SPI_Transfer_Complete_ISR();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+    return HAL_OK;
+}
+
+uint32_t HAL_SPI_GetError(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+    return HAL_SPI_ERROR_NONE;
+}
+
+void HAL_Delay(uint32_t milliseconds) {
+    now_ns += milliseconds * 1000000ULL;
+}
+
+uint32_t HAL_GetTick(void) {
+    return (uint32_t) (now_ns / 1000000);
+}
+
+
+/******************************************************************************
+ *                              OS Hooks
+ *****************************************************************************/
+
+void NAND_OS_Sleep_us(uint32_t microseconds) {
+    now_ns += microseconds * 1000ULL;
+}
+
+void NAND_OS_Yield(void) {
+}
+
+uint32_t NAND_OS_Time_us(void) {
+    return (uint32_t) (now_ns / 1000);
+}
+
+void NAND_OS_Lock(void) {
+}
+
+void NAND_OS_Unlock(void) {
+}
+
+uint8_t NAND_OS_Wait_Event(uint32_t timeout_us) {
+    if (!event_flag) {
+        now_ns += timeout_us * 1000ULL;
+        return 0;
+    }
+    event_flag = 0;
+    return 1;
+}
+
+void NAND_OS_Signal_From_ISR(void) {
+    event_flag = 1;
+}
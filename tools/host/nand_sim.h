@@ -0,0 +1,47 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_sim.h
+    Description: Simulated SPI NAND behind the host HAL stand-in, with a virtual clock, so
+                 that host tools can run the drivers unchanged and time what they do.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    The simulated part is the one selected in nand_m79a_lld.h; NAND_AUTODETECT is not
+    supported. It starts out erased, with no bad blocks and ECC never failing.
+
+    Time only passes when the drivers do something: every byte on the bus takes 8 SPI clock
+    cycles at the prescaler set through HAL_SPI_Init, every HAL transfer call a fixed
+    overhead, and page reads, programs and erases the typical array times of
+    nand_m79a_lld.h, during which the status register reports busy. READ PAGE CACHE RANDOM
+    and LAST are busy for tRCBSY after the array read before them is done, the next array
+    read going on behind the cache. Sleeps of the drivers advance the clock by the time asked.
+
+    The OS hooks of nand_os.h are implemented here on the virtual clock, for a single thread:
+    build tools with nand_sim.c instead of a nand_os_<port>.c.
+
+********************************************************************************/
+
+#ifndef NAND_SIM_H
+#define NAND_SIM_H
+
+#include <stdint.h>
+
+#define NAND_SIM_CALL_OVERHEAD_NS   2000    /* per HAL SPI call, roughly an STM32L0 at 32 MHz */
+
+typedef struct {
+    uint64_t page_reads;
+    uint64_t page_programs;
+    uint64_t block_erases;
+    uint64_t bus_bytes;
+} NAND_SimCounters;
+
+void NAND_Sim_Reset(double peripheral_clock_hz);
+uint64_t NAND_Sim_Time_ns(void);
+void NAND_Sim_Get_Counters(NAND_SimCounters *counters);
+uint32_t NAND_Sim_Erase_Count(uint16_t block);
+uint8_t NAND_Sim_Is_Erased(uint16_t block);
+
+#endif
@@ -0,0 +1,73 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    stm32l0xx_hal.h
+    Description: Host stand-in for the STM32L0 HAL header, so that tools built on Linux can
+                 include the driver headers for their geometry and on-flash formats, and
+                 run the drivers against the simulated device of nand_sim.c.
+                 Only what the drivers refer to is declared.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************/
+
+#ifndef STM32L0XX_HAL_H
+#define STM32L0XX_HAL_H
+
+#include <stdint.h>
+
+typedef enum {
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef struct {
+    uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct {
+    void *Instance;
+    SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+typedef struct {
+    uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef nand_sim_gpiob;
+#define GPIOB                       (&nand_sim_gpiob)
+#define GPIO_PIN_12                 ((uint16_t) 0x1000)
+#define GPIO_PIN_13                 ((uint16_t) 0x2000)
+#define GPIO_PIN_14                 ((uint16_t) 0x4000)
+#define GPIO_PIN_15                 ((uint16_t) 0x8000)
+
+#define SPI_BAUDRATEPRESCALER_2     0x00000000U
+#define SPI_BAUDRATEPRESCALER_4     0x00000008U
+#define SPI_BAUDRATEPRESCALER_8     0x00000010U
+#define SPI_BAUDRATEPRESCALER_16    0x00000018U
+#define SPI_BAUDRATEPRESCALER_32    0x00000020U
+#define SPI_BAUDRATEPRESCALER_64    0x00000028U
+#define SPI_BAUDRATEPRESCALER_128   0x00000030U
+#define SPI_BAUDRATEPRESCALER_256   0x00000038U
+
+#define HAL_SPI_ERROR_NONE          0x00000000U
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+uint32_t HAL_SPI_GetError(SPI_HandleTypeDef *hspi);
+void HAL_Delay(uint32_t milliseconds);
+uint32_t HAL_GetTick(void);
+
+#endif
@@ -0,0 +1,458 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_image.c
+    Description: Host tool building a raw NAND image (data plus spare area) that mounts
+                 with the flash translation layer as if its contents had been written by
+                 NAND_Write, for factory programming with NAND_Image_Program.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Build and run on a Linux host from the repository root:
+
+        gcc -O2 -pthread -I. -Itools/host tools/nand_image.c nand_lz.c nand_crc.c -o nand_image
+        ./nand_image [-j threads] [-b bad_blocks.txt] -o image.bin input
+
+    The geometry, spare area layout and FTL configuration (including NAND_COMPRESSION and
+    NAND_PAGE_CRC) come from the driver headers, so build the tool with the same headers
+    as the firmware.
+
+    input is either a file, stored from logical address 0, or a directory, whose regular
+    files are stored one after the other in name order, each starting on a page boundary.
+    Their logical addresses are printed. Pages that are all 0xFF are left unmapped, since
+    they read back the same.
+
+    The bad block table lists the device's bad blocks, one block number per line; '#'
+    starts a comment. Bad blocks are left empty in the image and the FTL skips them.
+
+    The image covers every block of the device, PAGE_SIZE bytes per page. Page contents
+    are compressed and rendered on all cores. The on-die ECC parity in the spare area is
+    left erased: the device computes it while programming, so on-die ECC must be enabled.
+
+********************************************************************************/
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nand_m79a.h"
+
+#ifdef NAND_AUTODETECT
+    #error "Select the part in nand_m79a_lld.h: the image layout depends on its geometry"
+#endif
+
+#define MAX_THREADS     256
+#define FTL_PAGES       (NAND_FTL_NUM_BLOCKS * NUM_PAGES_PER_BLOCK)
+
+/* logical page contents, found in parallel */
+typedef struct {
+    uint8_t  erased;        // all 0xFF, left unmapped
+    uint16_t length;        // compressed length, 0 if stored uncompressed
+} LogicalPage;
+
+/* what each physical page of the FTL region holds, laid out in order */
+typedef struct {
+    uint8_t  type;          // PageTagType
+    uint8_t  count;         // packed: number of chunks
+    uint32_t first;         // data: logical page; packed: index of the first chunk in pack_order
+    uint32_t sequence;
+} PhysicalPage;
+
+static uint8_t *input;                                  // NAND_LOGICAL_SIZE_BYTES of logical data
+static LogicalPage logical[NAND_NUM_LOGICAL_PAGES];
+static uint8_t *compressed;                             // NAND_PACK_RAW_THRESHOLD bytes per logical page
+static PhysicalPage physical[FTL_PAGES];
+static uint32_t pack_order[NAND_NUM_LOGICAL_PAGES];     // logical pages in packed pages, in order
+static uint8_t  bad_block[NUM_BLOCKS];
+static uint8_t  free_list[FREE_LIST_SIZE];
+static uint8_t *image;                                  // the FTL region, PAGE_SIZE bytes per page
+
+
+/******************************************************************************
+ *                              Parallel Loops
+ *****************************************************************************/
+
+typedef struct {
+    void (*body)(uint32_t first, uint32_t end);
+    uint32_t first;
+    uint32_t end;
+} WorkRange;
+
+static void *run_range(void *arg) {
+    WorkRange *range = arg;
+    range->body(range->first, range->end);
+    return NULL;
+}
+
+/* calls body over [0, count), split into contiguous ranges, one per thread */
+static void parallel_for(void (*body)(uint32_t first, uint32_t end), uint32_t count, int threads) {
+    pthread_t thread[MAX_THREADS];
+    WorkRange range[MAX_THREADS];
+
+    for (int t = 0; t < threads; t++) {
+        range[t].body  = body;
+        range[t].first = (uint64_t) count * t / threads;
+        range[t].end   = (uint64_t) count * (t + 1) / threads;
+        if (pthread_create(&thread[t], NULL, run_range, &range[t]) != 0) {
+            run_range(&range[t]);
+            thread[t] = 0;
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        if (thread[t] != 0) {
+            pthread_join(thread[t], NULL);
+        }
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/******************************************************************************
+ *                                  Input
+ *****************************************************************************/
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* reads path into input at *fill, and advances *fill past it */
+static int load_file(const char *path, uint32_t *fill) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t length = fread(&input[*fill], 1, NAND_LOGICAL_SIZE_BYTES - *fill, file);
+    int too_large = (fgetc(file) != EOF);
+    fclose(file);
+    if (too_large) {
+        fprintf(stderr, "%s: does not fit in the %u byte logical space\n", path, NAND_LOGICAL_SIZE_BYTES);
+        return -1;
+    }
+    *fill += length;
+    return 0;
+}
+
+static int load_input(const char *path) {
+    struct stat info;
+    uint32_t fill = 0;
+
+    if (stat(path, &info) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        return load_file(path, &fill);
+    }
+
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    char **names = NULL;
+    size_t count = 0;
+
+    if (dir == NULL) {
+        perror(path);
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        names = realloc(names, (count + 1) * sizeof(char *));
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char *), compare_names);
+
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", path, names[i]);
+        if (stat(full, &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        uint32_t start = fill;
+        status = load_file(full, &fill);
+        if (status == 0) {
+            printf("0x%08x %10u  %s\n", start, fill - start, names[i]);
+        }
+        fill = (fill + PAGE_DATA_SIZE - 1) / PAGE_DATA_SIZE * PAGE_DATA_SIZE;
+        if (fill > NAND_LOGICAL_SIZE_BYTES) {
+            fill = NAND_LOGICAL_SIZE_BYTES;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return status;
+}
+
+static int load_bad_blocks(const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *end;
+        line[strcspn(line, "#\r\n")] = '\0';
+        unsigned long block = strtoul(line, &end, 0);
+        if (end == line) {
+            continue;
+        }
+        if (block >= NUM_BLOCKS) {
+            fprintf(stderr, "%s: block %lu out of range\n", path, block);
+            fclose(file);
+            return -1;
+        }
+        bad_block[block] = 1;
+    }
+    fclose(file);
+    return 0;
+}
+
+
+/******************************************************************************
+ *                                  Layout
+ *****************************************************************************/
+
+/* finds erased pages and compresses the rest, like __ftl_write_compressed */
+static void classify_pages(uint32_t first, uint32_t end) {
+    for (uint32_t page = first; page < end; page++) {
+        const uint8_t *data = &input[(size_t) page * PAGE_DATA_SIZE];
+        uint16_t i = 0;
+
+        while (i < PAGE_DATA_SIZE && data[i] == 0xFF) {
+            i++;
+        }
+        logical[page].erased = (i == PAGE_DATA_SIZE);
+        logical[page].length = 0;
+#if NAND_COMPRESSION
+        if (!logical[page].erased) {
+            logical[page].length = NAND_LZ_Compress(data, PAGE_DATA_SIZE, &compressed[(size_t) page * NAND_PACK_RAW_THRESHOLD],
+                                                    NAND_PACK_RAW_THRESHOLD);
+        }
+#endif
+    }
+}
+
+/* next physical page of the FTL region, skipping bad blocks; FTL_PAGES when full */
+static uint32_t next_physical(uint32_t *cursor) {
+    while (*cursor < FTL_PAGES && bad_block[NAND_FTL_FIRST_BLOCK + *cursor / NUM_PAGES_PER_BLOCK]) {
+        *cursor += NUM_PAGES_PER_BLOCK;
+    }
+    return (*cursor < FTL_PAGES) ? (*cursor)++ : FTL_PAGES;
+}
+
+/* places every page in write order, as NAND_Write followed by NAND_Sync would */
+static int layout_pages(uint32_t *programmed, uint16_t *last_block) {
+    uint32_t cursor = 0, sequence = 1, packed = 0, phys;
+    uint8_t pack_count = 0;
+    uint16_t pack_fill = NAND_PACK_HEADER_SIZE;
+
+    for (uint32_t i = 0; i < FTL_PAGES; i++) {
+        physical[i].type = PAGE_TAG_ERASED;
+    }
+
+    for (uint32_t page = 0; page <= NAND_NUM_LOGICAL_PAGES; page++) {
+        uint8_t last = (page == NAND_NUM_LOGICAL_PAGES);
+
+        /* a packed page is programmed when the next chunk does not fit, and at the end */
+        if (pack_count > 0 && (last || (!logical[page].erased && logical[page].length > 0 &&
+                               (pack_count == NAND_PACK_MAX_CHUNKS || pack_fill + logical[page].length > PAGE_DATA_SIZE)))) {
+            if ((phys = next_physical(&cursor)) == FTL_PAGES) {
+                return -1;
+            }
+            physical[phys] = (PhysicalPage) { PAGE_TAG_PACKED, pack_count, packed - pack_count, sequence++ };
+            pack_count = 0;
+            pack_fill  = NAND_PACK_HEADER_SIZE;
+        }
+        if (last || logical[page].erased) {
+            continue;
+        }
+
+        if (logical[page].length > 0) {
+            pack_order[packed++] = page;
+            pack_count++;
+            pack_fill += logical[page].length;
+        } else {
+            if ((phys = next_physical(&cursor)) == FTL_PAGES) {
+                return -1;
+            }
+            physical[phys] = (PhysicalPage) { PAGE_TAG_DATA, 0, page, sequence++ };
+        }
+    }
+
+    /* the blocks after the last one used are erased; say so, or the first NAND_Init erases them again */
+    if ((phys = next_physical(&cursor)) == FTL_PAGES) {
+        return -1;
+    }
+    physical[phys] = (PhysicalPage) { PAGE_TAG_FREE, 0, NAND_FTL_NUM_BLOCKS, sequence++ };
+    *programmed = sequence - 1;
+    *last_block = phys / NUM_PAGES_PER_BLOCK;
+
+    memset(free_list, 0, sizeof(free_list));
+    for (uint16_t block = *last_block + 1; block < NAND_FTL_NUM_BLOCKS; block++) {
+        if (!bad_block[NAND_FTL_FIRST_BLOCK + block]) {
+            free_list[block / 8] |= 1 << (block % 8);
+        }
+    }
+
+    return 0;
+}
+
+/* fills in the data and spare area of every page of blocks [first, end) of the FTL region */
+static void render_blocks(uint32_t first, uint32_t end) {
+    memset(&image[(size_t) first * NUM_PAGES_PER_BLOCK * PAGE_SIZE], 0xFF, (size_t) (end - first) * NUM_PAGES_PER_BLOCK * PAGE_SIZE);
+
+    for (uint32_t phys = first * NUM_PAGES_PER_BLOCK; phys < end * NUM_PAGES_PER_BLOCK; phys++) {
+        uint8_t *page = &image[(size_t) phys * PAGE_SIZE];
+        PhysicalPage *content = &physical[phys];
+        PageTag tag = {0};
+
+        if (content->type == PAGE_TAG_ERASED) {
+            continue;
+        }
+
+        tag.type     = content->type;
+        tag.sequence = content->sequence;
+
+        if (content->type == PAGE_TAG_DATA) {
+            tag.logical_page = content->first;
+            memcpy(page, &input[(size_t) content->first * PAGE_DATA_SIZE], PAGE_DATA_SIZE);
+        } else if (content->type == PAGE_TAG_PACKED) {
+            uint16_t fill = NAND_PACK_HEADER_SIZE;
+
+            tag.logical_page = content->count;
+            for (uint8_t slot = 0; slot < content->count; slot++) {
+                uint32_t logical_page = pack_order[content->first + slot];
+                NAND_PackEntry entry = { .logical_page = logical_page, .offset = fill, .length = logical[logical_page].length };
+
+                memcpy(&page[slot * sizeof(NAND_PackEntry)], &entry, sizeof(entry));
+                memcpy(&page[fill], &compressed[(size_t) logical_page * NAND_PACK_RAW_THRESHOLD], entry.length);
+                fill += entry.length;
+            }
+        } else {
+            tag.logical_page = content->first;
+            memcpy(page, free_list, FREE_LIST_SIZE);
+        }
+
+#if NAND_PAGE_CRC
+        tag.crc = NAND_CRC32C(0, page, PAGE_DATA_SIZE);
+#endif
+
+        /* the bad-block mark and the rest of the spare area are left erased */
+        memcpy(&page[PAGE_DATA_SIZE + SPARE_USER_OFFSET], &tag, sizeof(tag));
+    }
+}
+
+
+/******************************************************************************
+ *                                  Output
+ *****************************************************************************/
+
+static int write_image(const char *path) {
+    FILE *file = fopen(path, "wb");
+    static uint8_t erased_block[NUM_PAGES_PER_BLOCK * PAGE_SIZE];
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    memset(erased_block, 0xFF, sizeof(erased_block));
+
+    for (uint32_t block = 0; block < NUM_BLOCKS; block++) {
+        const uint8_t *data = erased_block;
+        if (block - NAND_FTL_FIRST_BLOCK < NAND_FTL_NUM_BLOCKS) {
+            data = &image[(size_t) (block - NAND_FTL_FIRST_BLOCK) * NUM_PAGES_PER_BLOCK * PAGE_SIZE];
+        }
+        if (fwrite(data, 1, sizeof(erased_block), file) != sizeof(erased_block)) {
+            perror(path);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    return fclose(file);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] [-b bad_blocks.txt] -o image.bin input_file_or_directory\n", name);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL, *bad_blocks = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t programmed = 0;
+    uint16_t last_block = 0;
+    int option;
+    double t0, t1, t2, t3;
+
+    while ((option = getopt(argc, argv, "j:b:o:")) != -1) {
+        switch (option) {
+            case 'j': threads = atoi(optarg); break;
+            case 'b': bad_blocks = optarg; break;
+            case 'o': output = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (output == NULL || optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+
+    input      = malloc(NAND_LOGICAL_SIZE_BYTES);
+    compressed = malloc((size_t) NAND_NUM_LOGICAL_PAGES * NAND_PACK_RAW_THRESHOLD);
+    image      = malloc((size_t) FTL_PAGES * PAGE_SIZE);
+    if (input == NULL || compressed == NULL || image == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(input, 0xFF, NAND_LOGICAL_SIZE_BYTES);
+
+    if (load_input(argv[optind]) != 0 || (bad_blocks != NULL && load_bad_blocks(bad_blocks) != 0)) {
+        return 1;
+    }
+
+    t0 = now_seconds();
+    parallel_for(classify_pages, NAND_NUM_LOGICAL_PAGES, threads);
+    t1 = now_seconds();
+    if (layout_pages(&programmed, &last_block) != 0) {
+        fprintf(stderr, "not enough good blocks in the FTL region\n");
+        return 1;
+    }
+    t2 = now_seconds();
+    parallel_for(render_blocks, NAND_FTL_NUM_BLOCKS, threads);
+    t3 = now_seconds();
+
+    if (write_image(output) != 0) {
+        return 1;
+    }
+
+    printf("%u pages to program in blocks %u..%u, %d threads\n", programmed, NAND_FTL_FIRST_BLOCK,
+           NAND_FTL_FIRST_BLOCK + last_block, threads);
+    printf("classify %.3f s, layout %.3f s, render %.3f s\n", t1 - t0, t2 - t1, t3 - t2);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_lz_bench.c
+    Description: Host benchmark comparing nand_lz codec throughput with the time it takes
+                 to move a page over the SPI bus.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Build and run on a Linux host from the repository root:
+
+        gcc -O2 -I. tools/nand_lz_bench.c nand_lz.c -o nand_lz_bench
+        ./nand_lz_bench [spi_clock_hz] [pages]
+
+    Input is synthetic telemetry: fixed-size records with a timestamp and slowly drifting,
+    slightly noisy sensor channels. Host timings are an upper bound for what a Cortex-M0+
+    reaches; scale them by the clock and IPC ratio of the target.
+
+********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nand_lz.h"
+
+#define PAGE_DATA_SIZE  2048
+#define SPI_OVERHEAD    4       /* command and address bytes per transfer */
+
+typedef struct {
+    uint32_t timestamp;
+    int16_t  channel[6];
+    uint16_t status;
+    uint16_t crc;
+} TelemetryRecord;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_telemetry(uint8_t *page, uint32_t *timestamp, int16_t *level) {
+    TelemetryRecord record;
+
+    for (size_t i = 0; i + sizeof(record) <= PAGE_DATA_SIZE; i += sizeof(record)) {
+        record.timestamp = (*timestamp += 10);
+        for (int c = 0; c < 6; c++) {
+            if (rand() % 8 == 0) {
+                level[c] += (rand() % 3) - 1;
+            }
+            record.channel[c] = level[c] + ((rand() % 16 == 0) ? (rand() % 3) - 1 : 0);
+        }
+        record.status = 0x0001;
+        record.crc    = 0;
+        memcpy(&page[i], &record, sizeof(record));
+    }
+}
+
+int main(int argc, char **argv) {
+    double spi_hz  = (argc > 1) ? atof(argv[1]) : 4e6;
+    int pages      = (argc > 2) ? atoi(argv[2]) : 2000;
+    uint8_t *input = malloc((size_t) pages * PAGE_DATA_SIZE);
+    uint8_t *packed = malloc((size_t) pages * PAGE_DATA_SIZE);
+    uint16_t *lengths = malloc(pages * sizeof(uint16_t));
+    uint8_t output[PAGE_DATA_SIZE];
+    uint32_t timestamp = 0;
+    int16_t level[6] = {100, -40, 2000, 512, 0, 77};
+    uint64_t total_in = 0, total_out = 0;
+    double t0, compress_s, decompress_s;
+
+    if (input == NULL || packed == NULL || lengths == NULL || pages <= 0) {
+        return 1;
+    }
+
+    srand(1);
+    for (int p = 0; p < pages; p++) {
+        fill_telemetry(&input[(size_t) p * PAGE_DATA_SIZE], &timestamp, level);
+        memset(&input[(size_t) p * PAGE_DATA_SIZE + (PAGE_DATA_SIZE / sizeof(TelemetryRecord)) * sizeof(TelemetryRecord)],
+               0xFF, PAGE_DATA_SIZE % sizeof(TelemetryRecord));
+    }
+
+    t0 = now_seconds();
+    for (int p = 0; p < pages; p++) {
+        lengths[p] = NAND_LZ_Compress(&input[(size_t) p * PAGE_DATA_SIZE], PAGE_DATA_SIZE,
+                                      &packed[(size_t) p * PAGE_DATA_SIZE], PAGE_DATA_SIZE);
+        total_in  += PAGE_DATA_SIZE;
+        total_out += lengths[p];
+    }
+    compress_s = now_seconds() - t0;
+
+    t0 = now_seconds();
+    for (int p = 0; p < pages; p++) {
+        if (NAND_LZ_Decompress(&packed[(size_t) p * PAGE_DATA_SIZE], lengths[p], output, PAGE_DATA_SIZE) != PAGE_DATA_SIZE ||
+            memcmp(output, &input[(size_t) p * PAGE_DATA_SIZE], PAGE_DATA_SIZE) != 0) {
+            printf("round trip failed on page %d\n", p);
+            return 1;
+        }
+    }
+    decompress_s = now_seconds() - t0;
+
+    double ratio          = (double) total_in / total_out;
+    double page_spi_us    = (PAGE_DATA_SIZE + SPI_OVERHEAD) * 8 / spi_hz * 1e6;
+    double chunk_spi_us   = ((double) total_out / pages + SPI_OVERHEAD) * 8 / spi_hz * 1e6;
+    double compress_us    = compress_s / pages * 1e6;
+    double decompress_us  = decompress_s / pages * 1e6;
+
+    printf("pages                 %d x %d bytes\n", pages, PAGE_DATA_SIZE);
+    printf("compression ratio     %.2f : 1 (%.0f bytes per page)\n", ratio, (double) total_out / pages);
+    printf("compress              %8.2f us/page  %8.1f MB/s\n", compress_us, total_in / compress_s / 1e6);
+    printf("decompress            %8.2f us/page  %8.1f MB/s\n", decompress_us, total_in / decompress_s / 1e6);
+    printf("SPI x1 @ %.1f MHz\n", spi_hz / 1e6);
+    printf("  raw page transfer   %8.2f us/page\n", page_spi_us);
+    printf("  compressed transfer %8.2f us/page\n", chunk_spi_us);
+    printf("  bus time saved      %8.2f us/page (codec needs %.2f us on this host)\n",
+           page_spi_us - chunk_spi_us, compress_us);
+
+    free(input);
+    free(packed);
+    free(lengths);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_queue_test.c
+    Description: Host stress test of the submission queue: producer threads submit
+                 concurrently while a worker thread drains, and every write that reaches
+                 NAND_Write is checked for loss, duplication and reordering.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Build and run on a Linux host from the repository root:
+
+        gcc -O2 -pthread -I. -Itools/host tools/nand_queue_test.c nand_queue.c -o nand_queue_test
+        ./nand_queue_test [-p producers] [-n records] [-s seed]
+
+    Each producer logs records of random length, up to NAND_QUEUE_SLOT_SIZE bytes, one
+    after the other into its own part of the logical space, wrapping around at its end; a
+    record that does not fit before the end is submitted in two pieces. A record holds its
+    producer, its number in that producer's sequence and a pattern derived from both. A
+    refused submission (Ret_MemoryOverflow) is retried, as an application with
+    backpressure would.
+
+    NAND_Write and NAND_Sync are replaced by checking versions here, so nothing else of the
+    drivers is linked. They keep everything written to each producer's part as one stream;
+    every write must continue it where the last one ended, or rewrite bytes it already
+    holds with the same data, which the worker does after a failed write. Every record
+    must arrive whole and in sequence. One write in WRITE_FAIL_INTERVAL fails without
+    writing, to take the worker's retry path. The exit status is 1 if anything was lost,
+    duplicated, reordered or corrupted, or the queue counters disagree.
+
+********************************************************************************/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nand_queue.h"
+
+#define MAX_PRODUCERS       16
+#define RECORD_HEADER       8
+#define WRITE_FAIL_INTERVAL 97
+
+typedef struct {
+    uint32_t sequence;
+    uint16_t producer;
+    uint16_t length;        // of the whole record, header included
+} RecordHeader;
+
+typedef struct {
+    pthread_t thread;
+    uint16_t  id;
+    uint32_t  random_state;
+    uint32_t  offset;       // in its part of the logical space, where the next record goes
+    uint32_t  pieces;       // submissions accepted
+    uint32_t  refused;      // submissions refused and retried
+} Producer;
+
+static Producer producers[MAX_PRODUCERS];
+static uint16_t num_producers = 4;
+static uint32_t submissions   = 200000;  // records per producer
+static uint32_t region_size;                // bytes of the logical space per producer, whole pages
+static uint32_t producers_done;
+
+/* worker side: what NAND_Write received */
+static uint8_t *stream[MAX_PRODUCERS];     // everything written to each producer's part, in order
+static uint32_t stream_size[MAX_PRODUCERS];
+static uint32_t written[MAX_PRODUCERS];    // bytes of each stream so far
+static uint32_t parsed[MAX_PRODUCERS];     // bytes of each stream checked as records
+static uint32_t next_sequence[MAX_PRODUCERS];
+static uint32_t write_calls;
+static uint32_t failed_writes;
+static uint32_t errors;
+
+static void error(const char *format, uint32_t a, uint32_t b) {
+    if (errors++ < 10) {
+        printf("    ");
+        printf(format, a, b);
+        printf("\n");
+    }
+}
+
+static uint32_t next_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint8_t pattern(uint16_t producer, uint32_t sequence, uint16_t i) {
+    return (uint8_t) (sequence * 31 + producer * 7 + i);
+}
+
+
+/******************************************************************************
+ *                              Checking Writes
+ *****************************************************************************/
+
+/* checks the records that are complete in a stream; they must come in sequence */
+static void parse_records(uint16_t producer) {
+    uint8_t *region = stream[producer];
+    RecordHeader header;
+
+    while (written[producer] - parsed[producer] >= RECORD_HEADER) {
+        memcpy(&header, &region[parsed[producer]], sizeof(header));
+        if (header.producer != producer || header.length <= RECORD_HEADER ||
+            header.length > NAND_QUEUE_SLOT_SIZE) {
+            error("corrupt record header at offset %u of producer %u", parsed[producer], producer);
+            parsed[producer] = written[producer];
+            return;
+        }
+        if (written[producer] - parsed[producer] < header.length) {
+            return;
+        }
+        if (header.sequence != next_sequence[producer]) {
+            error("producer %u: record %u out of sequence", producer, header.sequence);
+        }
+        for (uint16_t i = RECORD_HEADER; i < header.length; i++) {
+            if (region[parsed[producer] + i] != pattern(producer, header.sequence, i)) {
+                error("producer %u: record %u corrupt", producer, header.sequence);
+                break;
+            }
+        }
+        next_sequence[producer] = header.sequence + 1;
+        parsed[producer] += header.length;
+    }
+}
+
+NAND_ReturnType NAND_Write(SPI_HandleTypeDef *hspi, NAND_Addr *address, uint8_t *buffer, uint32_t length) {
+    uint16_t producer = *address / region_size;
+    uint32_t offset   = *address % region_size;
+    uint32_t behind, overlap;
+
+    (void) hspi;
+    if (++write_calls % WRITE_FAIL_INTERVAL == 0) {
+        failed_writes++;
+        return Ret_ProgramFailed;
+    }
+    if (producer >= num_producers || length == 0 || length > region_size - offset) {
+        error("write of %u bytes at %u outside the producers' space", length, *address);
+        return Ret_AddressInvalid;
+    }
+    if (length > PAGE_DATA_SIZE - *address % PAGE_DATA_SIZE) {
+        error("write of %u bytes at %u crosses a page", length, *address);
+    }
+
+    /* a retry rewrites bytes already written, which must not change */
+    behind = (written[producer] % region_size + region_size - offset) % region_size;
+    if (behind > region_size / 2 || behind > written[producer]) {
+        error("producer %u: write at offset %u skips bytes", producer, offset);
+        return Ret_Success;
+    }
+    overlap = (behind < length) ? behind : length;
+    if (memcmp(&stream[producer][written[producer] - behind], buffer, overlap) != 0) {
+        error("producer %u: bytes at offset %u written twice with different data", producer, offset);
+    }
+
+    if (written[producer] + length - overlap > stream_size[producer]) {
+        stream_size[producer] = 2 * stream_size[producer] + PAGE_DATA_SIZE;
+        stream[producer] = realloc(stream[producer], stream_size[producer]);
+        if (stream[producer] == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(&stream[producer][written[producer]], &buffer[overlap], length - overlap);
+    written[producer] += length - overlap;
+
+    parse_records(producer);
+    return Ret_Success;
+}
+
+NAND_ReturnType NAND_Sync(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+    return Ret_Success;
+}
+
+
+/******************************************************************************
+ *                                  Threads
+ *****************************************************************************/
+
+/* submits data at the producer's offset, in two pieces if it wraps around; 0 on errors */
+static int submit(Producer *producer, uint8_t *data, uint16_t length) {
+    while (length > 0) {
+        uint16_t piece = length;
+        if (piece > region_size - producer->offset) {
+            piece = region_size - producer->offset;
+        }
+
+        for (;;) {
+            NAND_Addr address = producer->id * region_size + producer->offset;
+            NAND_ReturnType status = NAND_Queue_Write(&address, data, piece);
+            if (status == Ret_Success) {
+                break;
+            }
+            if (status != Ret_MemoryOverflow) {
+                printf("    producer %u: submission returned %u\n", producer->id, status);
+                return 0;
+            }
+            producer->refused++;
+            sched_yield();
+        }
+        producer->pieces++;
+        producer->offset = (producer->offset + piece) % region_size;
+        data   += piece;
+        length -= piece;
+    }
+    return 1;
+}
+
+static void *produce(void *arg) {
+    Producer *producer = arg;
+    uint8_t record[NAND_QUEUE_SLOT_SIZE];
+
+    for (uint32_t sequence = 0; sequence < submissions; sequence++) {
+        RecordHeader header = {
+            .sequence = sequence,
+            .producer = producer->id,
+            /* mostly short, sometimes a full slot, so records straddle pages */
+            .length   = (next_random(&producer->random_state) % 8 == 0) ? NAND_QUEUE_SLOT_SIZE :
+                        RECORD_HEADER + 1 + next_random(&producer->random_state) % 56,
+        };
+
+        memcpy(record, &header, sizeof(header));
+        for (uint16_t i = RECORD_HEADER; i < header.length; i++) {
+            record[i] = pattern(producer->id, sequence, i);
+        }
+
+        if (!submit(producer, record, header.length)) {
+            break;
+        }
+    }
+
+    __atomic_add_fetch(&producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    SPI_HandleTypeDef hspi;
+    NAND_QueueStats stats;
+    uint32_t seed = 1;
+    uint32_t pieces = 0, refused = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "p:n:s:")) != -1) {
+        switch (option) {
+        case 'p': num_producers = strtoul(optarg, NULL, 0); break;
+        case 'n': submissions   = strtoul(optarg, NULL, 0); break;
+        case 's': seed          = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-p producers] [-n records] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_producers < 1 || num_producers > MAX_PRODUCERS) {
+        fprintf(stderr, "1 to %d producers\n", MAX_PRODUCERS);
+        return 1;
+    }
+    /* whole pages, so that a run of the worker never spans two producers */
+    region_size = NAND_LOGICAL_SIZE_BYTES / num_producers / PAGE_DATA_SIZE * PAGE_DATA_SIZE;
+    memset(&hspi, 0, sizeof(hspi));
+    printf("%u producers, %u records each, %d slots of %d bytes\n", num_producers, submissions,
+           NAND_QUEUE_SLOTS, NAND_QUEUE_SLOT_SIZE);
+
+    for (uint16_t p = 0; p < num_producers; p++) {
+        producers[p].id           = p;
+        producers[p].random_state = seed * 2654435761u + p + 1;
+        if (pthread_create(&producers[p].thread, NULL, produce, &producers[p]) != 0) {
+            fprintf(stderr, "cannot start producer %u\n", p);
+            return 1;
+        }
+    }
+
+    /* this thread is the worker; failed writes are simply retried by the next call */
+    for (;;) {
+        uint8_t done = __atomic_load_n(&producers_done, __ATOMIC_ACQUIRE) == num_producers;
+
+        NAND_Queue_Process(&hspi);
+        if (done && NAND_Queue_Pending() == 0) {
+            break;
+        }
+        sched_yield();
+    }
+    while (NAND_Queue_Flush(&hspi) != Ret_Success) {
+    }
+    for (uint16_t p = 0; p < num_producers; p++) {
+        pthread_join(producers[p].thread, NULL);
+    }
+
+    for (uint16_t p = 0; p < num_producers; p++) {
+        if (next_sequence[p] != submissions) {
+            error("producer %u: %u records arrived", p, next_sequence[p]);
+        }
+        if (parsed[p] != written[p]) {
+            error("producer %u: %u bytes left over after the last record", p, written[p] - parsed[p]);
+        }
+        pieces  += producers[p].pieces;
+        refused += producers[p].refused;
+    }
+    NAND_Queue_Get_Stats(&stats);
+    if (stats.submitted != pieces) {
+        error("%u submissions counted, %u made", stats.submitted, pieces);
+    }
+    if (stats.rejected != refused) {
+        error("%u rejections counted, producers saw %u", stats.rejected, refused);
+    }
+
+    printf("%s: %u writes (%u failed and retried), %u submissions refused, high water %u of %d slots\n",
+           errors ? "FAILED" : "ok", write_calls, failed_writes, refused, stats.high_water, NAND_QUEUE_SLOTS);
+    return errors > 0;
+}
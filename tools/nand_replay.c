@@ -0,0 +1,351 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_replay.c
+    Description: Host replay of an operation trace (NAND_TRACE) through the driver, against
+                 a simulated device, to compare FTL settings on a workload from the field.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Build and run on a Linux host from the repository root, once per configuration of
+    nand_m79a.h to compare (the part simulated is the one selected in nand_m79a_lld.h):
+
+        gcc -O2 -I. -Itools/host tools/nand_replay.c tools/host/nand_sim.c nand_m79a.c \
+            nand_m79a_lld.c nand_spi.c nand_lz.c nand_crc.c nand_trace.c nand_pool.c -o nand_replay
+        ./nand_replay [-s clock_step] [-c hclk_hz] [-f fill_percent] [-g] trace.bin
+
+    trace.bin is either records as returned by NAND_Trace_Read, back to back, or a dump of
+    the data area of the trace region written by NAND_Trace_Save, in any page order.
+
+    The API calls of the trace are made again in order, on a device that starts out erased
+    and is mounted first. -f writes that share of the logical pages before the replay, so
+    that space reclamation starts from a realistic state. The data written is pseudo-random;
+    the trace does not record it, so compression ratios will differ from the field. The SPI
+    clock runs at hclk_hz (32 MHz by default) divided by 2 << clock_step (step 0 by default).
+    With -g, NAND_Idle is also called in the gaps between recorded calls, for as long as
+    the gap lasted and there is work pending, as a firmware idle task would.
+
+    Reported per call type: count, bytes, latency on the simulated device and as recorded;
+    then throughput, the flash operations of both runs, write amplification and erase
+    counts. Page operations in the trace are only counted, not replayed.
+
+********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nand_m79a.h"
+#include "nand_sim.h"
+
+#define NUM_OPS         (NAND_TRACE_TXN_ABORT + 1)
+#define NUM_LLD_OPS     (NAND_TRACE_BLOCK_ERASE - NAND_TRACE_LLD + 1)
+
+static const char *op_names[NUM_OPS] = {
+    [NAND_TRACE_INIT] = "init", [NAND_TRACE_READ] = "read", [NAND_TRACE_WRITE] = "write",
+    [NAND_TRACE_TRIM] = "trim", [NAND_TRACE_SYNC] = "sync", [NAND_TRACE_IDLE] = "idle",
+    [NAND_TRACE_TXN_BEGIN] = "txn begin", [NAND_TRACE_TXN_WRITE] = "txn write",
+    [NAND_TRACE_TXN_COMMIT] = "txn commit", [NAND_TRACE_TXN_ABORT] = "txn abort",
+};
+static const char *lld_names[NUM_LLD_OPS] = { "page reads", "page programs", "block erases" };
+
+typedef struct {
+    uint32_t count;
+    uint64_t bytes;
+    uint64_t field_us;      // total recorded duration
+    uint32_t field_max_us;
+    uint32_t *replay_us;    // latency of each call on the simulated device
+} OpStats;
+
+static OpStats ops[NUM_OPS];
+static OpStats lld_ops[NUM_LLD_OPS];
+static NAND_TraceRecord *records;
+static uint32_t num_records;
+static uint32_t dropped;
+static SPI_HandleTypeDef hspi;
+
+typedef struct {
+    uint32_t sequence;
+    uint8_t *data;
+} TracePage;
+
+static int by_sequence(const void *a, const void *b) {
+    uint32_t x = ((const TracePage *) a) -> sequence, y = ((const TracePage *) b) -> sequence;
+    return (x > y) - (x < y);
+}
+
+static int by_value(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* records of a trace file, in the order they were recorded */
+static int load_trace(const char *path) {
+    FILE *file = fopen(path, "rb");
+    uint8_t *data;
+    long size;
+    uint32_t magic = 0;
+
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) <= 0) {
+        return -1;
+    }
+    rewind(file);
+    data = malloc(size);
+    if (data == NULL || fread(data, 1, size, file) != (size_t) size) {
+        return -1;
+    }
+    fclose(file);
+    memcpy(&magic, data, size >= 4 ? 4 : 0);
+
+    if (magic != NAND_TRACE_MAGIC) {
+        if (size % sizeof(NAND_TraceRecord) != 0) {
+            return -1;
+        }
+        records     = (NAND_TraceRecord *) data;
+        num_records = size / sizeof(NAND_TraceRecord);
+        return 0;
+    }
+
+    /* saved pages: put them back in order, skipping erased ones */
+    uint32_t num_pages = size / PAGE_DATA_SIZE, used = 0;
+    TracePage *pages = malloc(num_pages * sizeof(TracePage));
+    records = malloc(num_pages * NAND_TRACE_RECORDS_PER_PAGE * sizeof(NAND_TraceRecord));
+    if (pages == NULL || records == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < num_pages; i++) {
+        NAND_TracePageHeader header;
+        memcpy(&header, &data[(size_t) i * PAGE_DATA_SIZE], sizeof(header));
+        if (header.magic == NAND_TRACE_MAGIC && header.count <= NAND_TRACE_RECORDS_PER_PAGE) {
+            pages[used].sequence = header.sequence;
+            pages[used].data     = &data[(size_t) i * PAGE_DATA_SIZE];
+            used++;
+        }
+    }
+    qsort(pages, used, sizeof(TracePage), by_sequence);
+    for (uint32_t i = 0; i < used; i++) {
+        NAND_TracePageHeader header;
+        memcpy(&header, pages[i].data, sizeof(header));
+        memcpy(&records[num_records], pages[i].data + sizeof(header), header.count * sizeof(NAND_TraceRecord));
+        num_records += header.count;
+        dropped     += header.dropped;
+    }
+    free(pages);
+    return 0;
+}
+
+static void fill_random(uint8_t *buffer, uint32_t length) {
+    static uint32_t state = 1;
+
+    for (uint32_t i = 0; i < length; i++) {
+        state = state * 1103515245u + 12345u;
+        buffer[i] = state >> 24;
+    }
+}
+
+/* makes the call a record stands for; returns what the driver returned */
+static NAND_ReturnType replay(const NAND_TraceRecord *record, uint8_t *buffer) {
+    NAND_Addr address = record -> address;
+
+    switch (record -> op) {
+    case NAND_TRACE_INIT:
+        return NAND_Init(&hspi);
+    case NAND_TRACE_READ:
+        return NAND_Read(&hspi, &address, buffer, record -> length);
+    case NAND_TRACE_WRITE:
+        fill_random(buffer, record -> length);
+        return NAND_Write_Stream(&hspi, &address, buffer, record -> length, record -> arg);
+    case NAND_TRACE_TRIM:
+        return NAND_Trim(&hspi, &address, record -> length);
+    case NAND_TRACE_SYNC:
+        return NAND_Sync(&hspi);
+    case NAND_TRACE_IDLE:
+        return NAND_Idle(&hspi);
+    case NAND_TRACE_TXN_BEGIN:
+        return NAND_Txn_Begin(&hspi);
+    case NAND_TRACE_TXN_WRITE:
+        fill_random(buffer, record -> length);
+        return NAND_Txn_Write(&hspi, &address, buffer, record -> length);
+    case NAND_TRACE_TXN_COMMIT:
+        return NAND_Txn_Commit(&hspi);
+    default:
+        return NAND_Txn_Abort(&hspi);
+    }
+}
+
+static void print_latency(const char *name, OpStats *stats) {
+    uint32_t n = stats -> count;
+    uint64_t total = 0;
+
+    qsort(stats -> replay_us, n, sizeof(uint32_t), by_value);
+    for (uint32_t i = 0; i < n; i++) {
+        total += stats -> replay_us[i];
+    }
+    printf("%-11s %8u %10.1f %9.1f %8u %8u %9u %9.1f %9u\n", name, n, stats -> bytes / 1024.0,
+           (double) total / n, stats -> replay_us[n / 2], stats -> replay_us[(uint64_t) n * 99 / 100],
+           stats -> replay_us[n - 1], (double) stats -> field_us / n, stats -> field_max_us);
+}
+
+int main(int argc, char **argv) {
+    int clock_step = 0, fill_percent = 0, idle_gaps = 0, option;
+    double hclk_hz = 32e6;
+    uint32_t max_length = PAGE_DATA_SIZE, mismatches = 0;
+    NAND_SimCounters before, after;
+    NAND_Stats stats_before, stats_after;
+
+    while ((option = getopt(argc, argv, "s:c:f:g")) != -1) {
+        switch (option) {
+        case 's': clock_step   = atoi(optarg); break;
+        case 'c': hclk_hz      = atof(optarg); break;
+        case 'f': fill_percent = atoi(optarg); break;
+        case 'g': idle_gaps    = 1;            break;
+        default:
+            fprintf(stderr, "usage: %s [-s clock_step] [-c hclk_hz] [-f fill_percent] [-g] trace.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || load_trace(argv[optind]) != 0) {
+        fprintf(stderr, "cannot read a trace from %s\n", optind < argc ? argv[optind] : "(none)");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_records; i++) {
+        const NAND_TraceRecord *record = &records[i];
+        OpStats *stats = (record -> op >= NAND_TRACE_LLD && record -> op - NAND_TRACE_LLD < NUM_LLD_OPS) ?
+                         &lld_ops[record -> op - NAND_TRACE_LLD] :
+                         (record -> op > 0 && record -> op < NUM_OPS) ? &ops[record -> op] : NULL;
+        if (stats == NULL) {
+            continue;
+        }
+        if (stats -> replay_us == NULL) {
+            stats -> replay_us = malloc(num_records * sizeof(uint32_t));
+        }
+        if (record -> op >= NAND_TRACE_LLD) {
+            stats -> count++;   // calls are counted as they are replayed
+        }
+        stats -> field_us += record -> duration_us;
+        if (record -> duration_us > stats -> field_max_us) {
+            stats -> field_max_us = record -> duration_us;
+        }
+        if (record -> op < NAND_TRACE_LLD && record -> length > max_length) {
+            max_length = record -> length;
+        }
+    }
+    uint8_t *buffer = malloc(max_length);
+
+    /* a fresh device, mounted and optionally filled before measuring */
+    NAND_Sim_Reset(hclk_hz);
+    hspi.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
+    if (NAND_SPI_Set_Clock(&hspi, clock_step) != SPI_OK || NAND_Init(&hspi) != Ret_Success) {
+        fprintf(stderr, "mount of the simulated device failed\n");
+        return 1;
+    }
+    for (uint32_t page = 0; page < (uint64_t) NAND_NUM_LOGICAL_PAGES * fill_percent / 100; page++) {
+        NAND_Addr address = page * PAGE_DATA_SIZE;
+        fill_random(buffer, PAGE_DATA_SIZE);
+        if (NAND_Write(&hspi, &address, buffer, PAGE_DATA_SIZE) != Ret_Success) {
+            fprintf(stderr, "fill failed at page %u\n", page);
+            return 1;
+        }
+    }
+    while (NAND_Idle_Pending()) {
+        NAND_Idle(&hspi);
+    }
+
+    NAND_Sim_Get_Counters(&before);
+    NAND_Get_Stats(&stats_before);
+    uint32_t *erases_before = malloc(NAND_FTL_NUM_BLOCKS * sizeof(uint32_t));
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        erases_before[block] = NAND_Sim_Erase_Count(NAND_FTL_FIRST_BLOCK + block);
+    }
+    uint64_t start_ns = NAND_Sim_Time_ns(), busy_ns = 0, idle_ns = 0;
+    uint64_t read_bytes = 0, write_bytes = 0, read_ns = 0, write_ns = 0;
+    const NAND_TraceRecord *previous = NULL;
+
+    for (uint32_t i = 0; i < num_records; i++) {
+        const NAND_TraceRecord *record = &records[i];
+        if (record -> op == 0 || record -> op >= NUM_OPS) {
+            continue;
+        }
+
+        if (idle_gaps && previous != NULL) {
+            uint64_t gap_ns = (uint64_t) (uint32_t) (record -> time_us - previous -> time_us - previous -> duration_us) * 1000;
+            uint64_t idle_start = NAND_Sim_Time_ns();
+            while (NAND_Idle_Pending() && NAND_Sim_Time_ns() - idle_start < gap_ns) {
+                NAND_Idle(&hspi);
+            }
+            idle_ns += NAND_Sim_Time_ns() - idle_start;
+        }
+
+        uint64_t t0 = NAND_Sim_Time_ns();
+        NAND_ReturnType status = replay(record, buffer);
+        uint64_t elapsed = NAND_Sim_Time_ns() - t0;
+
+        OpStats *stats = &ops[record -> op];
+        stats -> replay_us[stats -> count++] = elapsed / 1000;
+        stats -> bytes += record -> length;
+        busy_ns += elapsed;
+        if (record -> op == NAND_TRACE_READ) {
+            read_bytes += record -> length;
+            read_ns    += elapsed;
+        } else if (record -> op == NAND_TRACE_WRITE || record -> op == NAND_TRACE_TXN_WRITE) {
+            write_bytes += record -> length;
+            write_ns    += elapsed;
+        }
+        if (status != record -> status) {
+            mismatches++;
+        }
+        previous = record;
+    }
+
+    NAND_Sim_Get_Counters(&after);
+    NAND_Get_Stats(&stats_after);
+
+    printf("trace: %u records, %u dropped before saving\n", num_records, dropped);
+    printf("%-11s %8s %10s %9s %8s %8s %9s %9s %9s\n", "call", "count", "KB", "mean us", "p50 us", "p99 us",
+           "max us", "field us", "field max");
+    for (uint8_t op = 1; op < NUM_OPS; op++) {
+        if (ops[op].count > 0) {
+            print_latency(op_names[op], &ops[op]);
+        }
+    }
+    if (mismatches > 0) {
+        printf("%u calls returned a different status than recorded\n", mismatches);
+    }
+
+    printf("\nsimulated time %.3f s: %.3f s in calls, %.3f s in NAND_Idle between them\n",
+           (NAND_Sim_Time_ns() - start_ns) / 1e9, busy_ns / 1e9, idle_ns / 1e9);
+    printf("throughput: read %.2f MB/s, write %.2f MB/s (bytes over time spent in the calls)\n",
+           read_ns ? read_bytes / (read_ns / 1e9) / 1e6 : 0.0, write_ns ? write_bytes / (write_ns / 1e9) / 1e6 : 0.0);
+
+    printf("\n%-14s %10s %10s %12s\n", "flash", "replay", "field", "field mean us");
+    uint64_t replayed[NUM_LLD_OPS] = {
+        after.page_reads - before.page_reads, after.page_programs - before.page_programs,
+        after.block_erases - before.block_erases,
+    };
+    for (uint8_t op = 0; op < NUM_LLD_OPS; op++) {
+        printf("%-14s %10lu %10u %12.1f\n", lld_names[op], (unsigned long) replayed[op], lld_ops[op].count,
+               lld_ops[op].count ? (double) lld_ops[op].field_us / lld_ops[op].count : 0.0);
+    }
+
+    uint64_t host = stats_after.host_bytes_written - stats_before.host_bytes_written;
+    uint64_t programmed = stats_after.pages_programmed - stats_before.pages_programmed;
+    printf("\nwrite amplification %.3f (%lu pages programmed for %lu host bytes)\n",
+           host ? (double) programmed * PAGE_DATA_SIZE / host : 0.0, (unsigned long) programmed, (unsigned long) host);
+
+    uint32_t min = UINT32_MAX, max = 0;
+    uint64_t total = 0;
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        uint32_t erases = NAND_Sim_Erase_Count(NAND_FTL_FIRST_BLOCK + block) - erases_before[block];
+        min    = erases < min ? erases : min;
+        max    = erases > max ? erases : max;
+        total += erases;
+    }
+    printf("erases per block during replay: min %u avg %.2f max %u; lifetime min %u avg %u max %u\n",
+           min, (double) total / NAND_FTL_NUM_BLOCKS, max, stats_after.erase_min, stats_after.erase_avg, stats_after.erase_max);
+
+    return 0;
+}
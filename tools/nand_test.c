@@ -0,0 +1,493 @@
+/************************** Flash Memory Driver ***********************************
+
+    Filename:    nand_test.c
+    Description: Host tests of the FTL: seeded random operations against the simulated
+                 device, checked against a copy of the logical space kept in RAM, across
+                 remounts.
+
+    Version:     0.1
+    Author:      Tharun Suresh
+
+********************************************************************************
+
+    Build and run on a Linux host from the repository root, once per configuration: the
+    defaults, then each of NAND_COMPRESSION, NAND_MAP_EXTENTS, NAND_MAP_DEMAND,
+    NAND_PARTIAL_PROGRAM, NAND_PAGE_CRC and NAND_BLOCK_SUMMARY set on the command line, and
+    NAND_MAP_EXTENTS with NAND_BLOCK_SUMMARY:
+
+        gcc -O2 -I. -Itools/host [-DNAND_COMPRESSION=1] tools/nand_test.c tools/host/nand_sim.c \
+            nand_m79a.c nand_m79a_lld.c nand_spi.c nand_lz.c nand_crc.c nand_trace.c nand_pool.c -o nand_test
+        ./nand_test [-s seed] [-n operations]
+
+    Seeds that found bugs before are worth keeping in the runs: 3, 12, 16 and 18 with
+    -n 10000 under NAND_MAP_EXTENTS, and 4 and 16 under NAND_COMPRESSION.
+
+    Every test starts from an erased device. After each remount (NAND_Sync, then NAND_Init)
+    the whole logical space is read back and compared with the model:
+
+        remount     random writes, trims, syncs and NAND_Idle steps, remounted now and then;
+                    also checks that the statistics survive each remount, and that blocks
+                    erased before a remount are not erased again after it
+        txn         transactions committed, aborted, or left open at a remount, which
+                    must roll them back; and later transactions must not revive them
+        trim        trimmed ranges read back erased across remounts, also once space
+                    reclamation has moved their trim records
+        full        the logical space filled and overwritten at random, then filled with
+                    fragmented writes until the FTL refuses one; trims must make room
+                    again, and the device must mount in every state it accepted
+
+    A write the FTL refuses (Ret_MemoryOverflow) may have written some of its pages; those
+    must read back either old or new. The exit status is the number of failed tests.
+
+********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nand_m79a.h"
+#include "nand_sim.h"
+
+#define MAX_WRITE       (4 * PAGE_DATA_SIZE)
+#define QUARTER_SIZE    (NAND_NUM_LOGICAL_PAGES / 4 * PAGE_DATA_SIZE)
+
+static SPI_HandleTypeDef hspi;
+static uint8_t *model;                  // expected contents of the logical space
+static uint8_t buffer[MAX_WRITE];
+static uint8_t readback[PAGE_DATA_SIZE];
+static uint32_t random_state;
+static uint32_t failures;               // of the running test
+static uint32_t remounts;
+static uint64_t erases_seen;            // NAND_Get_Stats blocks_erased, as last seen
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void fail(const char *format, uint32_t a, uint32_t b) {
+    if (failures++ < 10) {
+        printf("    ");
+        printf(format, a, b);
+        printf("\n");
+    }
+}
+
+/* data that compresses well or not at all, so both paths of NAND_COMPRESSION are taken */
+static void fill_data(uint8_t *data, uint32_t length) {
+    uint8_t compressible = next_random() % 2;
+
+    for (uint32_t i = 0; i < length; i++) {
+        data[i] = compressible ? (uint8_t) (i / 64 + random_state) : (uint8_t) next_random();
+    }
+}
+
+static uint32_t sim_erases(void) {
+    uint32_t total = 0;
+
+    for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+        total += NAND_Sim_Erase_Count(NAND_FTL_FIRST_BLOCK + block);
+    }
+    return total;
+}
+
+/* starts a test on an erased, freshly mounted device with an erased model */
+static int start(uint32_t seed) {
+    NAND_Sim_Reset(32e6);
+    hspi.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_2;
+    memset(model, 0xFF, NAND_LOGICAL_SIZE_BYTES);
+    random_state = seed ? seed : 1;
+    failures     = 0;
+    remounts     = 0;
+    erases_seen  = 0;
+
+    if (NAND_Init(&hspi) != Ret_Success) {
+        fail("first mount failed", 0, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/* compares the whole logical space with the model */
+static void check_all(void) {
+    for (uint32_t page = 0; page < NAND_NUM_LOGICAL_PAGES; page++) {
+        NAND_Addr address = page * PAGE_DATA_SIZE;
+        NAND_ReturnType status = NAND_Read(&hspi, &address, readback, PAGE_DATA_SIZE);
+
+        if (status != Ret_Success) {
+            fail("read of logical page %u returned %u", page, status);
+        } else if (memcmp(readback, &model[address], PAGE_DATA_SIZE) != 0) {
+            fail("logical page %u does not match after %u remounts", page, remounts);
+        }
+    }
+}
+
+/* NAND_Sync, NAND_Init and a full check; the statistics must have come back too */
+static int remount(void) {
+    NAND_Stats stats;
+    NAND_ReturnType status = NAND_Sync(&hspi);
+
+    if (status != Ret_Success) {
+        fail("sync before remount %u returned %u", remounts, status);
+    }
+    NAND_Get_Stats(&stats);
+    if (stats.blocks_erased != sim_erases()) {
+        fail("%u erases counted, the device did %u", (uint32_t) stats.blocks_erased, sim_erases());
+    }
+    erases_seen = stats.blocks_erased;
+
+    status = NAND_Init(&hspi);
+    remounts++;
+    if (status != Ret_Success) {
+        fail("remount %u returned %u", remounts, status);
+        return -1;
+    }
+    NAND_Get_Stats(&stats);
+    if (stats.blocks_erased < erases_seen) {
+        fail("erase count went back from %u to %u at a remount", (uint32_t) erases_seen, (uint32_t) stats.blocks_erased);
+    }
+    check_all();
+    return 0;
+}
+
+/* a write that may be refused for lack of space: what reached flash must be old or new */
+static NAND_ReturnType write_checked(NAND_Addr address, uint32_t length, uint8_t may_overflow) {
+    NAND_ReturnType status;
+
+    fill_data(buffer, length);
+    status = NAND_Write(&hspi, &address, buffer, length);
+    if (status == Ret_Success) {
+        memcpy(&model[address], buffer, length);
+        return status;
+    }
+    if (status != Ret_MemoryOverflow || !may_overflow) {
+        fail("write at %u returned %u", address, status);
+        return status;
+    }
+
+    for (uint32_t done = 0; done < length; ) {
+        NAND_Addr page_start = (address + done) / PAGE_DATA_SIZE * PAGE_DATA_SIZE;
+        uint16_t offset = (address + done) - page_start;
+        uint32_t chunk = PAGE_DATA_SIZE - offset;
+        if (chunk > length - done) {
+            chunk = length - done;
+        }
+        if (NAND_Read(&hspi, &page_start, readback, PAGE_DATA_SIZE) != Ret_Success) {
+            fail("read after a refused write at %u failed", address, 0);
+        } else if (memcmp(&readback[offset], &buffer[done], chunk) == 0) {
+            memcpy(&model[address + done], &buffer[done], chunk);
+        } else if (memcmp(readback, &model[page_start], PAGE_DATA_SIZE) != 0) {
+            fail("refused write at %u left logical page %u neither old nor new", address, page_start / PAGE_DATA_SIZE);
+        }
+        done += chunk;
+    }
+    return status;
+}
+
+static void trim_checked(NAND_Addr address, uint32_t length) {
+    NAND_ReturnType status = NAND_Trim(&hspi, &address, length);
+    uint32_t first_page = (address + PAGE_DATA_SIZE - 1) / PAGE_DATA_SIZE;
+    uint32_t end_page   = (address + length) / PAGE_DATA_SIZE;
+
+    if (status != Ret_Success) {
+        fail("trim at %u returned %u", address, status);
+        return;
+    }
+    if (end_page > first_page) {
+        memset(&model[first_page * PAGE_DATA_SIZE], 0xFF, (end_page - first_page) * PAGE_DATA_SIZE);
+    }
+}
+
+/* only the extent table runs out: trimming a quarter of the space merges extents again */
+static NAND_Addr trim_quarter(void) {
+    NAND_Addr address = (next_random() % 4) * QUARTER_SIZE;
+
+    trim_checked(address, QUARTER_SIZE);
+    return address;
+}
+
+/* an address and length inside the logical space, mostly page aligned */
+static void random_range(NAND_Addr *address, uint32_t *length, uint32_t max_length) {
+    uint32_t page = next_random() % NAND_NUM_LOGICAL_PAGES;
+
+    if (next_random() % 4 == 0) {
+        *address = page * PAGE_DATA_SIZE + next_random() % PAGE_DATA_SIZE;
+        *length  = 1 + next_random() % max_length;
+    } else {
+        *address = page * PAGE_DATA_SIZE;
+        *length  = (1 + next_random() % (max_length / PAGE_DATA_SIZE)) * PAGE_DATA_SIZE;
+    }
+    if (*length > NAND_LOGICAL_SIZE_BYTES - *address) {
+        *length = NAND_LOGICAL_SIZE_BYTES - *address;
+    }
+}
+
+
+/******************************************************************************
+ *                                  Tests
+ *****************************************************************************/
+
+static void test_remount(uint32_t seed, uint32_t operations) {
+    NAND_Addr address;
+    uint32_t length;
+    uint32_t reerased = 0;
+
+    if (start(seed) != 0) {
+        return;
+    }
+    for (uint32_t op = 0; op < operations && failures == 0; op++) {
+        uint32_t choice = next_random() % 100;
+
+        if (choice < 70) {
+            random_range(&address, &length, MAX_WRITE);
+            if (write_checked(address, length, NAND_MAP_EXTENTS) == Ret_MemoryOverflow) {
+                trim_quarter();
+            }
+        } else if (choice < 80) {
+            random_range(&address, &length, 16 * PAGE_DATA_SIZE);
+            trim_checked(address, length);
+        } else if (choice < 85) {
+            if (NAND_Sync(&hspi) != Ret_Success) {
+                fail("sync returned an error at operation %u", op, 0);
+            }
+        } else if (choice < 99) {
+            /* a busy device only gets short idle periods */
+            if (NAND_Idle_Pending() && NAND_Idle(&hspi) != Ret_Success) {
+                fail("idle returned an error at operation %u", op, 0);
+            }
+        } else {
+            uint8_t erased[NAND_FTL_NUM_BLOCKS];
+            uint32_t before[NAND_FTL_NUM_BLOCKS];
+
+            for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+                erased[block] = NAND_Sim_Is_Erased(NAND_FTL_FIRST_BLOCK + block);
+                before[block] = NAND_Sim_Erase_Count(NAND_FTL_FIRST_BLOCK + block);
+            }
+            if (remount() != 0) {
+                break;
+            }
+            /* blocks erased before the remount must be known as erased after it */
+            while (NAND_Idle_Pending()) {
+                NAND_ReturnType status = NAND_Idle(&hspi);
+                if (status != Ret_Success) {
+                    fail("idle after remount %u returned %u", remounts, status);
+                    break;
+                }
+            }
+            for (uint16_t block = 0; block < NAND_FTL_NUM_BLOCKS; block++) {
+                if (erased[block] && NAND_Sim_Erase_Count(NAND_FTL_FIRST_BLOCK + block) > before[block]) {
+                    reerased++;
+                }
+            }
+        }
+    }
+    if (failures == 0) {
+        remount();
+    }
+    /* blocks erased in the foreground right before a remount may not be listed yet */
+    if (reerased > (remounts + 1) * NAND_FTL_GC_THRESHOLD) {
+        fail("%u erased blocks were erased again after %u remounts", reerased, remounts);
+    }
+    printf("remount: %s (%u remounts, %u blocks erased again)\n", failures ? "FAILED" : "ok", remounts, reerased);
+}
+
+static void test_txn(uint32_t seed, uint32_t rounds) {
+    if (start(seed) != 0) {
+        return;
+    }
+    for (uint32_t round = 0; round < rounds && failures == 0; round++) {
+        uint32_t pages[NAND_TXN_MAX_PAGES];
+        uint8_t *data = malloc(NAND_TXN_MAX_PAGES * PAGE_DATA_SIZE);
+        uint32_t count = 1 + next_random() % NAND_TXN_MAX_PAGES;
+        uint32_t outcome = next_random() % 3;
+        NAND_ReturnType status;
+
+        /* some plain writes, so that transactions land in blocks being reclaimed */
+        for (uint32_t i = 0; i < 40; i++) {
+            NAND_Addr address;
+            uint32_t length;
+            random_range(&address, &length, MAX_WRITE);
+            if (write_checked(address, length, NAND_MAP_EXTENTS) == Ret_MemoryOverflow) {
+                trim_quarter();
+            }
+        }
+        NAND_Sync(&hspi);
+
+        /* a full extent table also refuses the rollback NAND_Txn_Begin may retry */
+        status = NAND_Txn_Begin(&hspi);
+        if (status == Ret_MemoryOverflow && NAND_MAP_EXTENTS) {
+            trim_quarter();
+            status = NAND_Txn_Begin(&hspi);
+        }
+        if (status != Ret_Success) {
+            fail("txn begin returned %u in round %u", status, round);
+            free(data);
+            break;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            NAND_Addr address;
+            pages[i] = next_random() % NAND_NUM_LOGICAL_PAGES;
+            address  = pages[i] * PAGE_DATA_SIZE;
+            fill_data(&data[i * PAGE_DATA_SIZE], PAGE_DATA_SIZE);
+            /* a partial write merges with the copy written earlier in the transaction */
+            status = NAND_Txn_Write(&hspi, &address, &data[i * PAGE_DATA_SIZE], PAGE_DATA_SIZE / 2);
+            if (status == Ret_Success) {
+                address += PAGE_DATA_SIZE / 2;
+                status = NAND_Txn_Write(&hspi, &address, &data[i * PAGE_DATA_SIZE + PAGE_DATA_SIZE / 2], PAGE_DATA_SIZE / 2);
+            }
+            if (status != Ret_Success) {
+                fail("txn write returned %u in round %u", status, round);
+                break;
+            }
+        }
+
+        if (failures == 0 && outcome == 0) {
+            status = NAND_Txn_Commit(&hspi);
+            if (status == Ret_Success) {
+                for (uint32_t i = 0; i < count; i++) {
+                    memcpy(&model[pages[i] * PAGE_DATA_SIZE], &data[i * PAGE_DATA_SIZE], PAGE_DATA_SIZE);
+                }
+            } else if (status == Ret_MemoryOverflow && NAND_MAP_EXTENTS) {
+                /* refused for lack of extents, the transaction is still open */
+                outcome = 1;
+            } else {
+                fail("txn commit returned %u in round %u", status, round);
+            }
+        }
+        if (failures == 0 && outcome == 1) {
+            /* closed even if the rollback is refused; NAND_Txn_Begin retries it */
+            status = NAND_Txn_Abort(&hspi);
+            if (status == Ret_MemoryOverflow && NAND_MAP_EXTENTS) {
+                trim_quarter();
+            } else if (status != Ret_Success) {
+                fail("txn abort returned %u in round %u", status, round);
+            }
+        }
+        free(data);
+
+        /* left open: the remount is the power loss that rolls it back */
+        if (failures == 0 && (outcome == 2 || next_random() % 2 == 0)) {
+            remount();
+        }
+    }
+    if (failures == 0) {
+        remount();
+    }
+    printf("txn: %s (%u rounds, %u remounts)\n", failures ? "FAILED" : "ok", rounds, remounts);
+}
+
+static void test_trim(uint32_t seed, uint32_t rounds) {
+    if (start(seed) != 0) {
+        return;
+    }
+    for (uint32_t round = 0; round < rounds && failures == 0; round++) {
+        NAND_Addr address;
+        uint32_t length;
+
+        /* write a range, trim most of it, and rewrite elsewhere until the records move */
+        random_range(&address, &length, MAX_WRITE);
+        write_checked(address, length, NAND_MAP_EXTENTS);
+        for (uint32_t i = 0; i < 8; i++) {
+            random_range(&address, &length, 32 * PAGE_DATA_SIZE);
+            trim_checked(address, length);
+        }
+        for (uint32_t i = 0; i < 200; i++) {
+            random_range(&address, &length, MAX_WRITE);
+            write_checked(address, length, NAND_MAP_EXTENTS);
+            if (i % 8 == 0 && NAND_Idle_Pending()) {
+                NAND_Idle(&hspi);
+            }
+        }
+        remount();
+    }
+    printf("trim: %s (%u rounds)\n", failures ? "FAILED" : "ok", rounds);
+}
+
+static void test_full(uint32_t seed, uint32_t operations) {
+    NAND_Addr address;
+    NAND_ReturnType status;
+    uint32_t refused = 0;
+
+    if (start(seed) != 0) {
+        return;
+    }
+
+    /* every logical page written, then overwritten at random: there is always room */
+    for (uint32_t page = 0; page < NAND_NUM_LOGICAL_PAGES && failures == 0; page++) {
+        write_checked(page * PAGE_DATA_SIZE, PAGE_DATA_SIZE, 0);
+    }
+    for (uint32_t op = 0; op < operations && failures == 0; op++) {
+        address = (next_random() % NAND_NUM_LOGICAL_PAGES) * PAGE_DATA_SIZE;
+        write_checked(address, PAGE_DATA_SIZE, NAND_MAP_EXTENTS);
+        if (op % 16 == 0 && NAND_Idle_Pending()) {
+            NAND_Idle(&hspi);
+        }
+        if (op % (operations / 4 + 1) == 0) {
+            remount();
+        }
+    }
+
+    /* single pages all over the space: only a full extent table may refuse them */
+    for (uint32_t op = 0; op < operations && failures == 0; op++) {
+        address = (next_random() % NAND_NUM_LOGICAL_PAGES) * PAGE_DATA_SIZE + next_random() % 2 * PAGE_DATA_SIZE / 2;
+        if (write_checked(address, PAGE_DATA_SIZE / 2, NAND_MAP_EXTENTS) == Ret_MemoryOverflow) {
+            refused++;
+            if (remount() != 0) {
+                break;
+            }
+            /* the rest may still hold too many extents, but not once all of it is trimmed */
+            address = trim_quarter();
+            status  = write_checked(address, PAGE_DATA_SIZE, 1);
+            for (uint8_t quarter = 1; quarter < 4 && status == Ret_MemoryOverflow; quarter++) {
+                trim_checked((address + quarter * QUARTER_SIZE) % (4 * QUARTER_SIZE), QUARTER_SIZE);
+                status = write_checked(address, PAGE_DATA_SIZE, quarter < 3);
+            }
+            if (status != Ret_Success) {
+                break;
+            }
+        }
+    }
+    if (failures == 0) {
+        remount();
+    }
+    printf("full: %s (%u writes refused)\n", failures ? "FAILED" : "ok", refused);
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t seed = 1, operations = 20000;
+    uint32_t failed = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:n:")) != -1) {
+        switch (option) {
+        case 's': seed       = strtoul(optarg, NULL, 0); break;
+        case 'n': operations = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed] [-n operations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    model = malloc(NAND_LOGICAL_SIZE_BYTES);
+    if (model == NULL) {
+        return 1;
+    }
+    printf("seed %u, compression %d, extents %d, demand %d, partial program %d, page crc %d, summary %d\n",
+           seed, NAND_COMPRESSION, NAND_MAP_EXTENTS, NAND_MAP_DEMAND, NAND_PARTIAL_PROGRAM, NAND_PAGE_CRC,
+           NAND_BLOCK_SUMMARY);
+
+    test_remount(seed, operations);
+    failed += failures > 0;
+    test_txn(seed, operations / 200);
+    failed += failures > 0;
+    test_trim(seed, operations / 1000 + 1);
+    failed += failures > 0;
+    test_full(seed, operations / 8);
+    failed += failures > 0;
+
+    return failed;
+}